@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <GuitarPro.h>
+#include <IntList.h>
+
+
+namespace
+{
+
+const char* g_usage = R"(Usage: mooer-bench <command> [input]...
+
+Commands:
+  ints      Time the Guitar Pro index list parser against std::istringstream
+  compare   Read Guitar Pro 7/8 scores with the DOM and the streaming reader, and compare their tables.
+            Inputs are .gp files or directories, which are searched recursively.
+)";
+
+
+/// Time Text::AppendInts against the stream it replaced, on lists like the <Beats> and <Notes> of a score
+int Ints()
+{
+	for(std::size_t length : {4, 64, 4096})
+	{
+		std::string list;
+		for(std::size_t i = 0; i < length; i++)
+			list += std::to_string(7 * i + i % 5) + (i % 16 == 15 ? "\n" : " ");
+		const std::size_t repeats = (std::size_t(1) << 22) / length;
+
+		auto time = [&](auto&& parse)
+		{
+			std::vector<int> dst;
+			auto start = std::chrono::steady_clock::now();
+			for(std::size_t n = 0; n < repeats; n++)
+			{
+				dst.clear();
+				parse(list, dst);
+			}
+			std::chrono::duration<double, std::nano> dt = std::chrono::steady_clock::now() - start;
+			return std::make_pair(dt.count() / (repeats * length), dst);
+		};
+		auto [nsStream, stream] = time(
+			[](const std::string& s, std::vector<int>& dst)
+			{
+				std::istringstream in(s);
+				std::copy(std::istream_iterator<int>(in), std::istream_iterator<int>(), std::back_inserter(dst));
+			});
+		auto [nsChars, chars] = time([](const std::string& s, std::vector<int>& dst) { Text::AppendInts(s, dst); });
+		if(stream != chars)
+			throw std::runtime_error("Parsers disagree on a list of " + std::to_string(length));
+
+		std::cout << std::setw(5) << length << " values: istringstream " << nsStream << " ns/value, from_chars "
+				  << nsChars << " ns/value, " << nsStream / nsChars << "x\n";
+	}
+	return 0;
+}
+
+/// Check that ReaderV78::Stream() reads \p inputs like ReaderV78::Read(), and time both
+int Compare(const std::vector<std::filesystem::path>& inputs)
+{
+	std::vector<std::filesystem::path> scores;
+	for(const auto& input : inputs)
+	{
+		if(!std::filesystem::is_directory(input))
+		{
+			scores.push_back(input);
+			continue;
+		}
+		for(const auto& entry : std::filesystem::recursive_directory_iterator(input))
+		{
+			if(entry.is_regular_file() && entry.path().extension() == ".gp")
+				scores.push_back(entry.path());
+		}
+	}
+	if(scores.empty())
+		throw std::runtime_error("No scores to compare\n\n" + std::string(g_usage));
+
+	std::size_t nrDifferent = 0, nrFailed = 0;
+	std::chrono::duration<double> dom{}, stream{};
+	for(const auto& fn : scores)
+	{
+		try
+		{
+			auto start = std::chrono::steady_clock::now();
+			auto read = GuitarPro::ReaderV78::Read(fn);
+			auto mid = std::chrono::steady_clock::now();
+			auto streamed = GuitarPro::ReaderV78::Stream(fn);
+			dom += mid - start;
+			stream += std::chrono::steady_clock::now() - mid;
+
+			if(auto table = read.Difference(streamed); !table.empty())
+			{
+				std::cout << fn.string() << ": " << table << " differ\n";
+				nrDifferent++;
+			}
+		}
+		catch(std::exception& e)
+		{
+			std::cout << fn.string() << ": " << e.what() << '\n';
+			nrFailed++;
+		}
+	}
+
+	std::cout << scores.size() << " scores, " << nrDifferent << " differ, " << nrFailed << " failed. DOM "
+			  << dom.count() << " s, stream " << stream.count() << " s\n";
+	return nrDifferent > 0 || nrFailed > 0 ? 1 : 0;
+}
+
+} // namespace
+
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		std::string command = argc > 1 ? argv[1] : "";
+		if(command == "ints")
+			return Ints();
+		if(command == "compare")
+			return Compare(std::vector<std::filesystem::path>(argv + 2, argv + argc));
+		throw std::runtime_error(g_usage);
+	}
+	catch(std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return -1;
+	}
+}
@@ -0,0 +1,415 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <CabinetIR.h>
+#include <FileView.h>
+#include <Parallel.h>
+#include <PresetJson.h>
+
+
+namespace
+{
+
+using namespace Mooer;
+
+const char* g_usage = R"(Usage: mooer-cli <command> [options] <input>...
+
+Commands:
+  convert   Convert every preset of the inputs to a separate file
+  pack      Combine the presets of the inputs into one backup, in order
+  cab       Prepare .wav impulse responses for a cabinet slot
+
+Inputs are .mo presets, .mbf backups or .json presets, or .wav files for cab.
+Directories are searched recursively, convert keeps their subdirectories in the output.
+
+Options:
+  -o <path>    Output directory for convert and cab, output .mbf file for pack
+  -f <format>  Output format for convert: mo or json (default)
+  -m <model>   Model name in the header of a packed backup (default GE200)
+  -j <n>       Number of threads (default: all cores)
+  -l <dB>      Level of the impulse responses for cab (default 0 dB, which never clips)
+  -p           Convert impulse responses to minimum phase
+)";
+
+enum class Format
+{
+	None,
+	MO,
+	MBF,
+	JSON,
+	WAV
+};
+
+
+Format GetFormat(const std::filesystem::path& fn)
+{
+	auto ext = fn.extension().string();
+	std::transform(begin(ext), end(ext), begin(ext), [](unsigned char c) { return std::tolower(c); });
+	if(ext == ".mo")
+		return Format::MO;
+	if(ext == ".mbf")
+		return Format::MBF;
+	if(ext == ".json")
+		return Format::JSON;
+	if(ext == ".wav")
+		return Format::WAV;
+	return Format::None;
+}
+
+
+struct Options
+{
+	std::string command;
+	std::filesystem::path output;
+	Format format = Format::JSON;
+	std::string model = "GE200";
+	unsigned nrThreads = Parallel::NrThreads();
+	Conditioning conditioning;
+	std::vector<std::filesystem::path> inputs;
+};
+
+
+Options ParseArguments(int argc, char* argv[])
+{
+	if(argc < 2)
+		throw std::runtime_error(g_usage);
+
+	Options o;
+	o.command = argv[1];
+	for(int n = 2; n < argc; n++)
+	{
+		std::string_view arg = argv[n];
+		if(arg == "-p")
+		{
+			o.conditioning.minimumPhase = true;
+		}
+		else if(arg.size() == 2 && arg[0] == '-')
+		{
+			if(n + 1 >= argc)
+				throw std::runtime_error(std::string("Missing value for ") + argv[n]);
+			std::string value = argv[++n];
+			if(arg == "-o")
+				o.output = value;
+			else if(arg == "-f")
+				o.format = GetFormat("preset." + value);
+			else if(arg == "-m")
+				o.model = value;
+			else if(arg == "-j")
+				o.nrThreads = std::max(std::stoi(value), 1);
+			else if(arg == "-l")
+				o.conditioning.levelDb = std::stof(value);
+			else
+				throw std::runtime_error(std::string("Unknown option ") + std::string(arg) + "\n\n" + g_usage);
+		}
+		else
+		{
+			o.inputs.push_back(argv[n]);
+		}
+	}
+
+	if(o.command != "convert" && o.command != "pack" && o.command != "cab")
+		throw std::runtime_error("Unknown command " + o.command + "\n\n" + g_usage);
+	if(o.output.empty())
+		throw std::runtime_error("No output given (-o)");
+	if(o.format != Format::MO && o.format != Format::JSON)
+		throw std::runtime_error("Output format must be mo or json");
+	return o;
+}
+
+
+/**
+Files of a known format, directories are expanded recursively.
+\p outputs, if given, receives the path of each file relative to the input it was found in, without extension.
+*/
+std::vector<std::filesystem::path> ExpandInputs(const std::vector<std::filesystem::path>& inputs,
+												bool audio,
+												std::vector<std::filesystem::path>* outputs = nullptr)
+{
+	std::vector<std::filesystem::path> r;
+	for(const auto& input : inputs)
+	{
+		if(!std::filesystem::is_directory(input))
+		{
+			r.push_back(input);
+			if(outputs != nullptr)
+				outputs->push_back(input.stem());
+			continue;
+		}
+		std::vector<std::filesystem::path> files;
+		for(const auto& entry : std::filesystem::recursive_directory_iterator(input))
+		{
+			auto format = GetFormat(entry.path());
+			if(entry.is_regular_file() && format != Format::None && (format == Format::WAV) == audio)
+				files.push_back(entry.path());
+		}
+		std::sort(begin(files), end(files));
+		r.insert(end(r), begin(files), end(files));
+		if(outputs != nullptr)
+		{
+			for(const auto& fn : files)
+				outputs->push_back(fn.lexically_relative(input).replace_extension());
+		}
+	}
+	return r;
+}
+
+
+/// Throws if two of \p inputs would be written to the same of \p outputs
+void CheckCollisions(const std::vector<std::filesystem::path>& inputs,
+					 const std::vector<std::filesystem::path>& outputs)
+{
+	std::vector<std::size_t> order(inputs.size());
+	std::iota(begin(order), end(order), 0);
+	std::sort(begin(order), end(order), [&](auto a, auto b) { return outputs[a] < outputs[b]; });
+	auto same = std::adjacent_find(begin(order), end(order), [&](auto a, auto b) { return outputs[a] == outputs[b]; });
+	if(same != end(order))
+	{
+		std::stringstream ss;
+		ss << inputs[same[0]] << " and " << inputs[same[1]] << " would both be written to " << outputs[same[0]];
+		throw std::runtime_error(ss.str());
+	}
+}
+
+
+struct NamedPreset
+{
+	std::string stem; ///< File name to convert to, without extension
+	File::Preset preset;
+};
+
+
+/// All presets in \p fn, \p nrBytes is incremented with the size of the file
+std::vector<NamedPreset> ReadPresets(const std::filesystem::path& fn, std::atomic<std::uint64_t>& nrBytes)
+{
+	std::vector<NamedPreset> r;
+	auto stem = fn.stem().string();
+	switch(GetFormat(fn))
+	{
+	case Format::MO:
+	{
+		File::MappedMo mo(fn);
+		r.push_back({stem, mo->preset()});
+		nrBytes += sizeof(File::MO);
+		break;
+	}
+	case Format::MBF:
+	{
+		File::MappedMbf mbf(fn);
+		r.reserve(mbf->size());
+		for(int slot = 0; slot < mbf->size(); slot++)
+		{
+			std::stringstream ss;
+			ss << stem << '-' << std::setw(3) << std::setfill('0') << slot;
+			r.push_back({ss.str(), mbf->preset(slot)});
+		}
+		nrBytes += sizeof(File::Mbf);
+		break;
+	}
+	case Format::JSON:
+	{
+		std::ifstream f(fn, std::ios::binary);
+		std::string json((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+		r.push_back({stem, FromJson(json)});
+		nrBytes += json.size();
+		break;
+	}
+	default:
+		throw std::runtime_error("Unknown file type " + fn.string());
+	}
+	return r;
+}
+
+
+void WritePreset(const std::filesystem::path& fn, const File::Preset& preset, Format format)
+{
+	std::ofstream f(fn, std::ios::binary);
+	if(format == Format::MO)
+	{
+		File::MO mo{};
+		static_cast<File::Preset&>(mo.preset) = preset;
+		f.write(reinterpret_cast<const char*>(&mo), sizeof(mo));
+	}
+	else
+	{
+		f << ToJson(preset);
+	}
+	if(!f)
+		throw std::runtime_error("Could not write " + fn.string());
+}
+
+
+class Throughput
+{
+public:
+	/// \p items: what is counted in nrItems
+	Throughput(std::string_view items)
+		: m_items(items), m_start(std::chrono::steady_clock::now())
+	{
+	}
+
+	void Report(std::ostream& os) const
+	{
+		std::chrono::duration<double> dt = std::chrono::steady_clock::now() - m_start;
+		double seconds = std::max(dt.count(), 1e-9);
+		os << nrFiles << " files (" << nrFailed << " failed), " << nrItems << ' ' << m_items << ", " << nrBytes / 1e6
+		   << " MB in " << seconds << " s: " << nrFiles / seconds << " files/s, " << nrItems / seconds << ' '
+		   << m_items << "/s, " << nrBytes / 1e6 / seconds << " MB/s\n";
+	}
+
+	std::atomic<std::uint64_t> nrFiles = 0, nrFailed = 0, nrItems = 0, nrBytes = 0;
+
+private:
+	std::string_view m_items;
+	std::chrono::steady_clock::time_point m_start;
+};
+
+
+/// Call \p f for all \p inputs in parallel, it returns the number of items processed. Errors are reported per file.
+template<typename F>
+void ForEachFile(const std::vector<std::filesystem::path>& inputs, unsigned nrThreads, Throughput& stats, F&& f)
+{
+	std::mutex errMutex;
+	Parallel::For(inputs.size(),
+				  [&](std::size_t n)
+				  {
+					  try
+					  {
+						  stats.nrItems += f(n);
+						  stats.nrFiles++;
+					  }
+					  catch(std::exception& e)
+					  {
+						  stats.nrFailed++;
+						  std::lock_guard lock{errMutex};
+						  std::cerr << inputs[n].string() << ": " << e.what() << '\n';
+					  }
+				  },
+				  nrThreads);
+}
+
+
+int Convert(const Options& o)
+{
+	Throughput stats("presets");
+	std::vector<std::filesystem::path> outputs;
+	auto inputs = ExpandInputs(o.inputs, false, &outputs);
+	CheckCollisions(inputs, outputs);
+	const auto ext = o.format == Format::MO ? ".mo" : ".json";
+
+	// The directories below an input are mirrored in the output
+	for(const auto& out : outputs)
+		std::filesystem::create_directories(o.output / out.parent_path());
+
+	ForEachFile(inputs,
+				o.nrThreads,
+				stats,
+				[&](std::size_t n)
+				{
+					auto presets = ReadPresets(inputs[n], stats.nrBytes);
+					for(const auto& p : presets)
+						WritePreset(o.output / outputs[n].parent_path() / (p.stem + ext), p.preset, o.format);
+					return presets.size();
+				});
+
+	stats.Report(std::cerr);
+	return stats.nrFailed > 0 ? 1 : 0;
+}
+
+
+int Pack(const Options& o)
+{
+	Throughput stats("presets");
+	auto inputs = ExpandInputs(o.inputs, false);
+	std::vector<std::vector<NamedPreset>> files(inputs.size());
+	ForEachFile(inputs,
+				o.nrThreads,
+				stats,
+				[&](std::size_t n)
+				{
+					files[n] = ReadPresets(inputs[n], stats.nrBytes);
+					return files[n].size();
+				});
+
+	if(stats.nrFailed > 0)
+		throw std::runtime_error("Not all inputs could be read, no backup written");
+
+	auto mbf = std::make_unique<File::Mbf>(File::NewBackup(o.model));
+	std::size_t slot = 0;
+	for(const auto& presets : files)
+	{
+		for(const auto& p : presets)
+		{
+			if(slot >= mbf->presets.size())
+			{
+				std::stringstream ss;
+				ss << "A backup holds at most " << mbf->presets.size() << " presets";
+				throw std::runtime_error(ss.str());
+			}
+			static_cast<File::Preset&>(mbf->presets[slot++].preset) = p.preset;
+		}
+	}
+	File::SaveBackup(o.output, *mbf);
+
+	stats.Report(std::cerr);
+	return 0;
+}
+
+
+int Cabinets(const Options& o)
+{
+	Throughput stats("responses");
+	std::vector<std::filesystem::path> outputs;
+	auto inputs = ExpandInputs(o.inputs, true, &outputs);
+	CheckCollisions(inputs, outputs);
+
+	// The directories below an input are mirrored in the output
+	for(const auto& out : outputs)
+		std::filesystem::create_directories(o.output / out.parent_path());
+
+	ForEachFile(inputs,
+				o.nrThreads,
+				stats,
+				[&](std::size_t n)
+				{
+					IO::MappedFile wav(inputs[n]);
+					auto ir = Condition(ToCabinetRate(RIFF::Read(wav.data())), o.conditioning);
+					SaveCabinet(o.output / outputs[n].parent_path() / inputs[n].filename(), Quantize(ir));
+					stats.nrBytes += wav.size();
+					return 1;
+				});
+
+	stats.Report(std::cerr);
+	return stats.nrFailed > 0 ? 1 : 0;
+}
+
+} // namespace
+
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		auto options = ParseArguments(argc, argv);
+		if(options.command == "pack")
+			return Pack(options);
+		if(options.command == "cab")
+			return Cabinets(options);
+		return Convert(options);
+	}
+	catch(std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return -1;
+	}
+}
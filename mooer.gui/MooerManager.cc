@@ -2,8 +2,13 @@
 
 #include <filesystem>
 #include <fstream>
+#include <sstream>
 
+#include <QDir>
 #include <QFileDialog>
+#include <QStandardPaths>
+
+#include <FileView.h>
 
 
 //#define DEBUG_LVL 3
@@ -50,33 +55,20 @@ private:
 };
 
 
-std::vector<std::uint8_t> ReadFile(std::filesystem::path fn)
-{
-	std::vector<std::uint8_t> data(std::filesystem::file_size(fn));
-	std::ifstream f(fn, std::ios::binary);
-	f.read(reinterpret_cast<char*>(data.data()), data.size());
-	return data;
-}
-
-
 MooerManager::MooerManager(QWidget* parent)
 	: m_usb({Mooer::vendor_id, Mooer::product_id}, this)
 	, m_mooer(&m_usb, this)
 	, m_need_patches(true)
+	, m_capabilities(nullptr)
 #ifdef MOOER_HAS_MIDI
 	, m_midi(MIDI::Interface::Create("MooerManager", this))
 #endif
+	, m_uploads(m_mooer)
 {
 	m_ui.setupUi(this);
 	m_ui.centralwidget->setEnabled(false);
 
-	m_ui.cb_amp_type->clear();
-	for(auto name : Mooer::amp_model_names)
-		m_ui.cb_amp_type->addItem(QString::fromStdString(std::string(name)));
-
-	m_ui.cb_cab_type->clear();
-	for(auto name : Mooer::cab_model_names)
-		m_ui.cb_cab_type->addItem(QString::fromStdString(std::string(name)));
+	UpdateModelLists();
 
 	m_ui.cbPatch->clear();
 	for(int n = 0; n < 200; n++)
@@ -99,9 +91,8 @@ MooerManager::MooerManager(QWidget* parent)
 				auto fileName =
 					QFileDialog::getOpenFileName(this, tr("Import Preset"), ptFileOpen, tr("Preset Files (*.mo)"));
 				std::filesystem::path fnPreset = fileName.toStdString();
-				auto data = ReadFile(fnPreset);
-				Mooer::File::MO mo(data);
-				m_mooer.LoadMoPreset(mo);
+				Mooer::File::MappedMo mo(fnPreset);
+				ImportPreset(mo->mo());
 			});
 	connect(m_ui.pbExportPreset,
 			&QPushButton::clicked,
@@ -119,6 +110,53 @@ MooerManager::MooerManager(QWidget* parent)
 					f.write(reinterpret_cast<const char*>(&mo), sizeof(mo));
 				};
 			});
+	connect(m_ui.actionSave_backup,
+			&QAction::triggered,
+			[this](bool)
+			{
+				auto fileName =
+					QFileDialog::getSaveFileName(this, tr("Save Backup"), ptFileOpen, tr("Backup Files (*.mbf)"));
+				if(fileName.isEmpty())
+					return;
+				try
+				{
+					std::lock_guard lock{m_dev_mutex};
+					std::string_view model = m_mooer.capabilities().model;
+					if(m_systemBackup && m_systemBackup->getModel() == model)
+						m_backup = std::make_unique<Mooer::BackupWriter>(fileName.toStdString(), *m_systemBackup);
+					else
+						m_backup = std::make_unique<Mooer::BackupWriter>(fileName.toStdString(), model);
+				}
+				catch(std::exception& e)
+				{
+					m_ui.statusbar->showMessage(e.what(), 5 * 1000);
+					return;
+				}
+				// The presets are written to the file as they arrive
+				m_backupTimer.start(1000);
+				m_mooer.SendPatchListRequest();
+			});
+	connect(m_ui.actionLoad_backup,
+			&QAction::triggered,
+			[this](bool)
+			{
+				auto fileName = QFileDialog::getOpenFileName(this,
+															 tr("Restore Backup"),
+															 ptFileOpen,
+															 tr("Backup Files (*.mbf);;Directory of Preset Files (*.mo)"));
+				if(!fileName.isEmpty())
+					RestoreBackup(fileName.toStdString());
+			});
+	connect(m_ui.actionVerify_uploads, &QAction::toggled, [this](bool checked) { m_uploads.SetVerify(checked); });
+	connect(m_ui.actionCancel_uploads,
+			&QAction::triggered,
+			[this](bool)
+			{
+				m_uploads.CancelAll();
+				std::lock_guard lock{m_dev_mutex};
+				if(m_restore)
+					m_restore->Cancel();
+			});
 	connect(m_ui.pbStorePreset,
 			&QPushButton::clicked,
 			[&](bool)
@@ -156,9 +194,11 @@ MooerManager::MooerManager(QWidget* parent)
 		{
 			qDebug() << "Connected to " << name;
 			m_ui.statusbar->showMessage(QString("Connected to %1, version %2").arg(name, version), 5 * 1000);
+			UpdateModelLists();
 			if(m_need_patches)
 			{
-				m_mooer.SendFlush();
+				if(m_mooer.capabilities().has(Mooer::Capabilities::NeedsFlushAfterIdentify))
+					m_mooer.SendFlush();
 				m_mooer.SendPatchListRequest();
 				m_need_patches = false;
 			}
@@ -198,6 +238,78 @@ MooerManager::MooerManager(QWidget* parent)
 
 	connect(this, &MooerManager::MooerSettingsChanged, this, &MooerManager::UpdateSettingsView);
 
+	connect(
+		this,
+		&MooerManager::MooerBackupSaved,
+		this,
+		[&](QString message) { m_ui.statusbar->showMessage(message, 5 * 1000); },
+		Qt::QueuedConnection);
+
+	connect(&m_backupTimer,
+			&QTimer::timeout,
+			[this]
+			{
+				std::lock_guard lock{m_dev_mutex};
+				if(m_backup && m_backup->idle() > std::chrono::seconds(5))
+				{
+					// An incomplete backup would restore empty presets, so it is not kept
+					m_ui.statusbar->showMessage(QString("Backup stopped after %1 of %2 presets, nothing was saved")
+													.arg(m_backup->count())
+													.arg(Mooer::BackupWriter::nrSlots),
+												5 * 1000);
+					m_backup->Abort();
+					m_backup.reset();
+				}
+				if(!m_backup)
+					m_backupTimer.stop();
+			});
+
+	connect(
+		this,
+		&MooerManager::MooerUploadProgress,
+		this,
+		[&](QString message, bool busy)
+		{
+			m_ui.statusbar->showMessage(message, busy ? 0 : 5 * 1000);
+			m_ui.actionCancel_uploads->setEnabled(busy);
+		},
+		Qt::QueuedConnection);
+
+	connect(
+		this,
+		&MooerManager::MooerUploadDone,
+		this,
+		[&](int group, int slot, QString name)
+		{
+			{
+				std::lock_guard lock{m_dev_mutex};
+				if(group == Mooer::RxFrame::CAB)
+					m_mstate.cabModelNames.set(slot, name.toStdString());
+				else
+					m_mstate.ampModelNames.set(slot, name.toStdString());
+			}
+			emit MooerSettingsChanged(static_cast<Mooer::RxFrame::Group>(group));
+		},
+		Qt::QueuedConnection);
+
+	connect(
+		this,
+		&MooerManager::MooerRestoreDone,
+		this,
+		[&](QString message)
+		{
+			m_restore_worker.join();
+			{
+				std::lock_guard lock{m_dev_mutex};
+				m_restore.reset();
+			}
+			m_ui.statusbar->showMessage(message, 10 * 1000);
+			m_ui.actionCancel_uploads->setEnabled(m_uploads.size() > 0);
+		},
+		Qt::QueuedConnection);
+
+	OpenJournal();
+
 	// Start USB
 	m_usb.StartEventLoop();
 	OnUsbConnected(m_usb.IsConnected());
@@ -207,7 +319,36 @@ MooerManager::MooerManager(QWidget* parent)
 
 MooerManager::~MooerManager()
 {
+	{
+		std::lock_guard lock{m_dev_mutex};
+		if(m_restore)
+			m_restore->Cancel();
+	}
 	m_usb.StopEventLoop();
+	m_mooer.SetJournal(nullptr);
+}
+
+
+void MooerManager::OpenJournal()
+{
+	QDir dir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation));
+	if(!dir.mkpath("."))
+		return;
+	std::filesystem::path fn = dir.filePath("session.journal").toStdString();
+	try
+	{
+		m_journal = std::make_unique<Mooer::Journal>(fn);
+	}
+	catch(std::exception& e)
+	{
+		qDebug() << "MooerManager: journal not available: " << e.what();
+		return;
+	}
+
+	// Show the last known state, until the pedal sends its own
+	m_mstate = m_journal->state();
+	UpdatePatchDropdown();
+	m_mooer.SetJournal(m_journal.get());
 }
 
 
@@ -269,7 +410,7 @@ void MooerManager::ConnectAmplifier()
 		    [=](bool e){ pS->enabled = e; send(); });
 	connect(m_ui.cb_amp_type, &QComboBox::currentIndexChanged,
 			[=, this](int i){
-				m_ui.pb_amp_load->setEnabled(i >= 55);
+				m_ui.pb_amp_load->setEnabled(i >= m_mooer.capabilities().firstUserAmp);
 				pS->type = i+1; send();
 			});
 	connect(m_ui.pb_amp_load, &QPushButton::clicked,
@@ -301,7 +442,7 @@ void MooerManager::ConnectCabinet()
 			[=](bool e){ pS->enabled = e; send(); });
 	connect(m_ui.cb_cab_type, &QComboBox::currentIndexChanged,
 			[=, this](int i){
-				m_ui.pb_cab_load->setEnabled(i >= 26);
+				m_ui.pb_cab_load->setEnabled(i >= m_mooer.capabilities().firstUserCab);
 				pS->type = i+1; send();
 			});
 	connect(m_ui.pb_cab_load, &QPushButton::clicked, [&]() { OnCabinetLoad(); });
@@ -386,7 +527,7 @@ void MooerManager::ConnectModulator()
 void MooerManager::OnAmpLoad()
 {
 	int amp_idx = m_ui.cb_amp_type->currentIndex();
-	int slot_idx = amp_idx - 55;
+	int slot_idx = amp_idx - m_mooer.capabilities().firstUserAmp;
 	if(slot_idx < 0)
 		return;
 
@@ -396,40 +537,184 @@ void MooerManager::OnAmpLoad()
 #else
 	auto fileName = QFileDialog::getOpenFileName(
 		this, tr("Open Amplifier"), ptFileOpen, tr("Amplifier model (*.amp);;MNRS profile (*.gnr)"));
+	if(fileName.isEmpty())
+		return;
 	std::filesystem::path fnAmp = fileName.toStdString();
 #endif
 
 	std::string name = fnAmp.stem().string();
-	auto ampData = ReadFile(fnAmp);
+	auto ampFile = std::make_shared<IO::MappedFile>(fnAmp);
+	Mooer::UploadManager::Prepare prepare;
 	if(iequals(fnAmp.extension().string(), ".amp"))
-		m_mooer.LoadAmplifier(ampData, name, slot_idx);
+		prepare = [=] { return Mooer::PrepareAmplifier(ampFile->data(), name, slot_idx); };
 	else if(iequals(fnAmp.extension().string(), ".gnr"))
-		m_mooer.LoadGNR(ampData, name, slot_idx);
+		prepare = [=] { return Mooer::PrepareGNR(ampFile->data(), name, slot_idx); };
 	else
 		throw std::runtime_error("Amplifier File format not supported");
-
-	m_mstate.ampModelNames.set(slot_idx, name);
-	emit MooerSettingsChanged(Mooer::RxFrame::AMP);
+	SubmitUpload(Mooer::RxFrame::AMP, slot_idx, name, std::move(prepare));
 }
 
 
 void MooerManager::OnCabinetLoad()
 {
-	int amp_idx = m_ui.cb_amp_type->currentIndex();
-	int slot_idx = amp_idx - 26;
+	int cab_idx = m_ui.cb_cab_type->currentIndex();
+	int slot_idx = cab_idx - m_mooer.capabilities().firstUserCab;
 	if(slot_idx < 0)
 		return;
 
 	// std::filesystem::path fnCab = ptFileOpen / "impulse V30 3 LPR.wav";
 	auto fileName =
 		QFileDialog::getOpenFileName(this, tr("Open Cabinet (Impulse Response)"), ptFileOpen, tr("WAVE Files (*.wav)"));
+	if(fileName.isEmpty())
+		return;
 	std::filesystem::path fnCab = fileName.toStdString();
 
 	std::string name = std::filesystem::path(fnCab).stem().string();
-	auto ampData = ReadFile(fnCab);
-	m_mooer.LoadWav(ampData, name, slot_idx);
-	m_mstate.ampModelNames.set(slot_idx, name);
-	emit MooerSettingsChanged(Mooer::RxFrame::CAB);
+	auto cabFile = std::make_shared<IO::MappedFile>(fnCab);
+	SubmitUpload(Mooer::RxFrame::CAB,
+				 slot_idx,
+				 name,
+				 [=] { return Mooer::PrepareCabinet(Mooer::ConvertCabinet(cabFile->data()), name, slot_idx); });
+}
+
+
+void MooerManager::RestoreBackup(std::filesystem::path fn)
+{
+	// A preset stands for all presets in its directory
+	if(iequals(fn.extension().string(), ".mo"))
+		fn = fn.parent_path();
+
+	auto device = std::make_shared<Mooer::File::Mbf>();
+	auto target = std::make_shared<Mooer::File::Mbf>();
+	int activePreset;
+	try
+	{
+		std::lock_guard lock{m_dev_mutex};
+		*device = Mooer::CurrentBackup(m_mstate, m_mooer.capabilities().model);
+		*target = Mooer::ReadRestoreSource(fn, *device);
+		activePreset = m_mstate.activePresetIndex;
+		if(!std::filesystem::is_directory(fn))
+			m_systemBackup = target;
+	}
+	catch(std::exception& e)
+	{
+		m_ui.statusbar->showMessage(e.what(), 5 * 1000);
+		return;
+	}
+	RestorePresets(device, target, activePreset);
+}
+
+
+void MooerManager::ImportPreset(const Mooer::File::MO& mo)
+{
+	// A preset is a single frame, which the pedal confirms with patch frames instead of a byte plane acknowledge.
+	// So it is no UploadManager job, but is sent from m_restore_worker, which reads it back when verifying.
+	const bool verify = m_ui.actionVerify_uploads->isChecked();
+
+	// With or without verification, only the edit buffer changes: the stored preset stays until the user stores it
+	int activePreset;
+	{
+		std::lock_guard lock{m_dev_mutex};
+		activePreset = m_mstate.activePresetIndex;
+	}
+	RunRestore(
+		[this, mo, activePreset, verify](Mooer::PresetRestore& restore)
+		{
+			QString name = QString::fromStdString(std::string(mo.preset.getName()));
+			if(!verify)
+			{
+				m_mooer.LoadMoPreset(mo);
+				return QString("Loaded preset %1").arg(name);
+			}
+			auto report = restore.Load(mo, activePreset);
+			if(!report.failed.empty())
+				return QString("Preset %1 does not read back as loaded").arg(name);
+			return QString("Loaded preset %1").arg(name);
+		});
+}
+
+
+void MooerManager::RestorePresets(std::shared_ptr<const Mooer::File::Mbf> device,
+								  std::shared_ptr<const Mooer::File::Mbf> target,
+								  int activePreset)
+{
+	RunRestore(
+		[device, target, activePreset](Mooer::PresetRestore& restore)
+		{
+			auto report = restore.Run(*device, *target, activePreset);
+			std::stringstream ss;
+			report.Print(ss);
+			qDebug() << "MooerManager:" << ss.str();
+			return QString("Restored %1 presets, %2 unchanged, %3 failed, in %4 s")
+				.arg(report.restored.size())
+				.arg(report.skipped.size())
+				.arg(report.failed.size())
+				.arg(report.wallTime.count(), 0, 'f', 1);
+		});
+}
+
+
+void MooerManager::RunRestore(std::function<QString(Mooer::PresetRestore&)> run)
+{
+	if(m_restore_worker.joinable())
+	{
+		m_ui.statusbar->showMessage("A backup is already being restored", 5 * 1000);
+		return;
+	}
+	{
+		std::lock_guard lock{m_dev_mutex};
+		Mooer::RestoreOptions options;
+		options.progress = [this](std::size_t done, std::size_t total)
+		{ emit MooerUploadProgress(QString("Restoring presets: %1/%2").arg(done).arg(total), true); };
+		m_restore = std::make_unique<Mooer::PresetRestore>(m_mooer, options);
+	}
+
+	m_ui.actionCancel_uploads->setEnabled(true);
+	m_restore_worker = std::jthread(
+		[this, run = std::move(run)]
+		{
+			try
+			{
+				emit MooerRestoreDone(run(*m_restore));
+			}
+			catch(std::exception& e)
+			{
+				emit MooerRestoreDone(QString::fromStdString(e.what()));
+			}
+		});
+}
+
+
+void MooerManager::SubmitUpload(Mooer::RxFrame::Group group,
+								int slot,
+								std::string name,
+								Mooer::UploadManager::Prepare prepare)
+{
+	// The callback runs on the upload thread, the UI is updated through queued signals
+	auto progress = [this, group, slot, label = QString::fromStdString(name)](const Mooer::UploadManager::Progress& p)
+	{
+		using Progress = Mooer::UploadManager::Progress;
+		switch(p.status)
+		{
+		case Progress::Sending:
+			emit MooerUploadProgress(QString("Uploading %1: %2/%3").arg(label).arg(p.planes).arg(p.nrPlanes), true);
+			break;
+		case Progress::Done:
+			emit MooerUploadProgress(QString("Uploaded %1").arg(label), m_uploads.size() > 0);
+			emit MooerUploadDone(group, slot, label);
+			break;
+		case Progress::Cancelled:
+			emit MooerUploadProgress(QString("Upload of %1 cancelled").arg(label), m_uploads.size() > 0);
+			break;
+		case Progress::Failed:
+			emit MooerUploadProgress(
+				QString("Upload of %1 failed: %2").arg(label, QString::fromStdString(p.error)), m_uploads.size() > 0);
+			break;
+		}
+	};
+	m_uploads.Submit(std::move(prepare), progress);
+	m_ui.statusbar->showMessage(QString("Queued upload of %1").arg(QString::fromStdString(name)));
+	m_ui.actionCancel_uploads->setEnabled(true);
 }
 
 
@@ -473,6 +758,9 @@ void MooerManager::OnMooerFrame(const Mooer::RxFrame::Frame& frame)
 	std::span<const std::uint8_t> data = frame.noidx_data();
 	auto data_nochk = frame.nochecksum_data();
 
+	// The same mapping as the journal, so a recovered state equals the one shown
+	Mooer::Apply(m_mstate, frame.group(), data_nochk);
+
 	switch(frame.group())
 	{
 	case Mooer::RxFrame::Identify:
@@ -489,29 +777,32 @@ void MooerManager::OnMooerFrame(const Mooer::RxFrame::Frame& frame)
 #if DEBUG_LVL > 0
 		qDebug() << QString("MooerManager: Cabinet Acknowledge received for %1").arg(frame.index());
 #endif
+		m_uploads.OnAcknowledge(frame);
 		break;
 	case Mooer::RxFrame::AmpUpload:
 #if DEBUG_LVL > 0
 		qDebug() << QString("MooerManager: Amp Acknowledge received for %1").arg(frame.index());
 #endif
+		m_uploads.OnAcknowledge(frame);
 		break;
 	case Mooer::RxFrame::ActivePatch:
+		if(m_restore)
+			m_restore->OnFrame(frame);
 		emit MooerPatchChange(frame.index());
-		m_mstate.activePresetIndex = frame.index();
 #ifdef MOOER_HAS_MIDI
 		if(m_midi)
 			m_midi->ProgramChange(0, m_mstate.activePresetIndex);
 #endif
 		break;
 	case Mooer::RxFrame::AmpModels:
-		m_mstate.ampModelNames = Mooer::DeviceFormat::AmpModelNames(frame.data);
+		m_uploads.OnAcknowledge(frame);
 		emit MooerSettingsChanged(Mooer::RxFrame::AMP);
 		break;
 	case Mooer::RxFrame::CabModels:
 #if DEBUG_LVL > 3
 		qDebug() << "Received CAB models";
 #endif
-		m_mstate.cabModelNames = Mooer::DeviceFormat::AmpModelNames(frame.data);
+		m_uploads.OnAcknowledge(frame);
 		emit MooerSettingsChanged(Mooer::RxFrame::CAB);
 		break;
 	case Mooer::RxFrame::PatchSetting:
@@ -520,10 +811,34 @@ void MooerManager::OnMooerFrame(const Mooer::RxFrame::Frame& frame)
 		Mooer::File::PresetPadded preset = data_nochk.subspan(1);
 		qDebug() << std::format("MooerManager: received patch {:3d} {}", frame.index(), preset.getName());
 #endif
+		if(m_restore)
+			m_restore->OnFrame(frame);
 		if(data_nochk.size() == 0x201)
 		{
-			m_mstate.savedPresets.at(frame.index()) = data_nochk.subspan(1);
 			emit MooerPatchSetting(frame.index());
+			if(m_backup)
+			{
+				m_backup->Write(data_nochk);
+				if(m_backup->complete())
+				{
+					try
+					{
+						m_backup->Close();
+						auto message = QString("Backup of %1 presets saved").arg(m_backup->count());
+						const int extra = m_mooer.capabilities().nrPresets - int(Mooer::BackupWriter::nrSlots);
+						if(extra > 0)
+							message += QString(", the last %1 do not fit in a backup").arg(extra);
+						if(!m_backup->hasSystem())
+							message += ", without system settings";
+						emit MooerBackupSaved(message);
+					}
+					catch(std::exception& e)
+					{
+						qDebug() << "MooerManager: " << e.what();
+					}
+					m_backup.reset();
+				}
+			}
 		}
 		else
 		{
@@ -533,76 +848,52 @@ void MooerManager::OnMooerFrame(const Mooer::RxFrame::Frame& frame)
 	break;
 	case Mooer::RxFrame::ActivePatchSetting:
 	{
+		if(m_restore)
+			m_restore->OnFrame(frame);
 		auto idx = data_nochk[0];
 		qDebug() << QString("Received Preset data for %1").arg(idx);
-		// m_mstate.savedPresets.at(idx) = data_nochk.subspan(1);
+		for(auto group : {Mooer::RxFrame::FX,
+						  Mooer::RxFrame::DS_OD,
+						  Mooer::RxFrame::AMP,
+						  Mooer::RxFrame::CAB,
+						  Mooer::RxFrame::NS_GATE,
+						  Mooer::RxFrame::EQ,
+						  Mooer::RxFrame::MOD,
+						  Mooer::RxFrame::DELAY,
+						  Mooer::RxFrame::REVERB})
+			emit MooerSettingsChanged(group);
 	}
 	break;
 	case Mooer::RxFrame::FootSwitch:
 		qDebug() << QString("FootSwitch Mode %1").arg(data_nochk[0]);
-		m_mstate.footswitchConfirm = data_nochk[0];
 		break;
 	case Mooer::RxFrame::FX:
-		m_mstate.activePreset.fx = data_nochk;
-		emit MooerSettingsChanged(frame.group());
-		break;
 	case Mooer::RxFrame::DS_OD:
-		m_mstate.activePreset.distortion = data_nochk;
-		emit MooerSettingsChanged(frame.group());
-		break;
 	case Mooer::RxFrame::AMP:
-		m_mstate.activePreset.amp = data_nochk;
-		emit MooerSettingsChanged(frame.group());
-		break;
 	case Mooer::RxFrame::CAB:
-		m_mstate.activePreset.cab = data_nochk;
-		emit MooerSettingsChanged(frame.group());
-		break;
 	case Mooer::RxFrame::NS_GATE:
-		m_mstate.activePreset.noiseGate = data_nochk;
-		emit MooerSettingsChanged(frame.group());
-		break;
 	case Mooer::RxFrame::EQ:
-		m_mstate.activePreset.equalizer = data_nochk;
-		emit MooerSettingsChanged(frame.group());
-		break;
 	case Mooer::RxFrame::MOD:
-		m_mstate.activePreset.modulation = data_nochk;
-		emit MooerSettingsChanged(frame.group());
-		break;
 	case Mooer::RxFrame::DELAY:
-		m_mstate.activePreset.delay = data_nochk;
+	case Mooer::RxFrame::RHYTHM:
+	case Mooer::RxFrame::PedalAssignment:
+	case Mooer::RxFrame::System:
 		emit MooerSettingsChanged(frame.group());
 		break;
 	case Mooer::RxFrame::REVERB:
-		m_mstate.activePreset.reverb = data_nochk;
 #ifdef MOOER_HAS_MIDI
 		if(m_midi)
 			m_midi->ControlChange(0, MIDI::ControlChange::Reverb, m_mstate.activePreset.reverb.level);
 #endif
 		emit MooerSettingsChanged(frame.group());
 		break;
-	case Mooer::RxFrame::RHYTHM:
-		m_mstate.activePreset.rhythm = data_nochk;
-		emit MooerSettingsChanged(frame.group());
-		break;
-	case Mooer::RxFrame::PedalAssignment:
-		m_mstate.pedal = data_nochk;
-		emit MooerSettingsChanged(frame.group());
-		break;
-	case Mooer::RxFrame::System:
-		m_mstate.system = data_nochk;
-		emit MooerSettingsChanged(frame.group());
-		break;
 	case Mooer::RxFrame::Volume:
-		m_mstate.volume = data_nochk[0];
 #ifdef MOOER_HAS_MIDI
 		if(m_midi)
 			m_midi->ControlChange(0, MIDI::ControlChange::Volume, m_mstate.volume);
 #endif
 		break;
 	case Mooer::RxFrame::Menu:
-		m_mstate.activeMenu = data_nochk[0];
 		break;
 	default:
 		qDebug() << QString("MooerManager: received unhandled frame 0x%1, size %2")
@@ -680,7 +971,7 @@ void MooerManager::UpdateSettingsView(Mooer::RxFrame::Group group)
 			for(int n = 0; n < m_mstate.ampModelNames.size(); n++)
 			{
 				auto name = QString::fromLatin1(m_mstate.ampModelNames[n].data(), m_mstate.ampModelNames[n].size());
-				m_ui.cb_amp_type->setItemText(n + 55, name);
+				m_ui.cb_amp_type->setItemText(n + m_mooer.capabilities().firstUserAmp, name);
 				// qDebug() << "UpdateSettingsView " << (n + 55) << " " << name;
 			}
 		}
@@ -702,7 +993,7 @@ void MooerManager::UpdateSettingsView(Mooer::RxFrame::Group group)
 			for(int n = 0; n < m_mstate.cabModelNames.size(); n++)
 			{
 				auto name = QString::fromLatin1(m_mstate.cabModelNames[n].data(), m_mstate.cabModelNames[n].size());
-				m_ui.cb_cab_type->setItemText(n + 26, name);
+				m_ui.cb_cab_type->setItemText(n + m_mooer.capabilities().firstUserCab, name);
 			}
 		}
 
@@ -747,6 +1038,25 @@ void MooerManager::UpdateSettingsView(Mooer::RxFrame::Group group)
 }
 
 
+void MooerManager::UpdateModelLists()
+{
+	const Mooer::Capabilities* caps = &m_mooer.capabilities();
+	if(caps == m_capabilities)
+		return;
+	m_capabilities = caps;
+
+	QSignalBlocker bAmp(m_ui.cb_amp_type);
+	m_ui.cb_amp_type->clear();
+	for(auto name : caps->ampModels)
+		m_ui.cb_amp_type->addItem(QString::fromStdString(std::string(name)));
+
+	QSignalBlocker bCab(m_ui.cb_cab_type);
+	m_ui.cb_cab_type->clear();
+	for(auto name : caps->cabModels)
+		m_ui.cb_cab_type->addItem(QString::fromStdString(std::string(name)));
+}
+
+
 void MooerManager::UpdatePatchDropdown()
 {
 	auto& presets = m_mstate.savedPresets;
@@ -3,8 +3,13 @@
 #include <mutex>
 
 #include <QMainWindow>
+#include <QTimer>
 
+#include <Backup.h>
+#include <Journal.h>
 #include <MooerParser.h>
+#include <Restore.h>
+#include <UploadManager.h>
 #include <UsbConnection.h>
 #include <midi/Midi.h>
 
@@ -30,9 +35,14 @@ signals:
 	void MooerPatchSetting(int idx); ///< Received the settings for this patch
 	void MooerPatchChange(int idx);	 ///< Index of the active patch
 	void MooerSettingsChanged(Mooer::RxFrame::Group group);
+	void MooerBackupSaved(QString message);
+	void MooerUploadProgress(QString message, bool busy);
+	void MooerUploadDone(int group, int slot, QString name);
+	void MooerRestoreDone(QString message);
 
 private:
 	void SwitchMenuIfDifferent(int);
+	void OpenJournal();
 
 	// USB::ConnectionListener
 	void OnUsbConnected(bool) override;
@@ -58,6 +68,15 @@ private:
 	// GUI slots
 	void OnAmpLoad();
 	void OnCabinetLoad();
+	void RestoreBackup(std::filesystem::path fn);
+	void ImportPreset(const Mooer::File::MO& mo);
+	void RestorePresets(std::shared_ptr<const Mooer::File::Mbf> device,
+						std::shared_ptr<const Mooer::File::Mbf> target,
+						int activePreset);
+	/// Call \p run with a new m_restore on m_restore_worker, it returns the message for MooerRestoreDone
+	void RunRestore(std::function<QString(Mooer::PresetRestore&)> run);
+	void SubmitUpload(Mooer::RxFrame::Group group, int slot, std::string name, Mooer::UploadManager::Prepare prepare);
+	void UpdateModelLists();
 	void UpdatePatchDropdown();
 	void UpdateSettingsView(Mooer::RxFrame::Group group);
 
@@ -70,8 +89,17 @@ private:
 	std::mutex m_dev_mutex;
 	bool m_need_patches;
 	Mooer::Listener::Identity m_device_id;
+	const Mooer::Capabilities* m_capabilities; ///< Capabilities the model lists are filled with
 	Mooer::DeviceFormat::State m_mstate; // Device state
+	std::unique_ptr<Mooer::Journal> m_journal; ///< Log of all state changes, survives a crash
+	std::unique_ptr<Mooer::BackupWriter> m_backup; ///< Backup that is being downloaded
+	QTimer m_backupTimer;						   ///< Stops m_backup when the presets stop coming
+	std::shared_ptr<const Mooer::File::Mbf> m_systemBackup; ///< Last .mbf restored, has the system settings
 #if defined(MOOER_HAS_MIDI)
 	std::unique_ptr<MIDI::Interface> m_midi;
 #endif
+	// Last, so they stop before the rest is destroyed
+	Mooer::UploadManager m_uploads;
+	std::unique_ptr<Mooer::PresetRestore> m_restore; ///< Restore of a backup that is running
+	std::jthread m_restore_worker;
 };
@@ -0,0 +1,73 @@
+#include <Backup.h>
+
+
+namespace Mooer
+{
+
+BackupWriter::BackupWriter(const std::filesystem::path& fn, std::string_view model)
+	: m_fn(fn), m_hasSystem(false)
+{
+	Create(File::NewBackup(model));
+}
+
+
+BackupWriter::BackupWriter(const std::filesystem::path& fn, const File::Mbf& base)
+	: m_fn(fn), m_hasSystem(true)
+{
+	// Only what is received of the presets goes into the file
+	File::Mbf mbf = base;
+	for(std::size_t n = 0; n < mbf.presets.size(); n++)
+		mbf.presets[n] = File::MbfPreset{static_cast<std::uint16_t>(n)};
+	Create(mbf);
+}
+
+
+bool BackupWriter::Write(std::span<const std::uint8_t> patchSetting)
+{
+	if(patchSetting.size() != 1 + sizeof(File::PresetPadded))
+		return false;
+	const int slot = patchSetting[0];
+	if(slot >= m_written.size())
+		return false;
+
+	// Only the preset is written, the index and padding are already in place
+	auto offset = offsetof(File::Mbf, presets) + slot * sizeof(File::MbfPreset) + offsetof(File::MbfPreset, preset);
+	m_file.seekp(offset);
+	m_file.write(reinterpret_cast<const char*>(patchSetting.data() + 1), sizeof(File::PresetPadded));
+	m_written.set(slot);
+	m_lastWrite = clock::now();
+	return true;
+}
+
+
+void BackupWriter::Close()
+{
+	m_file.close();
+	if(!m_file)
+		throw std::runtime_error("Writing the backup failed");
+}
+
+
+void BackupWriter::Abort()
+{
+	m_file.close();
+	std::error_code ec;
+	std::filesystem::remove(m_fn, ec);
+}
+
+
+void BackupWriter::Create(const File::Mbf& mbf)
+{
+	m_file.open(m_fn, std::ios::binary | std::ios::trunc);
+	m_file.write(reinterpret_cast<const char*>(&mbf), sizeof(mbf));
+	if(!m_file)
+	{
+		std::stringstream ss;
+		ss << "Could not create backup " << m_fn;
+		throw std::runtime_error(ss.str());
+	}
+	m_lastWrite = clock::now();
+}
+
+
+} // namespace Mooer
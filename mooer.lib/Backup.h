@@ -0,0 +1,85 @@
+#pragma once
+
+#include <bitset>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <string_view>
+
+#include <MooerParser.h>
+
+
+namespace Mooer
+{
+
+/**
+Writes an .mbf backup while the presets arrive from the pedal.
+
+Each RxFrame::PatchSetting frame is written to its slot in the file straight away,
+so a dump of the whole pedal is never held in memory.
+Slots that are never received stay empty. The pedal can have more slots than a backup, those are left out.
+
+The pedal does not send its system settings in the layout of a backup. They are taken from an earlier backup
+of the same pedal when one is given, otherwise they are left empty and hasSystem() is false.
+*/
+class BackupWriter
+{
+public:
+	using clock = std::chrono::steady_clock;
+
+	static constexpr std::size_t nrSlots = std::tuple_size_v<decltype(File::Mbf::presets)>;
+
+	/// Create \p fn, with the header of a backup of \p model, no system settings and empty presets
+	BackupWriter(const std::filesystem::path& fn, std::string_view model);
+
+	/// Create \p fn, with the header, system settings and preset header of \p base, and empty presets
+	BackupWriter(const std::filesystem::path& fn, const File::Mbf& base);
+
+	/**
+	Write a preset, from the payload of a RxFrame::PatchSetting frame (index and File::PresetPadded).
+	Returns false if it is not a valid preset, or its slot does not fit in a backup.
+	*/
+	bool Write(std::span<const std::uint8_t> patchSetting);
+
+	/// Number of different slots written
+	std::size_t count() const
+	{
+		return m_written.count();
+	}
+
+	/// All slots of the backup have been written
+	bool complete() const
+	{
+		return m_written.all();
+	}
+
+	/// The system settings are in the backup
+	bool hasSystem() const
+	{
+		return m_hasSystem;
+	}
+
+	/// Time since the last preset was written, or since the file was created
+	clock::duration idle() const
+	{
+		return clock::now() - m_lastWrite;
+	}
+
+	/// Flush the file to disk, throws if anything failed to write
+	void Close();
+
+	/// Close and remove the file, for a dump that stopped before it was complete
+	void Abort();
+
+private:
+	void Create(const File::Mbf& mbf);
+
+	std::filesystem::path m_fn;
+	std::ofstream m_file;
+	std::bitset<nrSlots> m_written;
+	bool m_hasSystem;
+	clock::time_point m_lastWrite;
+};
+
+} // namespace Mooer
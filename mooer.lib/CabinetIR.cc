@@ -0,0 +1,219 @@
+#include <CabinetIR.h>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <complex>
+#include <fstream>
+#include <numbers>
+#include <numeric>
+
+#include <Parallel.h>
+#include <Resampler.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MOOER_CABINET_SSE2
+#endif
+
+
+namespace Mooer
+{
+
+namespace
+{
+
+using cplx = std::complex<double>;
+
+
+/// In-place radix-2 FFT, the size of \p a must be a power of 2
+void FFT(std::vector<cplx>& a, bool inverse)
+{
+	const std::size_t n = a.size();
+	for(std::size_t i = 1, j = 0; i < n; i++)
+	{
+		std::size_t bit = n >> 1;
+		for(; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if(i < j)
+			std::swap(a[i], a[j]);
+	}
+	for(std::size_t len = 2; len <= n; len <<= 1)
+	{
+		const double angle = (inverse ? 2 : -2) * std::numbers::pi / len;
+		const cplx step(std::cos(angle), std::sin(angle));
+		for(std::size_t i = 0; i < n; i += len)
+		{
+			cplx w = 1;
+			for(std::size_t j = 0; j < len / 2; j++, w *= step)
+			{
+				cplx u = a[i + j], v = a[i + j + len / 2] * w;
+				a[i + j] = u + v;
+				a[i + j + len / 2] = u - v;
+			}
+		}
+	}
+	if(inverse)
+	{
+		for(auto& v : a)
+			v /= static_cast<double>(n);
+	}
+}
+
+
+/// Minimum-phase response with the same magnitude spectrum, via the real cepstrum
+std::vector<float> MinimumPhase(std::span<const float> x)
+{
+	// Large enough to keep cepstral aliasing small
+	const std::size_t n = std::bit_ceil(std::max<std::size_t>(8 * x.size(), 4096));
+	std::vector<cplx> a(n, 0.0);
+	std::copy(begin(x), end(x), begin(a));
+	FFT(a, false);
+	for(auto& v : a)
+		v = std::log(std::max(std::abs(v), 1e-9));
+	FFT(a, true);
+
+	// Fold the anti-causal part of the cepstrum onto the causal part
+	for(std::size_t k = 1; k < n / 2; k++)
+	{
+		a[k] = 2.0 * a[k].real();
+		a[n - k] = 0;
+	}
+	a[0] = a[0].real();
+	a[n / 2] = a[n / 2].real();
+
+	FFT(a, false);
+	for(auto& v : a)
+		v = std::exp(v);
+	FFT(a, true);
+
+	std::vector<float> r(x.size());
+	std::transform(begin(a), begin(a) + r.size(), begin(r), [](cplx v) { return static_cast<float>(v.real()); });
+	return r;
+}
+
+} // namespace
+
+
+std::vector<float> ToCabinetRate(const RIFF::Audio& audio)
+{
+	if(audio.channels.empty())
+		return {};
+
+	std::vector<float> mono(audio.channels[0].size(), 0.f);
+	const float gain = 1.f / audio.channels.size();
+	for(const auto& channel : audio.channels)
+	{
+		for(std::size_t n = 0; n < mono.size(); n++)
+			mono[n] += gain * channel[n];
+	}
+
+	if(audio.frequency == cabSampleRate)
+		return mono;
+	return DSP::Resampler(audio.frequency, cabSampleRate).Process(mono);
+}
+
+
+CabinetData Quantize(std::span<const float> ir)
+{
+	constexpr float scale = 8388608.f; // 2^23
+	std::array<std::int32_t, cabLength> samples = {};
+	const int n = std::min<int>(ir.size(), cabLength);
+	int i = 0;
+#if defined(MOOER_CABINET_SSE2)
+	const __m128 lo = _mm_set1_ps(-scale), hi = _mm_set1_ps(scale - 1), s = _mm_set1_ps(scale);
+	for(; i + 4 <= n; i += 4)
+	{
+		__m128 v = _mm_mul_ps(_mm_loadu_ps(&ir[i]), s);
+		v = _mm_min_ps(_mm_max_ps(v, lo), hi);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&samples[i]), _mm_cvtps_epi32(v));
+	}
+#endif
+	for(; i < n; i++)
+		samples[i] = static_cast<std::int32_t>(std::nearbyint(std::clamp(ir[i] * scale, -scale, scale - 1)));
+
+	CabinetData r;
+	for(int k = 0; k < cabLength; k++)
+	{
+		r[3 * k + 0] = samples[k] & 0xFF;
+		r[3 * k + 1] = (samples[k] >> 8) & 0xFF;
+		r[3 * k + 2] = (samples[k] >> 16) & 0xFF;
+	}
+	return r;
+}
+
+
+CabinetData ConvertCabinet(std::span<const std::uint8_t> wav)
+{
+	return Quantize(ToCabinetRate(RIFF::Read(wav)));
+}
+
+
+void SaveCabinet(const std::filesystem::path& fn, const CabinetData& ir)
+{
+	RIFF::Master hdr{RIFF::fileTypeId,
+					 sizeof(RIFF::Master) + sizeof(RIFF::Chunk) - 8 + sizeof(ir),
+					 RIFF::fileFormatId,
+					 RIFF::fmtChunkId,
+					 sizeof(RIFF::Format),
+					 RIFF::PCM,
+					 1,
+					 cabSampleRate,
+					 3 * cabSampleRate,
+					 3,
+					 24};
+	RIFF::Chunk data{RIFF::dataId, sizeof(ir)};
+
+	std::ofstream f(fn, std::ios::binary);
+	f.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+	f.write(reinterpret_cast<const char*>(&data), sizeof(data));
+	f.write(reinterpret_cast<const char*>(ir.data()), ir.size());
+	if(!f)
+		throw std::runtime_error("Could not write " + fn.string());
+}
+
+
+std::vector<float> Condition(std::span<const float> ir, const Conditioning& options)
+{
+	if(ir.empty())
+		return std::vector<float>(cabLength, 0.f);
+
+	// Pre-delay: everything before the first sample that comes close to the peak
+	auto absLess = [](float a, float b) { return std::abs(a) < std::abs(b); };
+	const float peak = std::abs(*std::max_element(begin(ir), end(ir), absLess));
+	const float threshold = options.onsetThreshold * peak;
+	auto onset = std::find_if(begin(ir), end(ir), [&](float v) { return std::abs(v) >= threshold; }) - begin(ir);
+	ir = ir.subspan(std::max<std::ptrdiff_t>(onset - options.preRoll, 0));
+
+	std::vector<float> r = options.minimumPhase ? MinimumPhase(ir) : std::vector<float>(begin(ir), end(ir));
+
+	if(r.size() > cabLength)
+	{
+		const int fade = std::clamp(options.fadeLength, 0, cabLength);
+		for(int n = 0; n < fade; n++)
+			r[cabLength - fade + n] *= 0.5f * (1 + std::cos(std::numbers::pi_v<float> * (n + 1) / fade));
+	}
+	r.resize(cabLength, 0.f);
+
+	// The energy is the gain for white noise, and an upper bound of the peak
+	const float energy = std::sqrt(std::inner_product(begin(r), end(r), begin(r), 0.f));
+	if(energy > 0)
+	{
+		const float gain = std::pow(10.f, options.levelDb / 20) / energy;
+		for(auto& v : r)
+			v *= gain;
+	}
+	return r;
+}
+
+
+std::vector<std::vector<float>> Condition(std::span<const std::vector<float>> irs, const Conditioning& options)
+{
+	std::vector<std::vector<float>> r(irs.size());
+	Parallel::For(irs.size(), [&](std::size_t n) { r[n] = Condition(irs[n], options); });
+	return r;
+}
+
+
+} // namespace Mooer
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+#include <WaveFile.h>
+
+
+namespace Mooer
+{
+
+/// Impulse responses of cabinet slots: mono, 24-bit at the sample rate of the pedal
+constexpr std::uint32_t cabSampleRate = 44100;
+constexpr int cabLength = 512;
+
+/// Samples of a cabinet impulse response, as 24-bit little-endian integers
+using CabinetData = std::array<std::uint8_t, 3 * cabLength>;
+
+/// Mix all channels to mono, and resample to cabSampleRate
+std::vector<float> ToCabinetRate(const RIFF::Audio& audio);
+
+/// Convert to 24-bit, clipping to [-1, 1). Shorter responses are padded with zeros, longer ones cut off.
+CabinetData Quantize(std::span<const float> ir);
+
+/// Decode a .wav file of any supported format and rate, into the format of the pedal
+CabinetData ConvertCabinet(std::span<const std::uint8_t> wav);
+
+/// Write \p ir as a 24-bit mono .wav file at cabSampleRate
+void SaveCabinet(const std::filesystem::path& fn, const CabinetData& ir);
+
+/// Settings of Condition()
+struct Conditioning
+{
+	float onsetThreshold = 0.01f; ///< Relative to the peak, the first sample above it is the onset
+	int preRoll = 2;			  ///< Samples kept before the onset
+	int fadeLength = 64;		  ///< Half-cosine fade out at the end, when the response is cut off
+	bool minimumPhase = false;	  ///< Convert to minimum phase, which moves the energy to the start
+	float levelDb = 0.f;		  ///< Energy of the response, 0 dB never clips
+};
+
+/**
+Prepare an impulse response at cabSampleRate for the pedal:
+remove the pre-delay, optionally convert to minimum phase, fade out to cabLength samples and normalize the energy.
+*/
+std::vector<float> Condition(std::span<const float> ir, const Conditioning& options = {});
+
+/// Condition() a batch of impulse responses in parallel
+std::vector<std::vector<float>> Condition(std::span<const std::vector<float>> irs, const Conditioning& options = {});
+
+} // namespace Mooer
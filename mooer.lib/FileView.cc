@@ -0,0 +1,58 @@
+#include <FileView.h>
+
+#include <sstream>
+#include <string_view>
+
+
+namespace Mooer
+{
+namespace File
+{
+
+namespace
+{
+
+template<typename T>
+const T* view(std::span<const std::uint8_t> data, std::string_view what)
+{
+	if(reinterpret_cast<std::uintptr_t>(data.data()) % alignof(T) != 0)
+	{
+		std::stringstream ss;
+		ss << what << " data is not aligned to " << alignof(T) << " bytes";
+		throw std::runtime_error(ss.str());
+	}
+	return reinterpret_cast<const T*>(data.data());
+}
+
+} // namespace
+
+
+MoView::MoView(std::span<const std::uint8_t> data)
+{
+	if(data.size() != sizeof(MO))
+	{
+		std::stringstream ss;
+		ss << "MO must be " << sizeof(MO) << " bytes, not " << data.size();
+		throw std::runtime_error(ss.str());
+	}
+	m_mo = view<MO>(data, "MO");
+}
+
+
+MbfView::MbfView(std::span<const std::uint8_t> data)
+{
+	using namespace std::literals;
+	if(data.size() < sizeof(Mbf))
+	{
+		std::stringstream ss;
+		ss << "MBF must be at least " << sizeof(Mbf) << " bytes\n";
+		throw std::runtime_error(ss.str());
+	}
+	m_mbf = view<Mbf>(data, "MBF");
+	if(std::string_view(m_mbf->manufacturer, strnlen(m_mbf->manufacturer, sizeof(m_mbf->manufacturer))) != "MOOER"sv)
+		throw std::runtime_error("MBF has an invalid header");
+}
+
+
+} // namespace File
+} // namespace Mooer
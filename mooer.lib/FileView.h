@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+
+#include <MappedFile.h>
+#include <MooerParser.h>
+
+
+namespace Mooer
+{
+namespace File
+{
+
+/// Non-owning view of an .mo file, the data has to outlive the view
+class MoView
+{
+public:
+	/// Throws if \p data is not an .mo file
+	explicit MoView(std::span<const std::uint8_t> data);
+
+	const MO& mo() const
+	{
+		return *m_mo;
+	}
+
+	const Preset& preset() const
+	{
+		return m_mo->preset;
+	}
+
+private:
+	const MO* m_mo;
+};
+
+
+/// Non-owning view of an .mbf backup, the data has to outlive the view
+class MbfView
+{
+public:
+	/// Throws if \p data is not an .mbf file
+	explicit MbfView(std::span<const std::uint8_t> data);
+
+	const Mbf& mbf() const
+	{
+		return *m_mbf;
+	}
+
+	/// Number of preset slots
+	constexpr static std::size_t size()
+	{
+		return std::tuple_size_v<decltype(Mbf::presets)>;
+	}
+
+	/// Preset in \p slot, throws std::out_of_range for an invalid slot
+	const Preset& preset(std::size_t slot) const
+	{
+		return m_mbf->presets.at(slot).preset;
+	}
+
+	std::span<const MbfPreset> presets() const
+	{
+		return m_mbf->presets;
+	}
+
+private:
+	const Mbf* m_mbf;
+};
+
+
+/**
+Memory-mapped file, with a view on its contents.
+The view stays valid when this is moved, since the mapping doesn't move.
+*/
+template<typename View>
+class MappedView
+{
+public:
+	explicit MappedView(const std::filesystem::path& fn)
+		: m_file(fn), m_view(m_file.data())
+	{
+	}
+
+	const View& operator*() const
+	{
+		return m_view;
+	}
+
+	const View* operator->() const
+	{
+		return &m_view;
+	}
+
+private:
+	IO::MappedFile m_file;
+	View m_view;
+};
+
+using MappedMo = MappedView<MoView>;
+using MappedMbf = MappedView<MbfView>;
+
+} // namespace File
+} // namespace Mooer
@@ -1,14 +1,22 @@
 #include <GuitarPro.h>
 
+#include <algorithm>
 #include <array>
+#include <bitset>
 #include <charconv>
+#include <functional>
 #include <iostream>
+#include <iterator>
 #include <map>
 #include <ranges>
 #include <sstream>
 
 #include <zip.h>
 
+#include <IntList.h>
+#include <Parallel.h>
+#include <XmlStream.h>
+
 
 void print(pugi::xml_node node, int level = 0, int indent = 0)
 {
@@ -22,115 +30,312 @@ void print(pugi::xml_node node, int level = 0, int indent = 0)
 }
 
 
-std::string as_string(const pugi::xml_node& node)
+/// Text of \p node, in the buffer that was parsed in place
+std::string_view as_string(const pugi::xml_node& node)
 {
 	return node.text().as_string();
 }
 
 
-auto split(const pugi::xml_node& node, char sep = ' ')
+namespace
 {
-	std::istringstream in(node.text().as_string());
-	std::vector<std::string> r;
-	std::string el;
-	while(std::getline(in, el, sep))
-		r.push_back(el);
-	return r;
+
+using Text::AppendInts;
+
+const std::map<std::string_view, GuitarPro::NoteValue> noteValues = {
+	{"Whole", GuitarPro::NoteValue::Whole},
+	{"Half", GuitarPro::NoteValue::Half},
+	{"Quarter", GuitarPro::NoteValue::Quarter},
+	{"Eighth", GuitarPro::NoteValue::Eighth},
+	{"16th", GuitarPro::NoteValue::_16th},
+	{"32nd", GuitarPro::NoteValue::_32nd},
+};
+
+
+/// Like pugi::xml_text::as_int()
+int AsInt(std::string_view s)
+{
+	s.remove_prefix(std::min(s.find_first_not_of(" \t\r\n"), s.size()));
+	if(s.starts_with('+'))
+		s.remove_prefix(1);
+	int v = 0;
+	std::from_chars(s.data(), s.data() + s.size(), v);
+	return v;
 }
 
 
-template<typename T>
-auto as_vector(const pugi::xml_node& node)
+/// Like pugi::xml_text::as_bool()
+bool AsBool(std::string_view s)
 {
-	std::istringstream in(node.text().as_string());
-	std::vector<T> vec;
-	std::copy(std::istream_iterator<T>(in), std::istream_iterator<T>(), std::back_inserter(vec));
-	return vec;
+	return !s.empty() && std::string_view("1tTyY").find(s[0]) != std::string_view::npos;
 }
 
 
+/// Index of \p step in \p steps, which is added if it is new
+std::uint8_t Intern(std::vector<std::string_view>& steps, std::string_view step)
+{
+	auto it = std::find(begin(steps), end(steps), step);
+	if(it != end(steps))
+		return it - begin(steps);
+	if(steps.size() == 0x80)
+		throw std::runtime_error("Too many pitch steps");
+	steps.push_back(step);
+	return steps.size() - 1;
+}
+
+
+/// Time signature like "3/4"
+GuitarPro::GPIF::Time AsTime(std::string_view s)
+{
+	GuitarPro::GPIF::Time time{};
+	auto rest = s;
+	if(!Text::ParseInt(rest, time.num) || !rest.starts_with('/'))
+		throw std::runtime_error("Invalid time signature: " + std::string(s));
+	rest.remove_prefix(1);
+	if(!Text::ParseInt(rest, time.den))
+		throw std::runtime_error("Invalid time signature: " + std::string(s));
+	return time;
+}
+
+} // namespace
+
+
 namespace GuitarPro
 {
 
 // https://stackoverflow.com/questions/10440113/simple-way-to-unzip-a-zip-file-using-zlib
-class ZipFile
+class ReaderV78::ZipFile
 {
 public:
 	ZipFile(std::span<const char> data)
 	{
 		zip_error_t error = {ZIP_ER_OK, 0};
-		m_zs = zip_source_buffer_create(data.data(), data.size(), 0, &error);
-		if(error.zip_err != ZIP_ER_OK)
+		zip_source_t* zs = zip_source_buffer_create(data.data(), data.size(), 0, &error);
+		if(zs == nullptr)
 			throw std::runtime_error(zip_error_strerror(&error));
-		m_zip = zip_open_from_source(m_zs, ZIP_RDONLY, &error);
-		if(error.zip_err != ZIP_ER_OK)
+		// The archive owns the source, once it is opened
+		m_zip = zip_open_from_source(zs, ZIP_RDONLY, &error);
+		if(m_zip == nullptr)
+		{
+			zip_source_free(zs);
 			throw std::runtime_error(zip_error_strerror(&error));
+		}
 	}
 
 	ZipFile(std::filesystem::path fn)
-		: m_zs(nullptr)
 	{
 		int err = 0;
-		m_zip = zip_open(fn.string().c_str(), 0, &err);
+		m_zip = zip_open(fn.string().c_str(), ZIP_RDONLY, &err);
+		if(m_zip == nullptr)
+		{
+			zip_error_t error;
+			zip_error_init_with_code(&error, err);
+			std::stringstream ss;
+			ss << "Can not open " << fn << ": " << zip_error_strerror(&error);
+			zip_error_fini(&error);
+			throw std::runtime_error(ss.str());
+		}
 	}
 
 	~ZipFile()
 	{
-		zip_close(m_zip);
-		if(m_zs != nullptr)
-			zip_source_close(m_zs);
+		zip_discard(m_zip);
 	}
 
+	ZipFile(const ZipFile&) = delete;
+	ZipFile& operator=(const ZipFile&) = delete;
+
 	bool exists(std::string_view filename) const
 	{
 		zip_flags_t flags = ZIP_FL_NOCASE;
 		return zip_name_locate(m_zip, filename.data(), flags) >= 0;
 	}
 
-	struct zip_stat Stat(std::string_view filename) const
+	/**
+	Decompress \p filename into a single buffer, with room for a terminating zero after the contents.
+	Returns nullptr if the file is not in the archive.
+	*/
+	std::shared_ptr<char[]> ExtractFile(std::string_view filename, std::size_t& size)
 	{
 		struct zip_stat st;
 		zip_stat_init(&st);
-		zip_stat(m_zip, filename.data(), 0, &st);
-		return st;
+		zip_int64_t idx = zip_name_locate(m_zip, filename.data(), ZIP_FL_NOCASE);
+		if(idx < 0 || zip_stat_index(m_zip, idx, 0, &st) != 0 || (st.valid & ZIP_STAT_SIZE) == 0)
+			return nullptr;
+
+		auto data = std::make_shared_for_overwrite<char[]>(st.size + 1);
+		zip_file* f = zip_fopen_index(m_zip, idx, 0);
+		if(f == nullptr)
+			throw std::runtime_error(zip_error_strerror(zip_get_error(m_zip)));
+		zip_int64_t nRead = zip_fread(f, data.get(), st.size);
+		zip_fclose(f);
+		if(nRead < 0 || static_cast<zip_uint64_t>(nRead) != st.size)
+		{
+			std::stringstream ss;
+			ss << "Can not decompress " << filename;
+			throw std::runtime_error(ss.str());
+		}
+		data[st.size] = '\0';
+		size = st.size;
+		return data;
 	}
 
-	std::vector<char> ExtractFile(std::string_view filename)
+	/**
+	Decompress \p filename in chunks, passed to \p sink, until it returns false.
+	Returns false if the file is not in the archive.
+	*/
+	template<std::predicate<std::string_view> Sink>
+	bool ReadChunks(std::string_view filename, Sink&& sink)
 	{
-		struct zip_stat st;
-		zip_stat_init(&st);
-		zip_stat(m_zip, filename.data(), 0, &st);
+		zip_int64_t idx = zip_name_locate(m_zip, filename.data(), ZIP_FL_NOCASE);
+		if(idx < 0)
+			return false;
+		zip_file* f = zip_fopen_index(m_zip, idx, 0);
+		if(f == nullptr)
+			throw std::runtime_error(zip_error_strerror(zip_get_error(m_zip)));
 
-		std::vector<char> data(st.size);
-
-		zip_file* f = zip_fopen(m_zip, filename.data(), 0);
-		zip_fread(f, data.data(), st.size);
+		std::array<char, 0x10000> chunk;
+		zip_int64_t nRead;
+		while((nRead = zip_fread(f, chunk.data(), chunk.size())) > 0)
+		{
+			if(!sink(std::string_view(chunk.data(), nRead)))
+				break;
+		}
 		zip_fclose(f);
-		return data;
+		if(nRead < 0)
+		{
+			std::stringstream ss;
+			ss << "Can not decompress " << filename;
+			throw std::runtime_error(ss.str());
+		}
+		return true;
 	}
 
+private:
 	zip* m_zip;
-	zip_source_t* m_zs;
 };
 
 //-- GPIF --
 
-int GPIF::nrTracks()
+int GPIF::nrTracks() const
 {
 	return tracks.size();
 }
 
 
-int GPIF::nrBars()
+int GPIF::nrBars() const
 {
 	return masterBars.size();
 }
 
 
+void GPIF::Tables::SetBeats(std::span<const int> beatIds,
+							std::span<const Beat> beatsRead,
+							const IndexLists& beatNoteIds,
+							std::span<const Note> notesById)
+{
+	// The last beat with an id wins, missing ids are empty beats
+	int nrBeats = beatIds.empty() ? 0 : *std::max_element(begin(beatIds), end(beatIds)) + 1;
+	std::vector<int> order(nrBeats, -1);
+	for(std::size_t i = 0; i < beatIds.size(); i++)
+	{
+		if(beatIds[i] >= 0)
+			order[beatIds[i]] = i;
+	}
+
+	beats.assign(nrBeats, Beat{});
+	beatNotes.assign(1, 0);
+	notes.clear();
+	notes.reserve(beatNoteIds.values.size());
+	for(int id = 0; id < nrBeats; id++)
+	{
+		if(int i = order[id]; i >= 0)
+		{
+			beats[id] = beatsRead[i];
+			for(int idx_note : beatNoteIds[i])
+				notes.push_back(notesById[idx_note]);
+		}
+		beatNotes.push_back(static_cast<std::uint32_t>(notes.size()));
+	}
+}
+
+
+std::uint8_t GPIF::Tables::InternPitchStep(std::string_view step)
+{
+	return Intern(pitchSteps, step);
+}
+
+
+GPIF::GPIF(Tables&& tables, std::shared_ptr<const void> text)
+{
+	struct Storage
+	{
+		Tables tables;
+		std::shared_ptr<const void> text;
+	};
+	auto storage = std::make_shared<const Storage>(Storage{std::move(tables), std::move(text)});
+	const Tables& t = storage->tables;
+	tracks = t.tracks;
+	masterBars = t.masterBars;
+	masterBarBars = t.masterBarBars;
+	bars = t.bars;
+	barVoices = t.barVoices;
+	voiceBeats = t.voiceBeats;
+	beats = t.beats;
+	beatNotes = t.beatNotes;
+	notes = t.notes;
+	rhythms = t.rhythms;
+	pitchSteps = t.pitchSteps;
+	m_storage = std::move(storage);
+}
+
+
+std::string_view GPIF::Difference(const GPIF& other) const
+{
+	auto equalLists = [](const IndexListsView& a, const IndexListsView& b)
+	{
+		if(a.size() != b.size())
+			return false;
+		for(std::size_t i = 0; i < a.size(); i++)
+		{
+			if(!std::ranges::equal(a[i], b[i]))
+				return false;
+		}
+		return true;
+	};
+
+	if(version != other.version || revision != other.revision)
+		return "version";
+	if(!std::ranges::equal(tracks, other.tracks))
+		return "tracks";
+	if(!std::ranges::equal(masterBars, other.masterBars))
+		return "masterBars";
+	if(!equalLists(masterBarBars, other.masterBarBars))
+		return "masterBarBars";
+	if(!std::ranges::equal(bars, other.bars))
+		return "bars";
+	if(!equalLists(barVoices, other.barVoices))
+		return "barVoices";
+	if(!equalLists(voiceBeats, other.voiceBeats))
+		return "voiceBeats";
+	if(!std::ranges::equal(beats, other.beats))
+		return "beats";
+	if(!std::ranges::equal(beatNotes, other.beatNotes))
+		return "beatNotes";
+	if(!std::ranges::equal(notes, other.notes))
+		return "notes";
+	if(!std::ranges::equal(rhythms, other.rhythms))
+		return "rhythms";
+	if(!std::ranges::equal(pitchSteps, other.pitchSteps))
+		return "pitchSteps";
+	return {};
+}
+
+
 //-- AsciiRenderer --
 
 
-void AsciiRenderer::RenderBars(std::ostream& dst, GPIF& score, int track, Range<int> bars)
+void AsciiRenderer::RenderBars(std::ostream& dst, const GPIF& score, int track, Range<int> bars)
 {
 	struct beat_t
 	{
@@ -145,7 +350,7 @@ void AsciiRenderer::RenderBars(std::ostream& dst, GPIF& score, int track, Range<
 			track,
 			bar,
 			[](Clef key) {},
-			[&beats](Clef key, GPIF::Rhythm r, std::span<GPIF::Note> notes)
+			[&beats](Clef key, const GPIF::Rhythm& r, std::span<const GPIF::Note> notes)
 			{
 				beat_t b;
 				b.duration = r;
@@ -183,68 +388,121 @@ void AsciiRenderer::RenderBars(std::ostream& dst, GPIF& score, int track, Range<
 
 //-- ReaderV78 --
 
+/// Children of a section: \p count siblings, starting at \p first
+struct ReaderV78::Chunk
+{
+	node_t first;
+	std::size_t count;
+};
+
+/// Beats as they are in the file, in the form of GPIF::SetBeats()
+struct ReaderV78::BeatsRead
+{
+	std::vector<int> ids;
+	std::vector<GPIF::Beat> beats;
+	IndexLists noteIds;
+};
+
+/// Notes in the order of the file, their pitch step indexes into pitchSteps of the chunk
+struct ReaderV78::NotesRead
+{
+	std::vector<GPIF::Note> notes;
+	std::vector<std::string_view> pitchSteps = {""};
+};
+
+
 
 bool ReaderV78::isValid(std::span<const char> data)
 {
 	const std::string_view pk("PK");
-	auto d_pk = data.subspan(0, 2);
-	bool is_pkzip = std::equal(begin(d_pk), end(d_pk), begin(pk), end(pk));
-	if(!is_pkzip)
+	if(data.size() < pk.size() || !std::equal(begin(pk), end(pk), begin(data)))
 		return false;
 	ZipFile zf(data);
-
-	if(zf.exists("score.gpif"))
-		return false;
-	return true;
+	return zf.exists(m_fnGPIF);
 }
 
 
 GPIF ReaderV78::Read(std::span<const char> data)
 {
-	if(!isValid(data))
+	const std::string_view pk("PK");
+	if(data.size() < pk.size() || !std::equal(begin(pk), end(pk), begin(data)))
 		return {};
 	ZipFile zf(data);
-	auto gpifData = zf.ExtractFile(m_fnGPIF);
-	pugi::xml_document mGpifXml;
-	mGpifXml.load_buffer(gpifData.data(), gpifData.size());
-	auto gpifNode = mGpifXml.child("GPIF");
-	return Parse(gpifNode);
+	return Read(zf);
 }
 
 
 GPIF ReaderV78::Read(std::filesystem::path fn)
 {
 	ZipFile zf(fn);
-	auto gpifData = zf.ExtractFile(m_fnGPIF);
-	pugi::xml_document mGpifXml;
-	mGpifXml.load_buffer(gpifData.data(), gpifData.size());
-	auto gpifNode = mGpifXml.child("GPIF");
-	return Parse(gpifNode);
+	return Read(zf);
+}
+
+
+GPIF ReaderV78::Read(ZipFile& zf)
+{
+	std::size_t size = 0;
+	auto xml = zf.ExtractFile(m_fnGPIF, size);
+	if(!xml)
+		return {};
+	return ReadXml(std::move(xml), size);
 }
 
 
-GPIF ReaderV78::Parse(pugi::xml_node gpif)
+GPIF ReaderV78::ReadXml(std::shared_ptr<char[]> xml, std::size_t size)
 {
-	GPIF r;
+	// The parsed text stays in the buffer, which moves into the result. The XML is UTF-8, which needs no conversion.
+	pugi::xml_document doc;
+	auto result = doc.load_buffer_inplace(xml.get(), size, pugi::parse_default, pugi::encoding_utf8);
+	if(!result)
+	{
+		std::stringstream ss;
+		ss << m_fnGPIF << ": " << result.description();
+		throw std::runtime_error(ss.str());
+	}
+	return Parse(doc.child("GPIF"), std::move(xml));
+}
+
+
+GPIF ReaderV78::Parse(pugi::xml_node gpif, std::shared_ptr<const char[]> text)
+{
+	GPIF::Tables r;
 	// print(gpif, 0);
-	r.version = gpif.child("GPVersion").text().as_string();
-	r.revision = gpif.child("GPRevision").text().as_int();
-	r.tracks = ParseTracks(gpif.child("Tracks"));
-	r.masterBars = ParseMasterBars(gpif.child("MasterBars"));
-	r.bars = ParseBars(gpif.child("Bars"));
-	r.voices = ParseVoices(gpif.child("Voices"));
-	r.beats = ParseBeats(gpif.child("Beats"));
-	r.notes = ParseNotes(gpif.child("Notes"));
-	r.rhythms = ParseRhythms(gpif.child("Rhythms"));
+
+	constexpr std::size_t chunkSize = 2048;
+	const auto beatChunks = SplitChildren(gpif.child("Beats"), chunkSize);
+	const auto noteChunks = SplitChildren(gpif.child("Notes"), chunkSize);
+	std::vector<BeatsRead> beats(beatChunks.size());
+	std::vector<NotesRead> notes(noteChunks.size());
+
+	// Every task writes to its own members of r, or its own chunk. The largest go first.
+	std::vector<std::function<void()>> tasks;
+	for(std::size_t i = 0; i < noteChunks.size(); i++)
+		tasks.push_back([&, i] { ParseNotes(noteChunks[i], notes[i]); });
+	for(std::size_t i = 0; i < beatChunks.size(); i++)
+		tasks.push_back([&, i] { ParseBeats(beatChunks[i], beats[i]); });
+	tasks.push_back([&] { ParseTracks(gpif.child("Tracks"), r); });
+	tasks.push_back([&] { ParseMasterBars(gpif.child("MasterBars"), r); });
+	tasks.push_back([&] { ParseBars(gpif.child("Bars"), r); });
+	tasks.push_back([&] { ParseVoices(gpif.child("Voices"), r); });
+	tasks.push_back([&] { r.rhythms = ParseRhythms(gpif.child("Rhythms")); });
 	// ToDo: ScoreViews
 
-	return r;
+	// A small score is read before the threads would have started
+	const bool small = beatChunks.size() <= 1 && noteChunks.size() <= 1;
+	Parallel::For(tasks.size(), [&](std::size_t i) { tasks[i](); }, small ? 1 : Parallel::NrThreads());
+
+	MergeBeats(beats, notes, r);
+
+	GPIF score(std::move(r), std::move(text));
+	score.version = gpif.child("GPVersion").text().as_string();
+	score.revision = gpif.child("GPRevision").text().as_int();
+	return score;
 }
 
 
-std::vector<GPIF::Track> ReaderV78::ParseTracks(node_t tracks)
+void ReaderV78::ParseTracks(node_t tracks, GPIF::Tables& r)
 {
-	std::vector<GPIF::Track> r;
 	for(auto& track : tracks.children())
 	{
 		/* [Sounds/Sound/RSE/EffectChain] has:
@@ -274,80 +532,126 @@ std::vector<GPIF::Track> ReaderV78::ParseTracks(node_t tracks)
 			}
 		}
 
-		r.push_back(GPIF::Track{
+		r.tracks.push_back(GPIF::Track{
 			as_string(track.child("Name")),
 			track.child("PalmMute").text().as_bool(),
 		});
 	}
-	return r;
 }
 
 
-std::vector<GPIF::MasterBar> ReaderV78::ParseMasterBars(node_t mbars)
+void ReaderV78::ParseMasterBars(node_t mbars, GPIF::Tables& r)
 {
-	std::vector<GPIF::MasterBar> r;
 	for(auto& mbar : mbars.children())
 	{
-		auto time = split(mbar.child("Time"), '/');
-		r.push_back(GPIF::MasterBar{{std::stoi(time[0]), std::stoi(time[1])}, as_vector<int>(mbar.child("Bars"))});
+		r.masterBars.push_back(GPIF::MasterBar{AsTime(as_string(mbar.child("Time")))});
+		AppendInts(as_string(mbar.child("Bars")), r.masterBarBars.values);
+		r.masterBarBars.close();
 	}
-	return r;
 }
 
 
-std::vector<GPIF::Bar> ReaderV78::ParseBars(node_t bars)
+void ReaderV78::ParseBars(node_t bars, GPIF::Tables& r)
 {
-	std::vector<GPIF::Bar> r;
 	for(auto& bar : bars.children())
 	{
-		r.push_back(GPIF::Bar{Clef::A, as_vector<int>(bar.child("Voices"))});
+		r.bars.push_back(GPIF::Bar{Clef::A});
+		AppendInts(as_string(bar.child("Voices")), r.barVoices.values);
+		r.barVoices.close();
 	}
-	return r;
 }
 
 
-std::vector<GPIF::Voice> ReaderV78::ParseVoices(node_t voices)
+void ReaderV78::ParseVoices(node_t voices, GPIF::Tables& r)
 {
-	std::vector<GPIF::Voice> r;
 	for(auto& voice : voices.children())
 	{
-		r.push_back(GPIF::Voice{as_vector<int>(voice.child("Beats"))});
+		AppendInts(as_string(voice.child("Beats")), r.voiceBeats.values);
+		r.voiceBeats.close();
 	}
-	return r;
 }
 
 
-std::vector<GPIF::Beat> ReaderV78::ParseBeats(node_t beats)
+void ReaderV78::ParseBeats(const Chunk& beats, BeatsRead& r)
 {
-	std::vector<GPIF::Beat> r;
-	for(auto& beat : beats.children())
+	auto beat = beats.first;
+	for(std::size_t i = 0; i < beats.count; i++, beat = beat.next_sibling())
 	{
-		int idx = beat.attribute("id").as_int();
-		r.resize(idx + 1);
-		r[idx] = {Clef::A, beat.child("Rhythm").attribute("ref").as_int(), as_vector<int>(beat.child("Notes"))};
+		r.ids.push_back(beat.attribute("id").as_int());
+		r.beats.push_back({Clef::A, beat.child("Rhythm").attribute("ref").as_int()});
+		AppendInts(as_string(beat.child("Notes")), r.noteIds.values);
+		r.noteIds.close();
 	}
-	return r;
 }
 
 
-std::vector<GPIF::Note> ReaderV78::ParseNotes(node_t notes)
+void ReaderV78::ParseNotes(const Chunk& notes, NotesRead& r)
 {
-	std::vector<GPIF::Note> r;
-	for(auto& note : notes.children())
+	auto note = notes.first;
+	for(std::size_t i = 0; i < notes.count; i++, note = note.next_sibling())
 	{
-		GPIF::Note n;
+		GPIF::Note n{};
 		for(auto prop : note.child("Properties").children())
 		{
-			if(std::string_view(prop.attribute("name").as_string()) == "Fret")
+			std::string_view name = prop.attribute("name").as_string();
+			if(name == "Fret")
 				n.fret = prop.child("Fret").text().as_int();
-			if(std::string_view(prop.attribute("name").as_string()) == "String")
+			else if(name == "String")
 				n.string = prop.child("String").text().as_int();
+			else if(name == "ConcertPitch")
+			{
+				auto pitch = prop.child("Pitch");
+				n.pitch_step = Intern(r.pitchSteps, as_string(pitch.child("Step")));
+				n.pitch_octave = pitch.child("Octave").text().as_int();
+			}
 		}
-		if(auto lr = note.child("LetRing"))
-			n.letRing = true;
-		else
-			n.letRing = false;
-		r.push_back(n);
+		n.letRing = note.child("LetRing") ? 1 : 0;
+		r.notes.push_back(n);
+	}
+}
+
+
+void ReaderV78::MergeBeats(std::span<const BeatsRead> beats, std::span<const NotesRead> notes, GPIF::Tables& r)
+{
+	// Steps are interned in the order they were found in each chunk, so this gives the order of a single pass
+	std::vector<GPIF::Note> notesById;
+	for(const auto& chunk : notes)
+	{
+		std::vector<std::uint8_t> steps;
+		for(auto step : chunk.pitchSteps)
+			steps.push_back(r.InternPitchStep(step));
+		for(auto n : chunk.notes)
+		{
+			n.pitch_step = steps[n.pitch_step];
+			notesById.push_back(n);
+		}
+	}
+
+	BeatsRead all;
+	for(const auto& chunk : beats)
+	{
+		all.ids.insert(end(all.ids), begin(chunk.ids), end(chunk.ids));
+		all.beats.insert(end(all.beats), begin(chunk.beats), end(chunk.beats));
+		all.noteIds.append(chunk.noteIds);
+	}
+	for(int id : all.noteIds.values)
+	{
+		if(id < 0 || id >= static_cast<int>(notesById.size()))
+			throw std::runtime_error("Beat refers to note " + std::to_string(id) + ", which does not exist");
+	}
+	r.SetBeats(all.ids, all.beats, all.noteIds, notesById);
+}
+
+
+std::vector<ReaderV78::Chunk> ReaderV78::SplitChildren(node_t section, std::size_t size)
+{
+	std::vector<Chunk> r;
+	std::size_t n = 0;
+	for(auto& child : section.children())
+	{
+		if(n++ % size == 0)
+			r.push_back({child, 0});
+		r.back().count++;
 	}
 	return r;
 }
@@ -355,21 +659,12 @@ std::vector<GPIF::Note> ReaderV78::ParseNotes(node_t notes)
 
 std::vector<GPIF::Rhythm> ReaderV78::ParseRhythms(node_t rhythms)
 {
-	std::map<std::string_view, NoteValue> dmap = {
-		{"Whole", NoteValue::Whole},
-		{"Half", NoteValue::Half},
-		{"Quarter", NoteValue::Quarter},
-		{"Eighth", NoteValue::Eighth},
-		{"16th", NoteValue::_16th},
-		{"32nd", NoteValue::_32nd},
-	};
-
 	std::vector<GPIF::Rhythm> r;
 	for(auto& rhythm : rhythms.children())
 	{
-		GPIF::Rhythm rh;
+		GPIF::Rhythm rh{};
 		auto duration = rhythm.child("NoteValue");
-		rh.value = dmap.at(duration.text().as_string());
+		rh.value = noteValues.at(duration.text().as_string());
 		if(auto aug = rhythm.child("AugmentationDot"))
 			rh.augmentation = aug.attribute("count").as_int();
 		r.push_back(rh);
@@ -378,5 +673,545 @@ std::vector<GPIF::Rhythm> ReaderV78::ParseRhythms(node_t rhythms)
 }
 
 
+//-- ReaderV78::StreamBuilder --
+
+/**
+Builds a GPIF from the events of an XML::Tokenizer, with the same semantics as Parse() on a DOM:
+of repeated sections and fields only the first is used, and the text of an element is its first text.
+*/
+class ReaderV78::StreamBuilder : public XML::Handler
+{
+public:
+	GPIF Finish();
+
+private:
+	enum class Section
+	{
+		None,
+		Tracks,
+		MasterBars,
+		Bars,
+		Voices,
+		Beats,
+		Notes,
+		Rhythms,
+		Count
+	};
+
+	/// Text of the first child element with some name
+	struct Field
+	{
+		void clear()
+		{
+			seen = hasText = false;
+			text.clear();
+		}
+
+		bool seen = false; ///< The element was found, later ones with the same name are ignored
+		bool hasText = false;
+		std::string text;
+	};
+
+	void OnStartElement(std::string_view name, const XML::Attributes& attributes) override;
+	void OnEndElement(std::string_view name) override;
+	void OnText(std::string_view text) override;
+
+	/// Capture the text of the element that starts now into \p field, if it is the first of its name
+	void Capture(Field& field);
+
+	/// Start a new item of the current section
+	void StartItem(const XML::Attributes& attributes);
+
+	/// Add the item that ends now to the score
+	void EndItem();
+
+	/// Like GPIF::Tables::InternPitchStep(), the steps are stored when the score is finished
+	std::uint8_t InternPitchStep(std::string_view step);
+
+	/// Store \p text in m_text, returns its offset and size
+	std::pair<std::size_t, std::size_t> Store(std::string_view text);
+
+	GPIF::Tables m_tables;
+	int m_depth = 0; ///< Of the element that is open, the root is 1
+	bool m_isGpif = false;
+	Section m_section = Section::None;
+	std::bitset<static_cast<int>(Section::Count)> m_sectionsSeen;
+
+	// Text of the names, the views are set when the score is finished
+	std::string m_text;
+	std::pair<std::size_t, std::size_t> m_version{};
+	std::vector<std::pair<std::size_t, std::size_t>> m_trackNames;
+
+	// The item that is being read
+	Field* m_capture = nullptr;
+	int m_captureDepth = 0;
+	Field m_gpVersion, m_gpRevision;
+	Field m_name, m_palmMute, m_time, m_indices, m_noteValue, m_propertyValue, m_step, m_octave;
+	std::string_view m_indicesName; ///< Child with the indices of the current section
+	bool m_rhythmSeen, m_augmentationSeen, m_propertiesSeen, m_inProperties, m_pitchSeen, m_inPitch;
+	int m_beatId, m_rhythmRef, m_augmentation;
+	GPIF::Note m_note;
+	std::string m_propertyName;
+
+	// Beats and notes, as read, for GPIF::SetBeats()
+	std::vector<int> m_beatIds;
+	std::vector<GPIF::Beat> m_beatsRead;
+	IndexLists m_beatNoteIds;
+	std::vector<GPIF::Note> m_notes;
+	std::vector<std::string> m_pitchSteps = {""};
+};
+
+
+GPIF ReaderV78::StreamBuilder::Finish()
+{
+	for(int id : m_beatNoteIds.values)
+	{
+		if(id < 0 || id >= static_cast<int>(m_notes.size()))
+			throw std::runtime_error("Beat refers to note " + std::to_string(id) + ", which does not exist");
+	}
+	m_tables.SetBeats(m_beatIds, m_beatsRead, m_beatNoteIds, m_notes);
+
+	m_version = Store(m_gpVersion.text);
+	std::vector<std::pair<std::size_t, std::size_t>> steps;
+	for(const auto& step : m_pitchSteps)
+		steps.push_back(Store(step));
+
+	auto text = std::make_shared_for_overwrite<char[]>(m_text.size());
+	std::copy(begin(m_text), end(m_text), text.get());
+	auto view = [&](std::pair<std::size_t, std::size_t> r) { return std::string_view(text.get() + r.first, r.second); };
+
+	for(std::size_t i = 0; i < m_trackNames.size(); i++)
+		m_tables.tracks[i].name = view(m_trackNames[i]);
+	m_tables.pitchSteps.clear();
+	for(auto step : steps)
+		m_tables.pitchSteps.push_back(view(step));
+
+	GPIF score(std::move(m_tables), text);
+	score.version = view(m_version);
+	score.revision = AsInt(m_gpRevision.text);
+	return score;
+}
+
+
+void ReaderV78::StreamBuilder::OnStartElement(std::string_view name, const XML::Attributes& attributes)
+{
+	constexpr std::array<std::string_view, static_cast<int>(Section::Count)> sections = {
+		"", "Tracks", "MasterBars", "Bars", "Voices", "Beats", "Notes", "Rhythms"};
+
+	const int depth = ++m_depth;
+	if(depth == 1)
+	{
+		m_isGpif = name == "GPIF";
+		return;
+	}
+	if(!m_isGpif)
+		return;
+
+	if(depth == 2)
+	{
+		if(name == "GPVersion")
+			return Capture(m_gpVersion);
+		if(name == "GPRevision")
+			return Capture(m_gpRevision);
+		auto it = std::find(begin(sections) + 1, end(sections), name);
+		int section = it - begin(sections);
+		if(it == end(sections) || m_sectionsSeen.test(section))
+			return;
+		m_sectionsSeen.set(section);
+		m_section = static_cast<Section>(section);
+		return;
+	}
+	if(m_section == Section::None)
+		return;
+
+	if(depth == 3)
+		return StartItem(attributes);
+
+	if(depth == 4)
+	{
+		switch(m_section)
+		{
+		case Section::Tracks:
+			if(name == "Name")
+				Capture(m_name);
+			else if(name == "PalmMute")
+				Capture(m_palmMute);
+			break;
+		case Section::MasterBars:
+			if(name == "Time")
+				Capture(m_time);
+			else if(name == m_indicesName)
+				Capture(m_indices);
+			break;
+		case Section::Bars:
+		case Section::Voices:
+			if(name == m_indicesName)
+				Capture(m_indices);
+			break;
+		case Section::Beats:
+			if(name == "Rhythm" && !m_rhythmSeen)
+			{
+				m_rhythmSeen = true;
+				m_rhythmRef = AsInt(XML::find(attributes, "ref"));
+			}
+			else if(name == m_indicesName)
+			{
+				Capture(m_indices);
+			}
+			break;
+		case Section::Notes:
+			if(name == "Properties" && !m_propertiesSeen)
+				m_propertiesSeen = m_inProperties = true;
+			else if(name == "LetRing")
+				m_note.letRing = true;
+			break;
+		case Section::Rhythms:
+			if(name == "NoteValue")
+				Capture(m_noteValue);
+			else if(name == "AugmentationDot" && !m_augmentationSeen)
+			{
+				m_augmentationSeen = true;
+				m_augmentation = AsInt(XML::find(attributes, "count"));
+			}
+			break;
+		default:
+			break;
+		}
+		return;
+	}
+
+	// <Properties><Property name="Fret"><Fret>3</Fret></Property>
+	if(m_section == Section::Notes && m_inProperties)
+	{
+		if(depth == 5)
+		{
+			m_propertyName = XML::find(attributes, "name");
+			for(Field* f : {&m_propertyValue, &m_step, &m_octave})
+				f->clear();
+			m_pitchSeen = m_inPitch = false;
+		}
+		else if(depth == 6 && m_propertyName == "ConcertPitch")
+		{
+			// <Pitch><Step>C</Step><Octave>4</Octave></Pitch>
+			if(name == "Pitch" && !m_pitchSeen)
+				m_pitchSeen = m_inPitch = true;
+		}
+		else if(depth == 6 && name == m_propertyName)
+		{
+			Capture(m_propertyValue);
+		}
+		else if(depth == 7 && m_inPitch)
+		{
+			if(name == "Step")
+				Capture(m_step);
+			else if(name == "Octave")
+				Capture(m_octave);
+		}
+	}
+}
+
+
+void ReaderV78::StreamBuilder::OnEndElement(std::string_view name)
+{
+	const int depth = m_depth--;
+	if(m_capture != nullptr && depth == m_captureDepth)
+		m_capture = nullptr;
+	if(!m_isGpif || depth == 1)
+		return;
+
+	if(depth == 2)
+	{
+		m_section = Section::None;
+	}
+	else if(depth == 3 && m_section != Section::None)
+	{
+		EndItem();
+	}
+	else if(depth == 4 && m_inProperties)
+	{
+		m_inProperties = false;
+	}
+	else if(depth == 5 && m_inProperties)
+	{
+		// Like prop.child("Fret").text().as_int(), which is 0 without such a child
+		if(m_propertyName == "Fret")
+			m_note.fret = AsInt(m_propertyValue.text);
+		else if(m_propertyName == "String")
+			m_note.string = AsInt(m_propertyValue.text);
+		else if(m_propertyName == "ConcertPitch")
+		{
+			m_note.pitch_step = InternPitchStep(m_step.text);
+			m_note.pitch_octave = AsInt(m_octave.text);
+		}
+	}
+	else if(depth == 6 && m_inPitch)
+	{
+		m_inPitch = false;
+	}
+}
+
+
+void ReaderV78::StreamBuilder::OnText(std::string_view text)
+{
+	if(m_capture == nullptr || m_depth != m_captureDepth || m_capture->hasText)
+		return;
+	m_capture->text = text;
+	m_capture->hasText = true;
+}
+
+
+void ReaderV78::StreamBuilder::Capture(Field& field)
+{
+	if(field.seen)
+		return;
+	field.seen = true;
+	m_capture = &field;
+	m_captureDepth = m_depth;
+}
+
+
+void ReaderV78::StreamBuilder::StartItem(const XML::Attributes& attributes)
+{
+	constexpr std::array<std::string_view, static_cast<int>(Section::Count)> indices = {
+		"", "", "Bars", "Voices", "Beats", "Notes", "", ""};
+
+	m_capture = nullptr;
+	for(Field* f : {&m_name, &m_palmMute, &m_time, &m_indices, &m_noteValue, &m_propertyValue, &m_step, &m_octave})
+		f->clear();
+	m_indicesName = indices[static_cast<int>(m_section)];
+	m_rhythmSeen = m_augmentationSeen = m_propertiesSeen = m_inProperties = m_pitchSeen = m_inPitch = false;
+	m_beatId = m_section == Section::Beats ? AsInt(XML::find(attributes, "id")) : 0;
+	m_rhythmRef = m_augmentation = 0;
+	m_note = {};
+}
+
+
+void ReaderV78::StreamBuilder::EndItem()
+{
+	switch(m_section)
+	{
+	case Section::Tracks:
+		m_trackNames.push_back(Store(m_name.text));
+		m_tables.tracks.push_back(GPIF::Track{{}, AsBool(m_palmMute.text)});
+		break;
+	case Section::MasterBars:
+		m_tables.masterBars.push_back(GPIF::MasterBar{AsTime(m_time.text)});
+		AppendInts(m_indices.text, m_tables.masterBarBars.values);
+		m_tables.masterBarBars.close();
+		break;
+	case Section::Bars:
+		m_tables.bars.push_back(GPIF::Bar{Clef::A});
+		AppendInts(m_indices.text, m_tables.barVoices.values);
+		m_tables.barVoices.close();
+		break;
+	case Section::Voices:
+		AppendInts(m_indices.text, m_tables.voiceBeats.values);
+		m_tables.voiceBeats.close();
+		break;
+	case Section::Beats:
+		m_beatIds.push_back(m_beatId);
+		m_beatsRead.push_back({Clef::A, m_rhythmRef});
+		AppendInts(m_indices.text, m_beatNoteIds.values);
+		m_beatNoteIds.close();
+		break;
+	case Section::Notes:
+		m_notes.push_back(m_note);
+		break;
+	case Section::Rhythms:
+		m_tables.rhythms.push_back(
+			GPIF::Rhythm{noteValues.at(m_noteValue.text), static_cast<std::uint8_t>(m_augmentation)});
+		break;
+	default:
+		break;
+	}
+}
+
+
+std::uint8_t ReaderV78::StreamBuilder::InternPitchStep(std::string_view step)
+{
+	auto it = std::find(begin(m_pitchSteps), end(m_pitchSteps), step);
+	if(it != end(m_pitchSteps))
+		return it - begin(m_pitchSteps);
+	if(m_pitchSteps.size() == 0x80)
+		throw std::runtime_error("Too many pitch steps");
+	m_pitchSteps.emplace_back(step);
+	return m_pitchSteps.size() - 1;
+}
+
+
+std::pair<std::size_t, std::size_t> ReaderV78::StreamBuilder::Store(std::string_view text)
+{
+	std::pair<std::size_t, std::size_t> r{m_text.size(), text.size()};
+	m_text.append(text);
+	return r;
+}
+
+
+GPIF ReaderV78::Stream(std::span<const char> data)
+{
+	const std::string_view pk("PK");
+	if(data.size() < pk.size() || !std::equal(begin(pk), end(pk), begin(data)))
+		return {};
+	ZipFile zf(data);
+	return Stream(zf);
+}
+
+
+GPIF ReaderV78::Stream(std::filesystem::path fn)
+{
+	ZipFile zf(fn);
+	return Stream(zf);
+}
+
+
+GPIF ReaderV78::Stream(ZipFile& zf)
+{
+	StreamBuilder builder;
+	XML::Tokenizer tokenizer(builder);
+	auto feed = [&](std::string_view chunk)
+	{
+		tokenizer.Feed(chunk);
+		return true;
+	};
+	if(!zf.ReadChunks(m_fnGPIF, feed))
+		return {};
+	tokenizer.Finish();
+	return builder.Finish();
+}
+
+
+//-- ReaderV78::InfoBuilder --
+
+/// Collects a ScoreInfo from the events of an XML::Tokenizer, up to the end of the master bars
+class ReaderV78::InfoBuilder : public XML::Handler
+{
+public:
+	/// The master bars have ended, what follows is not needed
+	bool done() const
+	{
+		return m_done;
+	}
+
+	ScoreInfo Finish()
+	{
+		return std::move(m_info);
+	}
+
+private:
+	void OnStartElement(std::string_view name, const XML::Attributes& attributes) override;
+	void OnEndElement(std::string_view name) override;
+	void OnText(std::string_view text) override;
+
+	ScoreInfo m_info;
+	bool m_done = false;
+	std::string m_path; ///< Of the open element, like "/GPIF/Score/Title"
+	bool m_hasText = false;
+	bool m_trackHasTuning = false;
+	std::string m_automationType, m_automationValue;
+	int m_automationBar = 0;
+	int m_tempoBar = 0; ///< Of the tempo in m_info
+};
+
+
+void ReaderV78::InfoBuilder::OnStartElement(std::string_view name, const XML::Attributes&)
+{
+	if(m_done)
+		return;
+	m_path += '/';
+	m_path += name;
+	m_hasText = false;
+
+	if(m_path == "/GPIF/Tracks/Track")
+	{
+		m_info.tracks.emplace_back();
+		m_trackHasTuning = false;
+	}
+	else if(m_path == "/GPIF/MasterBars/MasterBar")
+		m_info.nrBars++;
+	else if(m_path == "/GPIF/MasterTrack/Automations/Automation")
+	{
+		m_automationType.clear();
+		m_automationValue.clear();
+		m_automationBar = 0;
+	}
+}
+
+
+void ReaderV78::InfoBuilder::OnEndElement(std::string_view name)
+{
+	if(m_done)
+		return;
+	if(m_path == "/GPIF/MasterBars")
+		m_done = true;
+	else if(m_path == "/GPIF/MasterTrack/Automations/Automation" && m_automationType == "Tempo")
+	{
+		// The tempo at the start is the one of the first bar
+		if(m_info.tempo == 0 || m_automationBar < m_tempoBar)
+		{
+			m_info.tempo = AsInt(m_automationValue);
+			m_tempoBar = m_automationBar;
+		}
+	}
+	m_path.resize(std::min(m_path.rfind('/'), m_path.size()));
+	m_hasText = false;
+}
+
+
+void ReaderV78::InfoBuilder::OnText(std::string_view text)
+{
+	// Like the DOM, only the first text of an element counts
+	if(m_done || m_hasText)
+		return;
+	m_hasText = true;
+
+	if(m_path == "/GPIF/GPVersion")
+		m_info.version = text;
+	else if(m_path == "/GPIF/Score/Title")
+		m_info.title = text;
+	else if(m_path == "/GPIF/Score/Artist")
+		m_info.artist = text;
+	else if(m_path == "/GPIF/MasterTrack/Automations/Automation/Type")
+		m_automationType = text;
+	else if(m_path == "/GPIF/MasterTrack/Automations/Automation/Value")
+		m_automationValue = text;
+	else if(m_path == "/GPIF/MasterTrack/Automations/Automation/Bar")
+		m_automationBar = AsInt(text);
+	else if(m_path == "/GPIF/Tracks/Track/Name")
+		m_info.tracks.back().name = text;
+	else if(m_path.starts_with("/GPIF/Tracks/Track/") && m_path.ends_with("/Pitches") && !m_trackHasTuning)
+	{
+		// Of the track, or of its first staff
+		m_trackHasTuning = true;
+		AppendInts(text, m_info.tracks.back().tuning);
+	}
+}
+
+
+ScoreInfo ReaderV78::ReadInfo(std::span<const char> data)
+{
+	const std::string_view pk("PK");
+	if(data.size() < pk.size() || !std::equal(begin(pk), end(pk), begin(data)))
+		throw std::runtime_error("Not a GuitarPro 7/8 file");
+	ZipFile zf(data);
+	return ReadInfo([&](const ChunkSink& sink) { return zf.ReadChunks(m_fnGPIF, sink); });
+}
+
+
+ScoreInfo ReaderV78::ReadInfo(const std::function<bool(const ChunkSink&)>& read)
+{
+	InfoBuilder builder;
+	XML::Tokenizer tokenizer(builder);
+	auto feed = [&](std::string_view chunk)
+	{
+		tokenizer.Feed(chunk);
+		return !builder.done();
+	};
+	if(!read(feed))
+		throw std::runtime_error("File has no score");
+	if(!builder.done())
+		tokenizer.Finish();
+	return builder.Finish();
+}
+
 
 } // namespace GuitarPro
@@ -1,8 +1,12 @@
 #pragma once
 
 #include <filesystem>
+#include <functional>
+#include <memory>
 #include <span>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include <fmt/format.h>
@@ -42,96 +46,252 @@ public:
 };
 
 
+/// Lists of indices in one array: list i is values[offsets[i]] up to values[offsets[i + 1]]
+struct IndexLists
+{
+	std::size_t size() const
+	{
+		return offsets.size() - 1;
+	}
+
+	std::span<const int> operator[](std::size_t i) const
+	{
+		return std::span(values).subspan(offsets[i], offsets[i + 1] - offsets[i]);
+	}
+
+	/// End the list that was appended to values
+	void close()
+	{
+		offsets.push_back(static_cast<std::uint32_t>(values.size()));
+	}
+
+	/// Append the lists of \p other
+	void append(const IndexLists& other)
+	{
+		const auto base = static_cast<std::uint32_t>(values.size());
+		values.insert(values.end(), other.values.begin(), other.values.end());
+		for(std::size_t i = 1; i < other.offsets.size(); i++)
+			offsets.push_back(base + other.offsets[i]);
+	}
+
+	std::vector<std::uint32_t> offsets = {0};
+	std::vector<int> values;
+};
+
+
+/// The lists of an IndexLists, in arrays that are owned elsewhere
+struct IndexListsView
+{
+	IndexListsView() = default;
+
+	IndexListsView(const IndexLists& lists)
+		: offsets(lists.offsets), values(lists.values)
+	{
+	}
+
+	IndexListsView(std::span<const std::uint32_t> offsets, std::span<const int> values)
+		: offsets(offsets), values(values)
+	{
+	}
+
+	std::size_t size() const
+	{
+		return offsets.empty() ? 0 : offsets.size() - 1;
+	}
+
+	std::span<const int> operator[](std::size_t i) const
+	{
+		return values.subspan(offsets[i], offsets[i + 1] - offsets[i]);
+	}
+
+	std::span<const std::uint32_t> offsets;
+	std::span<const int> values;
+};
+
+
+/**
+A score, as read from the score.gpif of a GuitarPro 7/8 file, or from a binary GuitarPro 3-5 file.
+
+The tables are stored by column: the indices of a bar, voice or beat are ranges in IndexLists,
+and the notes are ordered by beat, so visitNotes() hands out views without allocating.
+The tables and text are views of storage that is shared by all copies of a GPIF: what a reader built,
+or a mapped ScoreCache file.
+*/
 struct GPIF
 {
 	struct Track
 	{
-		std::string name;
+		std::string_view name;
 		bool palmMute;
+
+		bool operator==(const Track&) const = default;
 	};
 
 	struct Time
 	{
 		int num, den;
+
+		bool operator==(const Time&) const = default;
 	};
 
 	struct MasterBar
 	{
 		Time time;
-		std::vector<int> bars; ///< 1 bar per track
+
+		bool operator==(const MasterBar&) const = default;
 	};
 
 	struct Bar
 	{
 		Clef clef;
-		std::vector<int> voices;
-	};
 
-	struct Voice
-	{
-		std::vector<int> beats;
+		bool operator==(const Bar&) const = default;
 	};
 
 	struct Beat
 	{
 		Clef dynamic;
 		int rhythm;
-		std::vector<int> notes;
+
+		bool operator==(const Beat&) const = default;
 	};
 
 	struct Note
 	{
-		std::string pitch_step;
-		int pitch_octave;
-		int fret;	  ///< 0-base?
-		int string;	  ///< 0-based
-		bool letRing; ///< This makes it repeat for all succesive notes
+		std::uint8_t fret;			 ///< 0-base?
+		std::uint8_t string;		 ///< 0-based
+		std::int8_t pitch_octave;	 ///< 0 without a pitch
+		std::uint8_t pitch_step : 7; ///< Index into GPIF::pitchSteps, 0 without a pitch
+		std::uint8_t letRing : 1;	 ///< This makes it repeat for all succesive notes
+
+		bool operator==(const Note&) const = default;
 	};
+	static_assert(sizeof(Note) == 4);
 
 	struct Rhythm
 	{
 		NoteValue value;
 		std::uint8_t augmentation;
+
+		bool operator==(const Rhythm&) const = default;
 	};
 
-	int nrTracks();
+	GPIF() = default;
 
-	int nrBars();
+	int nrTracks() const;
 
-	template<std::invocable<Clef> CbBar, std::invocable<Clef, Rhythm, std::span<Note>> CbBeat>
-	void visitNotes(int idx_track, int idx_bar, CbBar&& cbBar, CbBeat&& cbBeat)
+	int nrBars() const;
+
+	/// "C" .. "B", or "" if \p note has no pitch
+	std::string_view pitchStep(const Note& note) const
 	{
-		const Bar& vbar = bars[masterBars[idx_bar].bars[idx_track]];
-		cbBar(vbar.clef);
-		for(int idx_voice : vbar.voices)
+		return at(pitchSteps, note.pitch_step);
+	}
+
+	/// The notes of beat \p idx_beat
+	std::span<const Note> notesOf(int idx_beat) const
+	{
+		const auto first = at(beatNotes, idx_beat);
+		return notes.subspan(first, at(beatNotes, idx_beat + 1) - first);
+	}
+
+	template<std::invocable<Clef> CbBar, std::invocable<Clef, const Rhythm&, std::span<const Note>> CbBeat>
+	void visitNotes(int idx_track, int idx_bar, CbBar&& cbBar, CbBeat&& cbBeat) const
+	{
+		const int idx_vbar = masterBarBars[idx_bar][idx_track];
+		cbBar(at(bars, idx_vbar).clef);
+		for(int idx_voice : barVoices[idx_vbar])
 		{
 			if(idx_voice < 0)
 				continue;
-			for(int idx_beat : voices[idx_voice].beats)
+			for(int idx_beat : voiceBeats[idx_voice])
 			{
-				std::vector<Note> notes;
-				Beat& beat = beats.at(idx_beat);
-				for(int idx_note : beat.notes)
-					notes.push_back(this->notes.at(idx_note));
-				Rhythm& r = rhythms.at(beat.rhythm);
-				cbBeat(beat.dynamic, r, notes);
+				const Beat& beat = at(beats, idx_beat);
+				cbBeat(beat.dynamic, at(rhythms, beat.rhythm), notesOf(idx_beat));
 			}
 		}
 	}
 
-	std::string version;
+	/// Name of the first table that differs from \p other, empty if the scores are equal
+	std::string_view Difference(const GPIF& other) const;
+
+	std::string_view version;
 	int revision;
 
 private:
+	friend class ReaderV345;
 	friend class ReaderV78;
+	friend class ScoreCache;
+
+	/// The tables of a score while it is read, with the names of the views of GPIF
+	struct Tables
+	{
+		/**
+		Store the beats and notes as they were read: \p beatIds, \p beatsRead and \p beatNoteIds in the order of the
+		file, the notes by id. Beats are placed at their id, the notes are copied into the order of the beats.
+		*/
+		void SetBeats(std::span<const int> beatIds,
+					  std::span<const Beat> beatsRead,
+					  const IndexLists& beatNoteIds,
+					  std::span<const Note> notesById);
+
+		/// Index of \p step in pitchSteps, which is added if it is new. The view has to stay valid.
+		std::uint8_t InternPitchStep(std::string_view step);
+
+		std::vector<Track> tracks;
+		std::vector<MasterBar> masterBars;
+		IndexLists masterBarBars;
+		std::vector<Bar> bars;
+		IndexLists barVoices;
+		IndexLists voiceBeats;
+		std::vector<Beat> beats;
+		std::vector<std::uint32_t> beatNotes = {0};
+		std::vector<Note> notes;
+		std::vector<Rhythm> rhythms;
+		std::vector<std::string_view> pitchSteps = {""};
+	};
+
+	/// Views of \p tables, which are kept together with \p text that their names point into
+	GPIF(Tables&& tables, std::shared_ptr<const void> text);
+
+	/// Like std::vector::at()
+	template<typename T>
+	static const T& at(std::span<const T> s, std::size_t i)
+	{
+		if(i >= s.size())
+			throw std::out_of_range("GPIF: index out of range");
+		return s[i];
+	}
 
+	std::shared_ptr<const void> m_storage; ///< Holds what the views point into
+
+	std::span<const Track> tracks;
+	std::span<const MasterBar> masterBars; ///< Entry point for tab rendering
+	IndexListsView masterBarBars;		   ///< 1 bar per track, per master bar
+	std::span<const Bar> bars;
+	IndexListsView barVoices;
+	IndexListsView voiceBeats;
+	std::span<const Beat> beats;
+	std::span<const std::uint32_t> beatNotes; ///< Beat i has notes[beatNotes[i]] up to notes[beatNotes[i + 1]]
+	std::span<const Note> notes;			  ///< In the order of the beats
+	std::span<const Rhythm> rhythms;
+	std::span<const std::string_view> pitchSteps; ///< Interned, the first is for notes without a pitch
+};
+
+/// What a catalog shows of a score, read from its header without the bars
+struct ScoreInfo
+{
+	struct Track
+	{
+		std::string name;
+		std::vector<int> tuning; ///< MIDI note of each string, from the lowest
+	};
+
+	std::string version; ///< As the file states it
+	std::string title, artist;
 	std::vector<Track> tracks;
-	std::vector<MasterBar> masterBars; ///< Entry point for tab rendering
-	std::vector<Bar> bars;
-	std::vector<Voice> voices;
-	std::vector<Beat> beats;
-	std::vector<Note> notes;
-	std::vector<Rhythm> rhythms;
+	int nrBars = 0;
+	int tempo = 0; ///< Beats per minute at the start, 0 if the file has none
 };
 
 /*
@@ -151,12 +311,75 @@ public:
 	};
 
 	///< Number of bars in the track, given a max. column width
-	int NrBars(GPIF& score, int track, int colwidth);
+	int NrBars(const GPIF& score, int track, int colwidth);
 
-	static void RenderBars(std::ostream& dst, GPIF& score, int track, Range<int> bars);
+	static void RenderBars(std::ostream& dst, const GPIF& score, int track, Range<int> bars);
 
 private:
-	static int BarWidth(GPIF& score, int track, int bar);
+	static int BarWidth(const GPIF& score, int track, int bar);
+};
+
+
+/**
+Version 3,4,5: binary .gp3, .gp4, .gp5
+
+The file is read front to back in one pass, through a cursor that checks every read against the end of the data.
+Only what a GPIF holds is kept, the names are views of the file. GuitarPro 3-5 stores text in the
+encoding of the system that wrote it, often Windows-1252, which is not converted.
+*/
+class ReaderV345
+{
+public:
+	/// Returns true if \p data starts with the header of a GuitarPro 3, 4 or 5 file
+	static bool isValid(std::span<const char> data);
+
+	/// \p data is copied, throws if it is not a GuitarPro 3, 4 or 5 file
+	static GPIF Read(std::span<const char> data);
+
+	/// The file stays mapped while the score is used
+	static GPIF Read(std::filesystem::path fname);
+
+	/// Only the header and the tracks of \p data are read, throws if it is not a GuitarPro 3, 4 or 5 file
+	static ScoreInfo ReadInfo(std::span<const char> data);
+
+private:
+	class Parser;
+
+	/// Parse \p data, which is kept alive by \p storage
+	static GPIF Read(std::span<const char> data, std::shared_ptr<const void> storage);
+};
+
+
+/**
+Version 6: .gpx, a BCFS file system that is usually BCFZ compressed. Its score.gpif is parsed like that of version 7.
+
+The file system is decompressed into a buffer per thread, which is reused for the next file.
+Only the score is copied out of it, sector by sector into the buffer that it is parsed in.
+*/
+class ReaderV6
+{
+public:
+	/// Returns true if \p data starts with the header of a BCFZ or BCFS block
+	static bool isValid(std::span<const char> data);
+
+	/// Throws if \p data is not a GuitarPro 6 file, or has no score
+	static GPIF Read(std::span<const char> data);
+	static GPIF Read(std::filesystem::path fname);
+
+	/// The info of the score, which is read up to the end of its master bars
+	static ScoreInfo ReadInfo(std::span<const char> data);
+
+	/// Decompress the BCFZ block \p src into \p dst, which starts with the header of the BCFS block
+	static void Decompress(std::span<const char> src, std::vector<char>& dst);
+
+private:
+	/// The BCFS block of \p data, after its header. Decompressed into a buffer of this thread if needed.
+	static std::span<const char> FileSystem(std::span<const char> data);
+
+	/// Copy file \p name out of the BCFS block \p fs, with a terminating zero. Returns nullptr if it is not there.
+	static std::shared_ptr<char[]> ExtractFile(std::span<const char> fs, std::string_view name, std::size_t& size);
+
+	constexpr static std::string_view m_fnGPIF = "score.gpif";
 };
 
 
@@ -167,21 +390,65 @@ public:
 	/// Returns true if this is a valid/parseable file
 	static bool isValid(std::span<const char> data);
 
+	/// An empty score if \p data is not a GuitarPro 7/8 file
 	static GPIF Read(std::span<const char> data);
 	static GPIF Read(std::filesystem::path fname);
 
+	/**
+	Read the score while it is decompressed, without a DOM of the XML.
+	Memory is bounded by the score, not by the XML. The result is equal to that of Read().
+	*/
+	static GPIF Stream(std::span<const char> data);
+	static GPIF Stream(std::filesystem::path fname);
+
+	/// The info of the score, which is decompressed and parsed up to the end of its master bars
+	static ScoreInfo ReadInfo(std::span<const char> data);
+
 private:
+	friend class ReaderV6;
+
 	using node_t = pugi::xml_node;
 
-	static GPIF Parse(node_t gpif);
-	static std::vector<GPIF::Track> ParseTracks(node_t tracks);
-	static std::vector<GPIF::MasterBar> ParseMasterBars(node_t mbars);
-	static std::vector<GPIF::Bar> ParseBars(node_t bars);
-	static std::vector<GPIF::Voice> ParseVoices(node_t voices);
-	static std::vector<GPIF::Beat> ParseBeats(node_t beats);
-	static std::vector<GPIF::Note> ParseNotes(node_t notes);
+	/// Takes the next chunk of a score.gpif, returns false when no more are needed
+	using ChunkSink = std::function<bool(std::string_view)>;
+
+	class ZipFile;
+	class StreamBuilder;
+	class InfoBuilder;
+	struct Chunk;
+	struct BeatsRead;
+	struct NotesRead;
+
+	static GPIF Stream(ZipFile& zf);
+
+	/// Decompress and parse the score.gpif of \p zf, in place
+	static GPIF Read(ZipFile& zf);
+
+	/// The info of a score.gpif, of which \p read passes the chunks to a ChunkSink. Throws if there is no score.
+	static ScoreInfo ReadInfo(const std::function<bool(const ChunkSink&)>& read);
+
+	/// Parse the score.gpif in \p xml, in place. The buffer has a terminating zero after \p size.
+	static GPIF ReadXml(std::shared_ptr<char[]> xml, std::size_t size);
+
+	/**
+	Parse the sections of \p gpif in parallel, each into its own part of the score. The names point into \p text.
+	Beats and Notes, most of a score, are split into chunks of children which are merged once all are read.
+	*/
+	static GPIF Parse(node_t gpif, std::shared_ptr<const char[]> text);
+	static void ParseTracks(node_t tracks, GPIF::Tables& r);
+	static void ParseMasterBars(node_t mbars, GPIF::Tables& r);
+	static void ParseBars(node_t bars, GPIF::Tables& r);
+	static void ParseVoices(node_t voices, GPIF::Tables& r);
+	static void ParseBeats(const Chunk& beats, BeatsRead& r);
+	static void ParseNotes(const Chunk& notes, NotesRead& r);
 	static std::vector<GPIF::Rhythm> ParseRhythms(node_t rhythms);
 
+	/// Concatenate the chunks in the order of the file, and place the beats by id
+	static void MergeBeats(std::span<const BeatsRead> beats, std::span<const NotesRead> notes, GPIF::Tables& r);
+
+	/// The children of \p section, in chunks of at most \p size
+	static std::vector<Chunk> SplitChildren(node_t section, std::size_t size);
+
 	constexpr static std::string_view m_fnGPIF = "Content/score.gpif";
 	// pugi::xml_document mGpifXml;
 };
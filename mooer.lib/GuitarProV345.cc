@@ -0,0 +1,611 @@
+#include <GuitarPro.h>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <string>
+#include <type_traits>
+
+#include <MappedFile.h>
+
+
+namespace GuitarPro
+{
+
+namespace
+{
+
+constexpr std::string_view g_versionPrefix = "FICHIER GUITAR PRO v";
+
+/// Size of the version string, after its length byte
+constexpr std::size_t g_versionSize = 30;
+
+constexpr int g_maxStrings = 7;
+
+
+/// Reads the little-endian fields of a file, throws instead of reading past its end
+class Cursor
+{
+public:
+	explicit Cursor(std::span<const char> data)
+		: m_data(data)
+	{
+	}
+
+	template<typename T>
+	T read()
+	{
+		static_assert(std::is_integral_v<T>);
+		const auto bytes = take(sizeof(T));
+		std::make_unsigned_t<T> v = 0;
+		for(std::size_t i = 0; i < sizeof(T); i++)
+			v |= static_cast<std::make_unsigned_t<T>>(static_cast<std::uint8_t>(bytes[i])) << (8 * i);
+		return static_cast<T>(v);
+	}
+
+	void skip(std::size_t n)
+	{
+		take(n);
+	}
+
+	/// A count that is followed by at least \p n * \p elementSize bytes, to reject corrupt counts early
+	int count(std::size_t elementSize)
+	{
+		const auto n = read<std::int32_t>();
+		if(n < 0 || static_cast<std::size_t>(n) > remaining() / elementSize)
+			throw std::runtime_error("GuitarPro: invalid count " + std::to_string(n) + " at " + std::to_string(m_pos));
+		return n;
+	}
+
+	/// A length byte, then \p size bytes of which the first length are the text
+	std::string_view byteSizeString(std::size_t size)
+	{
+		const std::size_t length = read<std::uint8_t>();
+		return take(size).substr(0, std::min(length, size));
+	}
+
+	/// The size of what follows as int, then a byteSizeString() of that size minus one
+	std::string_view intByteSizeString()
+	{
+		const auto size = read<std::int32_t>() - 1;
+		const std::size_t length = read<std::uint8_t>();
+		const std::size_t n = size > 0 ? static_cast<std::size_t>(size) : length;
+		return take(n).substr(0, std::min(length, n));
+	}
+
+	/// Text of which the size is an int
+	std::string_view intSizeString()
+	{
+		const auto size = read<std::int32_t>();
+		if(size < 0)
+			throw std::runtime_error("GuitarPro: invalid text size at " + std::to_string(m_pos));
+		return take(size);
+	}
+
+	std::size_t remaining() const
+	{
+		return m_data.size() - m_pos;
+	}
+
+private:
+	std::string_view take(std::size_t n)
+	{
+		if(n > remaining())
+			throw std::runtime_error("GuitarPro: file is truncated at " + std::to_string(m_pos));
+		std::string_view r(m_data.data() + m_pos, n);
+		m_pos += n;
+		return r;
+	}
+
+	std::span<const char> m_data;
+	std::size_t m_pos = 0;
+};
+
+
+/// 300 for "FICHIER GUITAR PRO v3.00", 0 if \p header is not of a version that can be read
+int ParseVersion(std::string_view header)
+{
+	if(!header.starts_with(g_versionPrefix))
+		return 0;
+	header.remove_prefix(g_versionPrefix.size());
+	int major = 0, minor = 0;
+	auto [p, ec] = std::from_chars(header.data(), header.data() + header.size(), major);
+	if(ec != std::errc() || p == header.data() + header.size() || *p != '.')
+		return 0;
+	ec = std::from_chars(p + 1, header.data() + header.size(), minor).ec;
+	if(ec != std::errc() || major < 3 || major > 5)
+		return 0;
+	return 100 * major + minor;
+}
+
+} // namespace
+
+
+//-- ReaderV345::Parser --
+
+/**
+Reads the sections in the order of the file. The fields that a GPIF has no place for are skipped,
+the comment next to a skip names them.
+*/
+class ReaderV345::Parser
+{
+public:
+	explicit Parser(std::span<const char> data)
+		: m_c(data)
+	{
+	}
+
+	GPIF Read(std::shared_ptr<const void> storage);
+
+	/// Only up to the tracks
+	ScoreInfo ReadScoreInfo();
+
+private:
+	/// Everything before the measures
+	void ReadHeader();
+	void ReadInfo();
+	void ReadLyrics();
+	void ReadPageSetup();
+	void ReadMeasureHeaders(int nrMeasures);
+	void ReadTracks(int nrTracks);
+	void ReadMeasures();
+	void ReadVoice(int track);
+	void ReadBeat(int track);
+	void ReadChord();
+	void ReadBeatEffects();
+	void ReadMixTableChange();
+	void ReadNote(int track, int string);
+	/// Returns whether the note rings
+	bool ReadNoteEffects();
+	/// Also the layout of a tremolo bar
+	void ReadBend();
+
+	/// Index of the rhythm of \p duration (-2 for whole, up to 4 for 64th)
+	int InternRhythm(int duration, bool dotted);
+
+	Cursor m_c;
+	std::string_view m_header;
+	int m_version = 0; ///< 300 .. 510
+	std::string_view m_title, m_artist;
+	int m_tempo = 0;
+	GPIF::Tables m_tables;
+
+	/// Strings and their tuning, from the highest, and the last fret on each. A tied note has the fret of the previous.
+	struct TrackState
+	{
+		int nrStrings;
+		std::array<int, g_maxStrings> tuning;
+		std::array<std::uint8_t, g_maxStrings> frets;
+	};
+	std::vector<TrackState> m_trackState;
+};
+
+
+GPIF ReaderV345::Parser::Read(std::shared_ptr<const void> storage)
+{
+	ReadHeader();
+	ReadMeasures();
+
+	GPIF score(std::move(m_tables), std::move(storage));
+	score.version = m_header.substr(g_versionPrefix.size());
+	score.revision = 0;
+	return score;
+}
+
+
+ScoreInfo ReaderV345::Parser::ReadScoreInfo()
+{
+	ReadHeader();
+
+	ScoreInfo info;
+	info.version = m_header.substr(g_versionPrefix.size());
+	info.title = m_title;
+	info.artist = m_artist;
+	info.nrBars = static_cast<int>(m_tables.masterBars.size());
+	info.tempo = m_tempo;
+	for(std::size_t t = 0; t < m_tables.tracks.size(); t++)
+	{
+		const TrackState& state = m_trackState[t];
+		ScoreInfo::Track& track = info.tracks.emplace_back();
+		track.name = m_tables.tracks[t].name;
+		track.tuning.assign(state.tuning.rend() - state.nrStrings, state.tuning.rend());
+	}
+	return info;
+}
+
+
+void ReaderV345::Parser::ReadHeader()
+{
+	m_header = m_c.byteSizeString(g_versionSize);
+	m_version = ParseVersion(m_header);
+	if(m_version == 0)
+		throw std::runtime_error("GuitarPro: unsupported version \"" + std::string(m_header) + "\"");
+
+	ReadInfo();
+	if(m_version < 500)
+		m_c.skip(1); // Triplet feel
+	if(m_version >= 400)
+		ReadLyrics();
+	if(m_version >= 510)
+		m_c.skip(19); // Master volume, effect and equalizer
+	if(m_version >= 500)
+	{
+		ReadPageSetup();
+		m_c.intByteSizeString(); // Tempo name
+	}
+	m_tempo = m_c.read<std::int32_t>();
+	if(m_version >= 510)
+		m_c.skip(1); // Hide tempo
+	m_c.skip(m_version >= 400 ? 5 : 4); // Key, octave
+	m_c.skip(64 * 12);					// MIDI channels
+	if(m_version >= 500)
+		m_c.skip(19 * 2 + 4); // Coda and segno bars, master reverb
+
+	const int nrMeasures = m_c.count(1);
+	const int nrTracks = m_c.count(1);
+	ReadMeasureHeaders(nrMeasures);
+	ReadTracks(nrTracks);
+}
+
+
+void ReaderV345::Parser::ReadInfo()
+{
+	m_title = m_c.intByteSizeString();
+	m_c.intByteSizeString(); // Subtitle
+	m_artist = m_c.intByteSizeString();
+	// Album, words, (music,) copyright, tab, instructions
+	for(int i = 0, n = m_version >= 500 ? 6 : 5; i < n; i++)
+		m_c.intByteSizeString();
+	for(int i = 0, n = m_c.count(5); i < n; i++)
+		m_c.intByteSizeString(); // Notice
+}
+
+
+void ReaderV345::Parser::ReadLyrics()
+{
+	m_c.skip(4); // Track
+	for(int i = 0; i < 5; i++)
+	{
+		m_c.skip(4); // Start bar
+		m_c.intSizeString();
+	}
+}
+
+
+void ReaderV345::Parser::ReadPageSetup()
+{
+	m_c.skip(7 * 4 + 2); // Size, margins, proportion, header and footer flags
+	for(int i = 0; i < 10; i++)
+		m_c.intByteSizeString(); // Title .. page number formats
+}
+
+
+void ReaderV345::Parser::ReadMeasureHeaders(int nrMeasures)
+{
+	GPIF::Time time{4, 4};
+	for(int m = 0; m < nrMeasures; m++)
+	{
+		if(m_version >= 500 && m > 0)
+			m_c.skip(1);
+		const auto flags = m_c.read<std::uint8_t>();
+		if(flags & 0x01)
+			time.num = m_c.read<std::int8_t>();
+		if(flags & 0x02)
+			time.den = m_c.read<std::int8_t>();
+		if(flags & 0x08)
+			m_c.skip(1); // Repeat close
+		if(m_version < 500 && (flags & 0x10))
+			m_c.skip(1); // Alternate ending
+		if(flags & 0x20)
+		{
+			m_c.intByteSizeString(); // Marker
+			m_c.skip(4);			 // Color
+		}
+		if(flags & 0x40)
+			m_c.skip(2); // Key signature
+		if(m_version >= 500)
+		{
+			if(flags & 0x10)
+				m_c.skip(1); // Alternate ending
+			if(flags & 0x03)
+				m_c.skip(4); // Beams
+			if(!(flags & 0x10))
+				m_c.skip(1);
+			m_c.skip(1); // Triplet feel
+		}
+		m_tables.masterBars.push_back(GPIF::MasterBar{time});
+	}
+}
+
+
+void ReaderV345::Parser::ReadTracks(int nrTracks)
+{
+	for(int t = 0; t < nrTracks; t++)
+	{
+		if(m_version >= 500 && (t == 0 || m_version == 500))
+			m_c.skip(1);
+		m_c.skip(1); // Flags
+		const auto name = m_c.byteSizeString(40);
+		const auto nrStrings = m_c.read<std::int32_t>();
+		if(nrStrings < 1 || nrStrings > g_maxStrings)
+			throw std::runtime_error("GuitarPro: track \"" + std::string(name) + "\" has " +
+									 std::to_string(nrStrings) + " strings");
+		TrackState state{nrStrings, {}, {}};
+		for(auto& tuning : state.tuning)
+			tuning = m_c.read<std::int32_t>();
+		m_c.skip(5 * 4 + 4);		// Port, channel, effect channel, frets, capo, color
+		if(m_version >= 500)
+			m_c.skip(m_version == 500 ? 44 : 45); // Display flags, RSE instrument
+		if(m_version >= 510)
+		{
+			m_c.skip(4); // Equalizer
+			m_c.intByteSizeString();
+			m_c.intByteSizeString(); // Effect, effect category
+		}
+		m_tables.tracks.push_back(GPIF::Track{name, false});
+		m_trackState.push_back(state);
+	}
+	if(m_version >= 500)
+		m_c.skip(m_version == 500 ? 2 : 1);
+}
+
+
+void ReaderV345::Parser::ReadMeasures()
+{
+	// Measure by measure, a bar for each track, in which version 5 has two voices
+	const int nrTracks = static_cast<int>(m_tables.tracks.size());
+	const int nrVoices = m_version >= 500 ? 2 : 1;
+	for(std::size_t m = 0; m < m_tables.masterBars.size(); m++)
+	{
+		for(int t = 0; t < nrTracks; t++)
+		{
+			m_tables.masterBarBars.values.push_back(static_cast<int>(m_tables.bars.size()));
+			m_tables.bars.push_back(GPIF::Bar{Clef::A});
+			for(int v = 0; v < nrVoices; v++)
+			{
+				m_tables.barVoices.values.push_back(static_cast<int>(m_tables.voiceBeats.size()));
+				ReadVoice(t);
+			}
+			m_tables.barVoices.close();
+			if(m_version >= 500)
+				m_c.skip(1); // Line break
+		}
+		m_tables.masterBarBars.close();
+	}
+}
+
+
+void ReaderV345::Parser::ReadVoice(int track)
+{
+	for(int i = 0, n = m_c.count(3); i < n; i++)
+	{
+		m_tables.voiceBeats.values.push_back(static_cast<int>(m_tables.beats.size()));
+		ReadBeat(track);
+	}
+	m_tables.voiceBeats.close();
+}
+
+
+void ReaderV345::Parser::ReadBeat(int track)
+{
+	const auto flags = m_c.read<std::uint8_t>();
+	if(flags & 0x40)
+		m_c.skip(1); // Empty or rest
+	const int duration = m_c.read<std::int8_t>();
+	if(flags & 0x20)
+		m_c.skip(4); // Tuplet
+	if(flags & 0x02)
+		ReadChord();
+	if(flags & 0x04)
+		m_c.intByteSizeString(); // Text
+	if(flags & 0x08)
+		ReadBeatEffects();
+	if(flags & 0x10)
+		ReadMixTableChange();
+
+	const auto strings = m_c.read<std::uint8_t>();
+	for(int s = 0; s < m_trackState[track].nrStrings; s++)
+	{
+		// Bit 6 is the first, highest, string
+		if(strings & (1 << (6 - s)))
+			ReadNote(track, s);
+	}
+
+	if(m_version >= 500 && (m_c.read<std::int16_t>() & 0x0800))
+		m_c.skip(1); // Secondary beam break
+
+	m_tables.beats.push_back(GPIF::Beat{Clef::A, InternRhythm(duration, flags & 0x01)});
+	m_tables.beatNotes.push_back(static_cast<std::uint32_t>(m_tables.notes.size()));
+}
+
+
+void ReaderV345::Parser::ReadChord()
+{
+	if(m_version >= 500)
+	{
+		m_c.skip(17);
+		m_c.byteSizeString(21);
+		m_c.skip(4 + 4 + 7 * 4 + 1 + 5 + 26); // First fret, frets, barres, omissions, fingering
+	}
+	else if(m_c.read<std::uint8_t>() != 0)
+	{
+		if(m_version >= 400)
+			m_c.skip(16 + 22 + 4 + 4 + 7 * 4 + 1 + 5 + 26);
+		else
+			m_c.skip(25 + 35 + 4 + 6 * 4 + 36);
+	}
+	else
+	{
+		m_c.intByteSizeString(); // Name
+		if(m_c.read<std::int32_t>() != 0)
+			m_c.skip(4 * (m_version >= 406 ? 7 : 6)); // Frets, from the first fret
+	}
+}
+
+
+void ReaderV345::Parser::ReadBeatEffects()
+{
+	const auto flags = m_c.read<std::uint8_t>();
+	const auto flags2 = m_version >= 400 ? m_c.read<std::uint8_t>() : 0;
+	if(flags & 0x20)
+		m_c.skip(m_version >= 400 ? 1 : 5); // Slap, pop, tapping; tremolo bar in version 3
+	if(flags2 & 0x04)
+		ReadBend(); // Tremolo bar
+	if(flags & 0x40)
+		m_c.skip(2); // Stroke
+	if(flags2 & 0x02)
+		m_c.skip(1); // Pick stroke
+}
+
+
+void ReaderV345::Parser::ReadMixTableChange()
+{
+	m_c.skip(1); // Instrument
+	if(m_version >= 500)
+		m_c.skip(16); // RSE instrument
+	std::array<std::int8_t, 6> values; // Volume, balance, chorus, reverb, phaser, tremolo
+	for(auto& v : values)
+		v = m_c.read<std::int8_t>();
+	if(m_version >= 500)
+		m_c.intByteSizeString(); // Tempo name
+	const auto tempo = m_c.read<std::int32_t>();
+
+	// A duration for each value that changes
+	m_c.skip(std::count_if(begin(values), end(values), [](std::int8_t v) { return v >= 0; }));
+	if(tempo >= 0)
+		m_c.skip(m_version >= 510 ? 2 : 1);
+	if(m_version >= 400)
+		m_c.skip(1); // Applies to all tracks
+	if(m_version >= 500)
+		m_c.skip(1); // Wah
+	if(m_version >= 510)
+	{
+		m_c.intByteSizeString();
+		m_c.intByteSizeString(); // Effect, effect category
+	}
+}
+
+
+void ReaderV345::Parser::ReadNote(int track, int string)
+{
+	const auto flags = m_c.read<std::uint8_t>();
+	const auto type = (flags & 0x20) ? m_c.read<std::uint8_t>() : 1;
+	if((flags & 0x01) && m_version < 500)
+		m_c.skip(2); // Duration, tuplet
+	if(flags & 0x10)
+		m_c.skip(1); // Dynamic
+	const int fret = (flags & 0x20) ? m_c.read<std::int8_t>() : 0;
+	if(flags & 0x80)
+		m_c.skip(2); // Fingering
+	if(m_version >= 500)
+	{
+		if(flags & 0x01)
+			m_c.skip(8); // Duration percentage
+		m_c.skip(1);
+	}
+	const bool letRing = (flags & 0x08) && ReadNoteEffects();
+
+	// Tied notes keep the fret of the one they are tied to
+	TrackState& state = m_trackState[track];
+	if(type != 2)
+		state.frets[string] = static_cast<std::uint8_t>(std::clamp(fret, 0, 99));
+
+	GPIF::Note note{};
+	note.fret = state.frets[string];
+	note.string = static_cast<std::uint8_t>(state.nrStrings - 1 - string); // GPIF counts from the lowest string
+	note.letRing = letRing;
+	m_tables.notes.push_back(note);
+}
+
+
+bool ReaderV345::Parser::ReadNoteEffects()
+{
+	const auto flags = m_c.read<std::uint8_t>();
+	const auto flags2 = m_version >= 400 ? m_c.read<std::uint8_t>() : 0;
+	if(flags & 0x01)
+		ReadBend();
+	if(flags & 0x10)
+		m_c.skip(m_version >= 500 ? 5 : 4); // Grace note
+	if(flags2 & 0x04)
+		m_c.skip(1); // Tremolo picking
+	if(flags2 & 0x08)
+		m_c.skip(1); // Slide
+	if(flags2 & 0x10)
+	{
+		const auto harmonic = m_c.read<std::uint8_t>();
+		if(m_version >= 500 && harmonic == 2)
+			m_c.skip(3); // Artificial: note, accidental, octave
+		else if(m_version >= 500 && harmonic == 3)
+			m_c.skip(1); // Tapped: fret
+	}
+	if(flags2 & 0x20)
+		m_c.skip(2); // Trill
+	return flags & 0x08;
+}
+
+
+void ReaderV345::Parser::ReadBend()
+{
+	m_c.skip(5); // Type, value
+	for(int i = 0, n = m_c.count(9); i < n; i++)
+		m_c.skip(9); // Position, value, vibrato
+}
+
+
+int ReaderV345::Parser::InternRhythm(int duration, bool dotted)
+{
+	// The GPIF has no 64th, they are shown as 32nd
+	const GPIF::Rhythm rhythm{
+		static_cast<NoteValue>(std::clamp(duration + 2, 0, static_cast<int>(NoteValue::_32nd))),
+		static_cast<std::uint8_t>(dotted ? 1 : 0)};
+	auto& rhythms = m_tables.rhythms;
+	auto it = std::find_if(begin(rhythms), end(rhythms), [&](const GPIF::Rhythm& r)
+						   { return r.value == rhythm.value && r.augmentation == rhythm.augmentation; });
+	if(it != end(rhythms))
+		return static_cast<int>(it - begin(rhythms));
+	rhythms.push_back(rhythm);
+	return static_cast<int>(rhythms.size() - 1);
+}
+
+
+//-- ReaderV345 --
+
+
+bool ReaderV345::isValid(std::span<const char> data)
+{
+	if(data.size() < 1 + g_versionSize)
+		return false;
+	const std::size_t length = std::min<std::size_t>(static_cast<std::uint8_t>(data[0]), g_versionSize);
+	return ParseVersion(std::string_view(data.data() + 1, length)) != 0;
+}
+
+
+GPIF ReaderV345::Read(std::span<const char> data)
+{
+	auto copy = std::make_shared_for_overwrite<char[]>(data.size());
+	std::copy(begin(data), end(data), copy.get());
+	return Read(std::span<const char>(copy.get(), data.size()), copy);
+}
+
+
+GPIF ReaderV345::Read(std::filesystem::path fn)
+{
+	auto file = std::make_shared<const IO::MappedFile>(fn);
+	return Read(std::span(reinterpret_cast<const char*>(file->data().data()), file->size()), file);
+}
+
+
+ScoreInfo ReaderV345::ReadInfo(std::span<const char> data)
+{
+	Parser parser(data);
+	return parser.ReadScoreInfo();
+}
+
+
+GPIF ReaderV345::Read(std::span<const char> data, std::shared_ptr<const void> storage)
+{
+	Parser parser(data);
+	return parser.Read(std::move(storage));
+}
+
+} // namespace GuitarPro
@@ -0,0 +1,261 @@
+#include <GuitarPro.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#include <MappedFile.h>
+
+
+namespace GuitarPro
+{
+
+namespace
+{
+
+constexpr std::string_view g_compressedHeader = "BCFZ";
+constexpr std::string_view g_fileSystemHeader = "BCFS";
+
+constexpr std::size_t g_sectorSize = 0x1000;
+
+/// Layout of a file entry in the BCFS file system, relative to the start of its sector
+constexpr std::uint32_t g_entryFile = 2;
+constexpr std::size_t g_entryNameOffset = 0x04;
+constexpr std::size_t g_entryNameSize = 127;
+constexpr std::size_t g_entrySizeOffset = 0x8c;
+constexpr std::size_t g_entrySectorsOffset = 0x94; ///< Indices of the data sectors, up to a 0
+
+
+std::uint32_t GetU32(std::span<const char> data, std::size_t offset)
+{
+	std::uint32_t v = 0;
+	for(std::size_t i = 0; i < 4; i++)
+		v |= static_cast<std::uint32_t>(static_cast<std::uint8_t>(data[offset + i])) << (8 * i);
+	return v;
+}
+
+
+bool StartsWith(std::span<const char> data, std::string_view header)
+{
+	return data.size() >= header.size() && std::equal(begin(header), end(header), begin(data));
+}
+
+
+/// Reads bits from the most significant bit of each byte down, 64 at a time
+class BitReader
+{
+public:
+	explicit BitReader(std::span<const char> data)
+		: m_data(data)
+	{
+	}
+
+	/// False if fewer than \p n bits are left
+	bool available(int n)
+	{
+		refill();
+		return m_count >= n;
+	}
+
+	/// \p n (at most 32) bits, the first is the most significant. available() has to be checked first.
+	std::uint32_t read(int n)
+	{
+		if(n == 0)
+			return 0;
+		const auto v = static_cast<std::uint32_t>(m_bits >> (64 - n));
+		m_bits <<= n;
+		m_count -= n;
+		return v;
+	}
+
+	/// \p n bits, the first is the least significant
+	std::uint32_t readReversed(int n)
+	{
+		std::uint32_t v = read(n), r = 0;
+		for(int i = 0; i < n; i++, v >>= 1)
+			r = (r << 1) | (v & 1);
+		return r;
+	}
+
+private:
+	void refill()
+	{
+		while(m_count <= 56 && m_pos < m_data.size())
+		{
+			m_bits |= static_cast<std::uint64_t>(static_cast<std::uint8_t>(m_data[m_pos++])) << (56 - m_count);
+			m_count += 8;
+		}
+	}
+
+	std::span<const char> m_data;
+	std::size_t m_pos = 0;
+	std::uint64_t m_bits = 0; ///< The next bit is the most significant
+	int m_count = 0;		  ///< Number of bits in m_bits
+};
+
+
+/**
+Pass the contents of file \p name in the BCFS block \p fs to \p f, a sector at a time, for as long as it returns true.
+Returns false if there is no such file.
+*/
+template<std::predicate<std::string_view> F>
+bool VisitFile(std::span<const char> fs, std::string_view name, F&& f)
+{
+	// Sector 0 is empty, each file has an entry sector with the indices of its data sectors
+	for(std::size_t entry = g_sectorSize; entry + g_entrySectorsOffset <= fs.size(); entry += g_sectorSize)
+	{
+		if(GetU32(fs, entry) != g_entryFile)
+			continue;
+		const auto nameField = fs.subspan(entry + g_entryNameOffset, g_entryNameSize);
+		const std::string_view entryName(nameField.data(),
+										 std::find(begin(nameField), end(nameField), '\0') - begin(nameField));
+		std::size_t remaining = entryName == name ? GetU32(fs, entry + g_entrySizeOffset) : 0;
+
+		// The list of sectors ends at a 0, or at the end of the entry. The next entry follows the last sector.
+		const std::size_t listEnd = std::min(entry + g_sectorSize, fs.size());
+		std::size_t next = entry;
+		for(std::size_t p = entry + g_entrySectorsOffset; p + 4 <= listEnd; p += 4)
+		{
+			const std::size_t sector = GetU32(fs, p);
+			if(sector == 0)
+				break;
+			if(sector > fs.size() / g_sectorSize)
+				throw std::runtime_error("GuitarPro 6: BCFS block is corrupt");
+			const std::size_t offset = sector * g_sectorSize;
+			next = std::max(next, offset);
+			if(remaining > 0)
+			{
+				const auto n = std::min({g_sectorSize, fs.size() - offset, remaining});
+				remaining -= n;
+				if(!f(std::string_view(fs.data() + offset, n)))
+					return true;
+			}
+		}
+		if(entryName == name)
+			return true;
+		entry = next;
+	}
+	return false;
+}
+
+} // namespace
+
+
+bool ReaderV6::isValid(std::span<const char> data)
+{
+	return StartsWith(data, g_compressedHeader) || StartsWith(data, g_fileSystemHeader);
+}
+
+
+GPIF ReaderV6::Read(std::span<const char> data)
+{
+	std::size_t size = 0;
+	auto xml = ExtractFile(FileSystem(data), m_fnGPIF, size);
+	if(!xml)
+		throw std::runtime_error("GuitarPro 6: file has no score");
+	return ReaderV78::ReadXml(std::move(xml), size);
+}
+
+
+GPIF ReaderV6::Read(std::filesystem::path fn)
+{
+	IO::MappedFile file(fn);
+	return Read(std::span(reinterpret_cast<const char*>(file.data().data()), file.size()));
+}
+
+
+ScoreInfo ReaderV6::ReadInfo(std::span<const char> data)
+{
+	// The sectors of the score go to the parser as they are, it stops after the master bars
+	const auto fs = FileSystem(data);
+	return ReaderV78::ReadInfo([&](const ReaderV78::ChunkSink& sink) { return VisitFile(fs, m_fnGPIF, sink); });
+}
+
+
+std::span<const char> ReaderV6::FileSystem(std::span<const char> data)
+{
+	std::span<const char> fs = data;
+	if(StartsWith(data, g_compressedHeader))
+	{
+		// Only what is read of the score leaves this buffer, which keeps its size for the next file
+		thread_local std::vector<char> decompressed;
+		Decompress(data, decompressed);
+		fs = decompressed;
+	}
+	if(!StartsWith(fs, g_fileSystemHeader))
+		throw std::runtime_error("GuitarPro 6: no BCFS block");
+	return fs.subspan(g_fileSystemHeader.size());
+}
+
+
+void ReaderV6::Decompress(std::span<const char> src, std::vector<char>& dst)
+{
+	const std::size_t headerSize = g_compressedHeader.size() + 4;
+	if(!StartsWith(src, g_compressedHeader) || src.size() < headerSize)
+		throw std::runtime_error("GuitarPro 6: no BCFZ block");
+	const std::size_t expected = GetU32(src, g_compressedHeader.size());
+
+	// Each chunk is either a copy of what was decompressed before, or 0-3 bytes as they are.
+	// It ends at the expected size, or at the end of the data.
+	dst.clear();
+	dst.reserve(std::min(expected, 16 * src.size())); // The size is not trusted before it is reached
+	BitReader bits(src.subspan(headerSize));
+	while(dst.size() < expected && bits.available(1))
+	{
+		if(bits.read(1))
+		{
+			if(!bits.available(4))
+				break;
+			const int wordSize = bits.read(4);
+			if(!bits.available(2 * wordSize))
+				break;
+			const std::size_t offset = bits.readReversed(wordSize);
+			const std::size_t size = std::min<std::size_t>(offset, bits.readReversed(wordSize));
+			if(offset > dst.size())
+				throw std::runtime_error("GuitarPro 6: BCFZ block is corrupt");
+			// The copy ends where it starts, so it does not overlap
+			const std::size_t end = dst.size();
+			dst.resize(end + size);
+			std::memcpy(dst.data() + end, dst.data() + end - offset, size);
+		}
+		else
+		{
+			if(!bits.available(2))
+				break;
+			const int size = bits.readReversed(2);
+			if(!bits.available(8 * size))
+				break;
+			for(int i = 0; i < size; i++)
+				dst.push_back(static_cast<char>(bits.read(8)));
+		}
+	}
+}
+
+
+std::shared_ptr<char[]> ReaderV6::ExtractFile(std::span<const char> fs, std::string_view name, std::size_t& size)
+{
+	// One buffer for the whole file, the last sector can be cut off by the end of the block
+	std::size_t available = 0;
+	auto count = [&](std::string_view part)
+	{
+		available += part.size();
+		return true;
+	};
+	if(!VisitFile(fs, name, count))
+		return nullptr;
+
+	size = available;
+	auto data = std::make_shared_for_overwrite<char[]>(size + 1);
+	std::size_t pos = 0;
+	auto copy = [&](std::string_view part)
+	{
+		std::memcpy(data.get() + pos, part.data(), part.size());
+		pos += part.size();
+		return true;
+	};
+	VisitFile(fs, name, copy);
+	data[size] = '\0';
+	return data;
+}
+
+} // namespace GuitarPro
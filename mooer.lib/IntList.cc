@@ -0,0 +1,172 @@
+#include <IntList.h>
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MOOER_INTS_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define MOOER_INTS_NEON
+#endif
+
+
+namespace Text
+{
+
+namespace
+{
+
+/// Like std::isspace in the "C" locale, which is what the stream skips
+bool isSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+
+#if defined(MOOER_INTS_SSE2) || defined(MOOER_INTS_NEON)
+
+constexpr std::size_t blockSize = 16;
+
+/// Lists shorter than this are not worth the setup of the block scan
+constexpr std::size_t minScanSize = 4 * blockSize;
+
+
+/// Bit i is set if byte i of the block is a digit, or a space, tab or line end
+struct Classes
+{
+	std::uint32_t digits;
+	std::uint32_t spaces;
+};
+
+
+#if defined(MOOER_INTS_SSE2)
+
+Classes Classify(const char* p)
+{
+	const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	// Signed compares: bytes from 0x80 are negative, so never digits
+	const __m128i digits =
+		_mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+	const __m128i spaces =
+		_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+					 _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+	return {static_cast<std::uint32_t>(_mm_movemask_epi8(digits)),
+			static_cast<std::uint32_t>(_mm_movemask_epi8(spaces))};
+}
+
+#else
+
+/// One bit per byte of a comparison result, like _mm_movemask_epi8
+std::uint32_t MoveMask(uint8x16_t m)
+{
+	static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+	const uint8x16_t bits = vandq_u8(m, vld1q_u8(weights));
+	return vaddv_u8(vget_low_u8(bits)) | (static_cast<std::uint32_t>(vaddv_u8(vget_high_u8(bits))) << 8);
+}
+
+
+Classes Classify(const char* p)
+{
+	const uint8x16_t v = vld1q_u8(reinterpret_cast<const uint8_t*>(p));
+	const uint8x16_t digits = vcltq_u8(vsubq_u8(v, vdupq_n_u8('0')), vdupq_n_u8(10));
+	const uint8x16_t spaces = vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8(' ')), vceqq_u8(v, vdupq_n_u8('\n'))),
+									   vorrq_u8(vceqq_u8(v, vdupq_n_u8('\t')), vceqq_u8(v, vdupq_n_u8('\r'))));
+	return {MoveMask(digits), MoveMask(spaces)};
+}
+
+#endif
+
+
+/**
+Append the integers of [first, last) to \p dst for as long as the blocks hold only digits and whitespace.
+Returns where the scalar parse continues: the start of the number that was being read, or of the first block that
+has anything else in it, a sign for example.
+*/
+const char* ScanInts(const char* first, const char* last, std::vector<int>& dst)
+{
+	const char* token = nullptr; // Start of the number that is being read
+	std::uint32_t value = 0;	 // Its digits so far, only used when there are at most 9 of them
+
+	const char* p = first;
+	for(; last - p >= static_cast<std::ptrdiff_t>(blockSize); p += blockSize)
+	{
+		const auto [digits, spaces] = Classify(p);
+		if((digits | spaces) != 0xFFFF)
+			break;
+
+		for(unsigned i = 0; i < blockSize;)
+		{
+			if(token == nullptr)
+			{
+				i += std::min<unsigned>(std::countr_zero(digits >> i), blockSize - i);
+				if(i < blockSize)
+				{
+					token = p + i;
+					value = 0;
+				}
+				continue;
+			}
+
+			const unsigned n = std::countr_one(digits >> i);
+			for(unsigned k = i; k < i + n; k++)
+				value = 10 * value + static_cast<std::uint32_t>(p[k] - '0');
+			i += n;
+			if(i == blockSize)
+				continue;
+
+			// The number ends at a space, long ones are converted again with overflow checks
+			const char* end = p + i;
+			int v = static_cast<int>(value);
+			if(end - token > 9 && std::from_chars(token, end, v).ec != std::errc())
+				return token;
+			dst.push_back(v);
+			token = nullptr;
+		}
+	}
+	return token != nullptr ? token : p;
+}
+
+#endif
+
+} // namespace
+
+
+bool ParseInt(std::string_view& s, int& value)
+{
+	const char* first = std::find_if_not(s.data(), s.data() + s.size(), isSpace);
+	const char* last = s.data() + s.size();
+	// from_chars takes a minus but no plus, the stream takes both
+	if(first != last && *first == '+')
+	{
+		first++;
+		if(first == last || *first < '0' || *first > '9')
+			return false;
+	}
+
+	int v = 0;
+	auto [ptr, ec] = std::from_chars(first, last, v);
+	if(ec != std::errc())
+		return false;
+	value = v;
+	s.remove_prefix(ptr - s.data());
+	return true;
+}
+
+
+std::size_t AppendInts(std::string_view s, std::vector<int>& dst)
+{
+	const auto size = dst.size();
+#if defined(MOOER_INTS_SSE2) || defined(MOOER_INTS_NEON)
+	if(s.size() >= minScanSize)
+		s.remove_prefix(ScanInts(s.data(), s.data() + s.size(), dst) - s.data());
+#endif
+	for(int v = 0; ParseInt(s, v);)
+		dst.push_back(v);
+	return dst.size() - size;
+}
+
+} // namespace Text
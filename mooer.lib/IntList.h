@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+
+namespace Text
+{
+
+/**
+Parse the integer at the start of \p s, after whitespace and an optional sign, and remove it from \p s.
+Returns false, and leaves \p s as it is, if there is no integer or it does not fit.
+*/
+bool ParseInt(std::string_view& s, int& value);
+
+/**
+Append the whitespace separated integers of \p s to \p dst, up to the first one that is not, and return how many.
+This gives the same as copying a std::istream_iterator<int> over \p s, without the stream.
+
+Long lists are scanned 16 bytes at a time where SSE2 or NEON is available.
+*/
+std::size_t AppendInts(std::string_view s, std::vector<int>& dst);
+
+} // namespace Text
@@ -0,0 +1,304 @@
+#include <Journal.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <MappedFile.h>
+
+
+namespace Mooer
+{
+
+namespace
+{
+
+struct FileHeader
+{
+	std::array<char, 8> magic;
+	std::uint32_t version;
+	std::uint32_t stateSize; ///< sizeof(DeviceFormat::State), checkpoints depend on it
+};
+
+struct RecordHeader
+{
+	std::uint32_t size; ///< Of the data following the header
+	Journal::Kind kind;
+	std::uint8_t group;
+	std::uint16_t checksum; ///< Of the header (with checksum 0) and the data
+	std::int64_t time;		///< Microseconds since the epoch
+};
+static_assert(sizeof(RecordHeader) == 16);
+
+static_assert(std::is_trivially_copyable_v<DeviceFormat::State>);
+
+/// State is trivially copyable, but not standard layout, so as_const_span() doesn't apply
+std::span<const std::uint8_t> StateBytes(const DeviceFormat::State& state)
+{
+	return {reinterpret_cast<const std::uint8_t*>(&state), sizeof(state)};
+}
+
+
+constexpr FileHeader g_header = {{'M', 'O', 'O', 'E', 'R', 'J', 'N', 'L'}, 1, sizeof(DeviceFormat::State)};
+
+
+std::uint16_t RecordChecksum(RecordHeader h, std::span<const std::uint8_t> data)
+{
+	h.checksum = 0;
+	return calculateChecksum(as_const_span(&h)) ^ calculateChecksum(data);
+}
+
+
+/**
+Call \p cb for all valid records starting at \p offset.
+Returns the offset after the last valid record.
+*/
+template<typename Callback>
+std::uint64_t ForEachRecord(std::span<const std::uint8_t> file, std::uint64_t offset, Callback&& cb)
+{
+	while(offset + sizeof(RecordHeader) <= file.size())
+	{
+		RecordHeader h;
+		std::memcpy(&h, file.data() + offset, sizeof(h));
+		if(h.size > file.size() - offset - sizeof(h))
+			break; // Cut short
+		auto data = file.subspan(offset + sizeof(h), h.size);
+		if(h.checksum != RecordChecksum(h, data) || h.kind > Journal::Checkpoint)
+			break;
+		if(h.kind == Journal::Checkpoint && h.size != sizeof(DeviceFormat::State))
+			break;
+
+		auto time = std::chrono::duration_cast<Journal::clock::duration>(std::chrono::microseconds(h.time));
+		cb(Journal::Record{h.kind, static_cast<RxFrame::Group>(h.group), Journal::clock::time_point(time), data}, offset);
+		offset += sizeof(h) + h.size;
+	}
+	return offset;
+}
+
+
+/// Check the file header, returns false if the file is empty
+bool ValidateHeader(std::span<const std::uint8_t> file)
+{
+	if(file.empty())
+		return false;
+	FileHeader h;
+	if(file.size() < sizeof(h))
+		throw std::runtime_error("Journal: file header is truncated");
+	std::memcpy(&h, file.data(), sizeof(h));
+	if(h.magic != g_header.magic)
+		throw std::runtime_error("Journal: not a journal file");
+	if(h.version != g_header.version || h.stateSize != g_header.stateSize)
+	{
+		std::stringstream ss;
+		ss << "Journal: version " << h.version << " with state size " << h.stateSize << " is not supported";
+		throw std::runtime_error(ss.str());
+	}
+	return true;
+}
+
+
+/// The segments of \p fn as (number, path), by number
+std::vector<std::pair<int, std::filesystem::path>> FindSegments(const std::filesystem::path& fn)
+{
+	const auto prefix = fn.filename().string() + ".";
+	auto dir = fn.parent_path();
+	if(dir.empty())
+		dir = ".";
+
+	std::vector<std::pair<int, std::filesystem::path>> r;
+	std::error_code ec;
+	for(std::filesystem::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec))
+	{
+		const auto name = it->path().filename().string();
+		const auto number = std::string_view(name).substr(std::min(prefix.size(), name.size()));
+		if(!name.starts_with(prefix) || number.empty() || number.size() > 9
+		   || !std::ranges::all_of(number, [](unsigned char c) { return std::isdigit(c); }))
+			continue;
+		r.emplace_back(std::stoi(std::string(number)), it->path());
+	}
+	std::sort(begin(r), end(r));
+	return r;
+}
+
+
+std::optional<DeviceFormat::State> RecoverFile(const std::filesystem::path& fn)
+{
+	if(!std::filesystem::exists(fn))
+		return std::nullopt;
+	IO::MappedFile mf(fn);
+	auto file = mf.data();
+	// A crash while a segment was started can leave a part of the header
+	if(file.size() < sizeof(FileHeader) || !ValidateHeader(file))
+		return std::nullopt;
+
+	// A journal starts with a checkpoint, frames are replayed from the last one
+	std::optional<DeviceFormat::State> state;
+	ForEachRecord(file,
+				  sizeof(FileHeader),
+				  [&state](const Journal::Record& r, std::uint64_t)
+				  {
+					  if(r.kind == Journal::Checkpoint)
+						  std::memcpy(&state.emplace(), r.data.data(), sizeof(DeviceFormat::State));
+					  else if(state.has_value())
+						  Apply(*state, r.group, r.data);
+				  });
+	return state;
+}
+
+
+/// The state of the current file \p fn, or of the last segment if a crash left it without a checkpoint
+std::optional<DeviceFormat::State> RecoverState(const std::filesystem::path& fn)
+{
+	if(auto state = RecoverFile(fn); state.has_value())
+		return state;
+	auto segments = FindSegments(fn);
+	if(segments.empty())
+		return std::nullopt;
+	return RecoverFile(segments.back().second);
+}
+
+} // namespace
+
+
+Journal::Journal(const std::filesystem::path& fn, int checkpointInterval)
+	: m_fn(fn), m_nextSegment(1), m_checkpointInterval(checkpointInterval), m_sinceCheckpoint(0), m_state{}
+{
+	if(auto segments = FindSegments(fn); !segments.empty())
+		m_nextSegment = segments.back().first + 1;
+	if(auto recovered = RecoverState(fn); recovered.has_value())
+		m_state = *recovered;
+
+	std::lock_guard lock{m_mutex};
+	Rotate();
+	if(!m_error.empty())
+		throw std::runtime_error(m_error);
+}
+
+
+Journal::~Journal() = default;
+
+
+void Journal::Append(Kind kind, RxFrame::Group group, std::span<const std::uint8_t> data)
+{
+	std::lock_guard lock{m_mutex};
+	if(!Apply(m_state, group, data) || !m_error.empty())
+		return;
+	try
+	{
+		Write(kind, group, data);
+	}
+	catch(std::exception& e)
+	{
+		Fail(e);
+		return;
+	}
+	if(++m_sinceCheckpoint >= m_checkpointInterval)
+		Rotate();
+}
+
+
+void Journal::WriteCheckpoint()
+{
+	std::lock_guard lock{m_mutex};
+	if(m_error.empty())
+		Rotate();
+}
+
+
+DeviceFormat::State Journal::state() const
+{
+	std::lock_guard lock{m_mutex};
+	return m_state;
+}
+
+
+std::string Journal::error() const
+{
+	std::lock_guard lock{m_mutex};
+	return m_error;
+}
+
+
+std::vector<std::filesystem::path> Journal::Segments(const std::filesystem::path& fn)
+{
+	std::vector<std::filesystem::path> r;
+	for(auto& [number, path] : FindSegments(fn))
+		r.push_back(std::move(path));
+	return r;
+}
+
+
+void Journal::Write(Kind kind, RxFrame::Group group, std::span<const std::uint8_t> data)
+{
+	auto now = std::chrono::duration_cast<std::chrono::microseconds>(clock::now().time_since_epoch());
+	RecordHeader h{static_cast<std::uint32_t>(data.size()), kind, static_cast<std::uint8_t>(group), 0, now.count()};
+	h.checksum = RecordChecksum(h, data);
+
+	// A single write per record, so a crash leaves at most one partial record
+	std::vector<char> record(sizeof(h) + data.size());
+	std::memcpy(record.data(), &h, sizeof(h));
+	std::copy(begin(data), end(data), begin(record) + sizeof(h));
+	m_file.write(record.data(), record.size());
+	m_file.flush();
+	if(!m_file)
+		throw std::runtime_error("Journal: could not write " + m_fn.string());
+}
+
+
+void Journal::Rotate()
+{
+	try
+	{
+		if(m_file.is_open())
+		{
+			// A segment ends with the state it leads to
+			Write(Checkpoint, {}, StateBytes(m_state));
+			m_file.close();
+		}
+		// A crash before the new file has its checkpoint recovers from this segment
+		if(std::filesystem::exists(m_fn))
+		{
+			auto segment = m_fn;
+			segment += "." + std::to_string(m_nextSegment);
+			std::filesystem::rename(m_fn, segment);
+			m_nextSegment++;
+		}
+
+		m_file.open(m_fn, std::ios::binary | std::ios::trunc);
+		m_file.write(reinterpret_cast<const char*>(&g_header), sizeof(g_header));
+		Write(Checkpoint, {}, StateBytes(m_state));
+		m_sinceCheckpoint = 0;
+	}
+	catch(std::exception& e)
+	{
+		Fail(e);
+	}
+}
+
+
+void Journal::Fail(const std::exception& e)
+{
+	m_file.close();
+	m_error = e.what();
+	std::cerr << "Journal stopped writing: " << m_error << std::endl;
+}
+
+
+std::uint64_t Journal::Read(const std::filesystem::path& fn, const std::function<void(const Record&)>& cb)
+{
+	IO::MappedFile mf(fn);
+	if(!ValidateHeader(mf.data()))
+		return 0;
+	return ForEachRecord(mf.data(), sizeof(FileHeader), [&cb](const Record& r, std::uint64_t) { cb(r); });
+}
+
+
+std::optional<DeviceFormat::State> Journal::Recover(const std::filesystem::path& fn)
+{
+	return RecoverState(fn);
+}
+
+
+} // namespace Mooer
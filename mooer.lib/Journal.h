@@ -0,0 +1,99 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <MooerParser.h>
+
+
+namespace Mooer
+{
+
+/**
+Append-only log of all state-changing frames, sent to and received from the pedal.
+
+The journal is a series of segments, each starts with a full DeviceFormat::State. Every \p checkpointInterval
+frames, and when it is opened, the current file ends with a checkpoint and is kept as the next numbered segment
+"<fn>.<n>". So recovery replays at most that many frames, and the segments hold the whole history.
+Records are checksummed, a record that was cut short by a crash is dropped.
+
+Append() runs on the USB event thread, so it does not throw: after an I/O error the state is still tracked,
+but nothing is written anymore, and error() tells why.
+*/
+class Journal
+{
+public:
+	enum Kind : std::uint8_t
+	{
+		Received,
+		Sent,
+		Checkpoint, ///< data is a DeviceFormat::State
+	};
+
+	using clock = std::chrono::system_clock;
+
+	struct Record
+	{
+		Kind kind;
+		RxFrame::Group group;
+		clock::time_point time;
+		std::span<const std::uint8_t> data;
+	};
+
+	/// Recover the state from \p fn if it exists, keep it as a segment, and start a new journal there
+	Journal(const std::filesystem::path& fn, int checkpointInterval = 256);
+
+	~Journal();
+
+	/// Apply a frame to the state, and record it if it carries state
+	void Append(Kind kind, RxFrame::Group group, std::span<const std::uint8_t> data);
+
+	/// Start a new segment with the current state
+	void WriteCheckpoint();
+
+	/// The state after all recorded frames
+	DeviceFormat::State state() const;
+
+	/// Why the journal stopped writing, empty while it works
+	std::string error() const;
+
+	/// The kept segments of the journal \p fn, oldest first. The current file \p fn is not included.
+	static std::vector<std::filesystem::path> Segments(const std::filesystem::path& fn);
+
+	/**
+	Call \p cb for every valid record in the journal \p fn, in order.
+	Returns the file offset after the last valid record.
+	*/
+	static std::uint64_t Read(const std::filesystem::path& fn, const std::function<void(const Record&)>& cb);
+
+	/// Reconstruct the last state from the journal \p fn, or its last segment, std::nullopt without a checkpoint
+	static std::optional<DeviceFormat::State> Recover(const std::filesystem::path& fn);
+
+private:
+	void Write(Kind kind, RxFrame::Group group, std::span<const std::uint8_t> data);
+
+	/// Close the current file as segment m_nextSegment, and start a new one with a checkpoint of m_state
+	void Rotate();
+
+	/// Stop writing after the I/O error \p e
+	void Fail(const std::exception& e);
+
+	mutable std::mutex m_mutex;
+	std::filesystem::path m_fn;
+	std::ofstream m_file;
+	int m_nextSegment;
+	std::string m_error;
+	int m_checkpointInterval;
+	int m_sinceCheckpoint;
+	DeviceFormat::State m_state;
+};
+
+} // namespace Mooer
@@ -0,0 +1,161 @@
+#include <MappedFile.h>
+
+#include <bit>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace IO
+{
+
+
+MappedFile::MappedFile(const std::filesystem::path& fn)
+{
+	auto fail = [&fn](std::string_view what)
+	{
+		std::stringstream ss;
+		ss << "MappedFile: could not " << what << " '" << fn.string() << "'";
+		throw std::runtime_error(ss.str());
+	};
+
+#ifdef _WIN32
+	m_file = CreateFileW(fn.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(m_file == INVALID_HANDLE_VALUE)
+	{
+		m_file = nullptr;
+		fail("open");
+	}
+	LARGE_INTEGER size;
+	GetFileSizeEx(m_file, &size);
+	m_size = size.QuadPart;
+	if(m_size == 0)
+		return;
+	m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if(m_mapping == nullptr)
+	{
+		Close();
+		fail("map");
+	}
+	m_data = static_cast<const std::uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if(m_data == nullptr)
+	{
+		Close();
+		fail("map");
+	}
+#else
+	int fd = open(fn.c_str(), O_RDONLY);
+	if(fd < 0)
+		fail("open");
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+	{
+		close(fd);
+		fail("stat");
+	}
+	m_size = st.st_size;
+	if(m_size > 0)
+	{
+		void* p = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(p == MAP_FAILED)
+		{
+			m_size = 0;
+			fail("map");
+		}
+		m_data = static_cast<const std::uint8_t*>(p);
+	}
+	else
+		close(fd);
+#endif
+}
+
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+
+MappedFile::MappedFile(MappedFile&& o) noexcept
+{
+	*this = std::move(o);
+}
+
+
+MappedFile& MappedFile::operator=(MappedFile&& o) noexcept
+{
+	if(this == &o)
+		return *this;
+	Close();
+	std::swap(m_data, o.m_data);
+	std::swap(m_size, o.m_size);
+#ifdef _WIN32
+	std::swap(m_file, o.m_file);
+	std::swap(m_mapping, o.m_mapping);
+#endif
+	return *this;
+}
+
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+	if(m_data != nullptr)
+		UnmapViewOfFile(m_data);
+	if(m_mapping != nullptr)
+		CloseHandle(m_mapping);
+	if(m_file != nullptr)
+		CloseHandle(m_file);
+	m_mapping = nullptr;
+	m_file = nullptr;
+#else
+	if(m_data != nullptr)
+		munmap(const_cast<std::uint8_t*>(m_data), m_size);
+#endif
+	m_data = nullptr;
+	m_size = 0;
+}
+
+
+std::uint64_t Hash64(std::span<const std::uint8_t> data)
+{
+	constexpr std::uint64_t prime = 0x9E3779B97F4A7C15ull;
+	std::uint64_t h = 0xCBF29CE484222325ull ^ (data.size() * prime);
+
+	auto mix = [&h](std::uint64_t w)
+	{
+		h ^= w * prime;
+		h = std::rotl(h, 31) * 0xBF58476D1CE4E5B9ull;
+	};
+
+	std::size_t n = 0;
+	for(; n + 8 <= data.size(); n += 8)
+	{
+		std::uint64_t w;
+		std::memcpy(&w, data.data() + n, sizeof(w));
+		mix(w);
+	}
+	std::uint64_t tail = 0;
+	if(n < data.size())
+		std::memcpy(&tail, data.data() + n, data.size() - n);
+	mix(tail);
+
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	return h;
+}
+
+
+} // namespace IO
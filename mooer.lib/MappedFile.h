@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+
+
+namespace IO
+{
+
+/**
+Read-only memory mapping of a file.
+The contents stay valid for the lifetime of the object.
+*/
+class MappedFile
+{
+public:
+	MappedFile() = default;
+
+	explicit MappedFile(const std::filesystem::path& fn);
+
+	~MappedFile();
+
+	MappedFile(MappedFile&& o) noexcept;
+	MappedFile& operator=(MappedFile&& o) noexcept;
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	std::span<const std::uint8_t> data() const
+	{
+		return {m_data, m_size};
+	}
+
+	std::size_t size() const
+	{
+		return m_size;
+	}
+
+	bool empty() const
+	{
+		return m_size == 0;
+	}
+
+private:
+	void Close();
+
+	const std::uint8_t* m_data = nullptr;
+	std::size_t m_size = 0;
+#ifdef _WIN32
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#endif
+};
+
+/// Non-cryptographic 64-bit hash, used to detect changed file contents
+std::uint64_t Hash64(std::span<const std::uint8_t> data);
+
+} // namespace IO
@@ -1,13 +1,17 @@
 #include <cstdint>
 
 #include <bit>
+#include <charconv>
+#include <fstream>
 #include <ranges>
 #include <span>
 #include <utility>
 #include <vector>
 
+#include <FileView.h>
+#include <Journal.h>
 #include <MooerParser.h>
-#include <WaveFile.h>
+#include <Upload.h>
 
 
 // #define PARSER_DEBUG_LVL 3
@@ -42,7 +46,7 @@ const std::uint16_t g_hash_lut[256] = {
 	0x2e93, 0x3eb2, 0x0ed1, 0x1ef0};
 
 
-std::uint16_t calculateChecksum(std::span<std::uint8_t> m)
+std::uint16_t calculateChecksum(std::span<const std::uint8_t> m)
 {
 	std::uint16_t chk = 0;
 	for(std::uint8_t v : m)
@@ -51,83 +55,307 @@ std::uint16_t calculateChecksum(std::span<std::uint8_t> m)
 }
 
 
-File::Mbf LoadBackup(std::span<const std::uint8_t> mbfData)
+File::Mbf File::LoadBackup(std::span<const std::uint8_t> mbfData)
 {
-	using namespace std::literals;
-	if(mbfData.size() <= sizeof(File::Mbf))
+	return MbfView(mbfData).mbf();
+}
+
+
+File::Mbf File::NewBackup(std::string_view model)
+{
+	auto put = [](std::span<char> dst, std::string_view src)
+	{
+		std::copy_n(begin(src), std::min(src.size(), dst.size()), begin(dst));
+	};
+
+	Mbf mbf{};
+	put(mbf.manufacturer, "MOOER");
+	put(mbf.model, model);
+	put(mbf.version, "V1.0.0");
+	put(mbf.version2, "V1.1.0");
+	put(mbf.version3, "V1.0.0");
+	put(mbf.buff, "BUFF");
+
+	// Little-endian file offsets of the system settings and the presets
+	for(int n = 0; n < 4; n++)
+	{
+		mbf.unknown[n] = (offsetof(Mbf, system) >> (8 * n)) & 0xFF;
+		mbf.unknown[4 + n] = (offsetof(Mbf, presetHeader) >> (8 * n)) & 0xFF;
+	}
+
+	for(int n = 0; n < mbf.presets.size(); n++)
+		mbf.presets[n].index = n;
+	return mbf;
+}
+
+
+void File::SaveBackup(const std::filesystem::path& fn, const Mbf& mbf)
+{
+	std::ofstream f(fn, std::ios::binary);
+	f.write(reinterpret_cast<const char*>(&mbf), sizeof(mbf));
+	if(!f)
 	{
 		std::stringstream ss;
-		ss << "MBF must be at least " << sizeof(File::Mbf) << " bytes\n";
+		ss << "Could not write backup " << fn;
 		throw std::runtime_error(ss.str());
 	}
+}
+
 
-	auto mbf = reinterpret_cast<const File::Mbf*>(mbfData.data());
-	if(std::string_view(mbf->manufacturer) != "MOOER"sv)
-		throw std::runtime_error("MBF has an invalid heade");
+//-- Capabilities --
+
+namespace
+{
 
-	return *mbf;
+std::bitset<256> groupSet(std::initializer_list<RxFrame::Group> groups)
+{
+	std::bitset<256> r;
+	for(auto g : groups)
+		r.set(static_cast<std::uint8_t>(g));
+	return r;
 }
 
+// clang-format off
+const Capabilities g_ge200 = {
+	.model = "MOOER_GE200",
+	.minVersion = "",
+	.known = true,
+	.ampModels = amp_model_names,
+	.cabModels = cab_model_names,
+	.firstUserAmp = 55,
+	.firstUserCab = 26,
+	//          FX DS  AMP CAB NS EQ MOD DELAY REVERB
+	.maxType = {8, 20, 65, 36, 3, 4, 21, 11,   7},
+	.groups = groupSet({
+		RxFrame::Identify, RxFrame::System, RxFrame::Volume, RxFrame::PedalAssignment,
+		RxFrame::PatchAlternate, RxFrame::PatchSetting, RxFrame::ActivePatch, RxFrame::StorePatch,
+		RxFrame::ActivePatchSetting, RxFrame::CabinetUpload, RxFrame::AmpUpload, RxFrame::AmpModels,
+		RxFrame::CabModels, RxFrame::Menu, RxFrame::Preset, RxFrame::PedalAssignment_Maybe,
+		RxFrame::FootSwitch, RxFrame::FX, RxFrame::DS_OD, RxFrame::AMP, RxFrame::CAB, RxFrame::NS_GATE,
+		RxFrame::EQ, RxFrame::MOD, RxFrame::DELAY, RxFrame::REVERB, RxFrame::RHYTHM}),
+	.maxFrameSize = 56,
+	.nrPresets = 200,
+	.quirks = Capabilities::CrashesOnInvalidType | Capabilities::NeedsFlushAfterIdentify,
+};
+// clang-format on
 
-//-- Parser --
+/// Unknown pedals get the GE-200 limits, but no uploads
+const Capabilities g_unknown = []()
+{
+	Capabilities c = g_ge200;
+	c.model = "";
+	c.known = false;
+	c.groups.reset(RxFrame::CabinetUpload);
+	c.groups.reset(RxFrame::AmpUpload);
+	return c;
+}();
 
-enum class AmpKind : std::uint8_t
+const std::array<const Capabilities*, 1> g_capabilities = {&g_ge200};
+
+
+std::string_view trim(std::string_view s)
 {
-	amp = 0x05,
-	gnr = 0x15
-};
+	auto last = s.find_last_not_of(std::string_view(" \0", 2));
+	return last == std::string_view::npos ? std::string_view() : s.substr(0, last + 1);
+}
 
-void Parser::LoadAmplifier(std::span<std::uint8_t> amp, std::string_view name, int slot)
+
+/// Compare dotted version numbers, "2.0.4" < "2.0.10"
+int compareVersion(std::string_view a, std::string_view b)
 {
-	const int szData = 0x204;
-	std::vector<std::uint8_t> packetData(szData + 6);
+	while(!a.empty() || !b.empty())
+	{
+		int va = 0, vb = 0;
+		auto ra = std::from_chars(a.data(), a.data() + a.size(), va);
+		auto rb = std::from_chars(b.data(), b.data() + b.size(), vb);
+		if(va != vb)
+			return va < vb ? -1 : 1;
+		a = a.substr(std::min<std::size_t>(a.size(), ra.ptr - a.data() + 1));
+		b = b.substr(std::min<std::size_t>(b.size(), rb.ptr - b.data() + 1));
+	}
+	return 0;
+}
 
-	packetData[0] = 0xAA;
-	packetData[1] = 0x55;
-	packetData[2] = szData & 0xFF;
-	packetData[3] = szData >> 8;
-
-	packetData[4] = RxFrame::Group::AmpUpload; // 0xE2;
-	packetData[5] = slot;
-	// packetData[6] = index;
-	packetData[7] = std::bit_cast<std::uint8_t>(AmpKind::amp);
-
-	const int iData = 8;
-	const int iChecksum = iData + 512;
-	constexpr int nBytesPerWord = 4;
-	for(int i = 0; i < nBytesPerWord; i++)
+} // namespace
+
+
+const Capabilities& FindCapabilities(std::string_view model, std::string_view version)
+{
+	model = trim(model);
+	version = trim(version);
+	const Capabilities* r = &g_unknown;
+	for(const Capabilities* c : g_capabilities)
 	{
-		packetData[6] = i + 1;
-		for(int n = 0; n < 512; n++)
-			packetData.at(iData + n) = amp[nBytesPerWord * n + (nBytesPerWord - 1 - i)];
-		int cc = calculateChecksum(std::span(packetData).subspan(2, iChecksum - 2));
-#if PARSER_DEBUG_LVL > 2
-		std::cout << std::format("LoadAmplifier: checksum 0x{:04x}\n", cc);
-#endif
-		packetData[iChecksum + 0] = cc >> 8;
-		packetData[iChecksum + 1] = cc & 0xFF;
-		SendSplitPacket(packetData);
+		if(c->model != model || compareVersion(version, c->minVersion) < 0)
+			continue;
+		// Prefer the most recent matching firmware entry
+		if(!r->known || compareVersion(r->minVersion, c->minVersion) < 0)
+			r = c;
 	}
+	return *r;
+}
+
+
+//-- State --
+
+namespace
+{
+
+/// Copy the start of \p src into \p dst, false if \p src is too small
+template<StandardLayoutType T>
+bool assign(T& dst, std::span<const std::uint8_t> src)
+{
+	if(src.size() < sizeof(T))
+		return false;
+	copy(dst, src.first(sizeof(T)));
+	return true;
+}
+
+
+/**
+Set a module of the device from its 8 bytes in a File::Preset: type, enabled and the parameters in order.
+The device has 16 bits per value, with enabled before type, and only as many parameters as the module uses.
+*/
+template<StandardLayoutType T>
+void assignModule(T& dst, std::span<const u8, 8> src)
+{
+	std::array<u16be, 8> values;
+	values[0] = src[1];
+	values[1] = src[0];
+	std::copy(begin(src) + 2, end(src), begin(values) + 2);
+	std::memcpy(&dst, values.data(), std::min(sizeof(dst), sizeof(values)));
+}
+
+
+/// The active preset of the device, from a preset in the format of an .mo file
+void assignPreset(DeviceFormat::Preset& dst, const File::Preset& src)
+{
+	using File::Module;
+	dst.fxOrder = src.fxOrder;
+	dst.size = src.size;
+	std::memcpy(dst.name, src.name, sizeof(dst.name));
+	dst.fx = DeviceFormat::FX(src.fx);
+	dst.distortion = DeviceFormat::OD(src.ds);
+	assignModule(dst.amp, src.module(Module::AMP));
+	assignModule(dst.cab, src.module(Module::CAB));
+	assignModule(dst.noiseGate, src.module(Module::NS));
+	assignModule(dst.equalizer, src.module(Module::EQ));
+	assignModule(dst.modulation, src.module(Module::MOD));
+	assignModule(dst.delay, src.module(Module::DELAY));
+	assignModule(dst.reverb, src.module(Module::REVERB));
+}
+
+} // namespace
+
+
+bool Apply(DeviceFormat::State& state, RxFrame::Group group, std::span<const std::uint8_t> data)
+{
+	if(data.empty())
+		return false;
+
+	auto& preset = state.activePreset;
+	switch(group)
+	{
+	case RxFrame::ActivePatch:
+		state.activePresetIndex = data[0];
+		return true;
+	case RxFrame::Menu:
+		state.activeMenu = data[0];
+		return true;
+	case RxFrame::Volume:
+		state.volume = data[0];
+		return true;
+	case RxFrame::FootSwitch:
+		state.footswitchConfirm = data[0];
+		return true;
+	case RxFrame::AmpModels:
+		return assign(state.ampModelNames, data);
+	case RxFrame::CabModels:
+		return assign(state.cabModelNames, data);
+	case RxFrame::PatchSetting:
+		if(data.size() != sizeof(File::PresetPadded) + 1 || data[0] >= state.savedPresets.size())
+			return false;
+		state.savedPresets[data[0]] = data.subspan(1);
+		return true;
+	case RxFrame::Preset:
+		// An .mo file loaded into the active preset
+		if(data.size() != sizeof(File::PresetPadded))
+			return false;
+		assignPreset(preset, File::PresetPadded(data));
+		return true;
+	case RxFrame::ActivePatchSetting:
+		if(data.size() != sizeof(File::PresetPadded) + 1)
+			return false;
+		assignPreset(preset, File::PresetPadded(data.subspan(1)));
+		return true;
+	case RxFrame::PedalAssignment:
+		return assign(state.pedal, data);
+	case RxFrame::System:
+		return assign(state.system, data);
+	case RxFrame::FX:
+		return assign(preset.fx, data);
+	case RxFrame::DS_OD:
+		return assign(preset.distortion, data);
+	case RxFrame::AMP:
+		return assign(preset.amp, data);
+	case RxFrame::CAB:
+		return assign(preset.cab, data);
+	case RxFrame::NS_GATE:
+		return assign(preset.noiseGate, data);
+	case RxFrame::EQ:
+		return assign(preset.equalizer, data);
+	case RxFrame::MOD:
+		return assign(preset.modulation, data);
+	case RxFrame::DELAY:
+		return assign(preset.delay, data);
+	case RxFrame::REVERB:
+		return assign(preset.reverb, data);
+	case RxFrame::RHYTHM:
+		return assign(preset.rhythm, data);
+	default:
+		return false;
+	}
+}
+
+
+//-- Parser --
+
+void Parser::LoadAmplifier(std::span<const std::uint8_t> amp, std::string_view name, int slot)
+{
+	if(!capabilities().supports(RxFrame::AmpUpload))
+		throw std::runtime_error("Amplifier upload is not supported by this pedal");
+	SendUpload(PrepareAmplifier(amp, name, slot));
+}
+
+
+void Parser::LoadGNR(std::span<const std::uint8_t> gnr, std::string_view name, int slot)
+{
+	if(!capabilities().supports(RxFrame::AmpUpload))
+		throw std::runtime_error("Amplifier upload is not supported by this pedal");
+	SendUpload(PrepareGNR(gnr, name, slot));
+}
 
-	packetData[6] = nBytesPerWord + 1;
-	std::fill(begin(packetData) + iData, end(packetData), 0);
-	std::copy(begin(name), begin(name) + std::min<int>(name.size(), 15), begin(packetData) + iData);
-	SendWithHeaderAndChecksum(std::span(packetData).subspan(4, 0x13));
+
+void Parser::LoadWav(std::span<const std::uint8_t> wav, std::string_view name, int slot)
+{
+	if(!capabilities().supports(RxFrame::CabinetUpload))
+		throw std::runtime_error("Cabinet upload is not supported by this pedal");
+	LoadCabinet(ConvertCabinet(wav), name, slot);
 }
 
 
-void Parser::LoadGNR(std::span<std::uint8_t> gnrData, std::string_view name, int slot)
+void Parser::LoadCabinet(const CabinetData& wavData, std::string_view name, int slot)
 {
-	if(gnrData.size() < sizeof(File::GNR))
-		throw std::runtime_error("GNR too small in size");
-	auto gnr = reinterpret_cast<const File::GNR*>(gnrData.data());
+	if(!capabilities().supports(RxFrame::CabinetUpload))
+		throw std::runtime_error("Cabinet upload is not supported by this pedal");
+
+	SendUpload(PrepareCabinet(wavData, name, slot));
+}
 
-	assert(std::string_view(&gnr->manufacturer[0]) == "mooerge");
-	assert(std::string_view(&gnr->infoId[0], 4) == "info");
-	assert(std::string_view(&gnr->dataId[0], 4) == "data");
 
-	auto ampData = gnr->dataSpan();
-	/* LoadAmplifier(), with nBytesPerWord = 20, AmpKind::gnr
+void Parser::StartAudioStream()
+{
+	/* As captured from MooerStudio, before a .gnr upload:
 	ControlOut bmRequestType 0x21, data fragment 00
 	ControlOut bmRequestType 0x21, data fragment 000c
 	ControlOut bmRequestType 0x21, data fragment 000c
@@ -141,6 +369,10 @@ void Parser::LoadGNR(std::span<std::uint8_t> gnrData, std::string_view name, int
 	const std::array<std::uint8_t, 1> m0{0x00};
 	const std::array<std::uint8_t, 2> mc{0x00, 0x0C};
 	const std::array<std::uint8_t, 2> mec{0x00, 0xEC};
+	const std::vector<std::uint8_t> silence(2646, 0);
+
+	std::lock_guard lock{m_tx_mutex};
+	assert(m_connection != nullptr);
 	m_connection->control_transfer(0x21, 1, 1, 2, m0);
 	m_connection->control_transfer(0x21, 1, 0x102, 2, mc);
 	m_connection->control_transfer(0x21, 1, 0x202, 2, mc);
@@ -149,53 +381,10 @@ void Parser::LoadGNR(std::span<std::uint8_t> gnrData, std::string_view name, int
 	m_connection->control_transfer(0x21, 1, 0x102, 5, mec);
 	m_connection->control_transfer(0x21, 1, 0x202, 5, mec);
 
-	m_connection->set_interface(2, 1);
-	std::vector<std::uint8_t> bulk(2646, 0);
-	m_connection->bulk_transfer(m_tx_bulk_endpoint, bulk);
-	m_connection->set_interface(2, 0);
-}
-
-
-void Parser::LoadWav(std::span<std::uint8_t> wav, std::string_view name, int slot)
-{
-	auto optionalWavData = RIFF::FindChunk(wav, RIFF::dataId);
-	if(!optionalWavData.has_value())
-		throw std::runtime_error("Input is not a RIFF wave file");
-	auto wavData = optionalWavData.value();
-	// auto wavData = wav.subspan(0x3E0);
-
-	const int szData = 0x203;
-	std::vector<std::uint8_t> packetData(szData + 6);
-
-	packetData[0] = 0xAA;
-	packetData[1] = 0x55;
-	packetData[2] = szData & 0xFF;
-	packetData[3] = szData >> 8;
-
-	packetData[4] = RxFrame::Group::CabinetUpload; // 0xE1;
-	packetData[5] = slot;
-
-	const int iData = 8;
-	const int iChecksum = iData + 512;
-	constexpr int nBytesPerWord = 3;
-	for(int i = 0; i < nBytesPerWord; i++)
-	{
-		packetData[6] = i + 1;
-		for(int n = 0; n < 512; n++)
-			packetData.at(iData + n) = wavData[nBytesPerWord * n + (nBytesPerWord - 1 - i)];
-		int cc = calculateChecksum(std::span(packetData).subspan(2, iChecksum - 2));
-#if PARSER_DEBUG_LVL > 2
-		std::cout << std::format("LoadWav: checksum 0x{:04x}\n", cc);
-#endif
-		packetData[iChecksum + 0] = cc >> 8;
-		packetData[iChecksum + 1] = cc & 0xFF;
-		SendSplitPacket(packetData);
-	}
-
-	packetData[6] = nBytesPerWord + 1;
-	std::fill(begin(packetData) + iData, end(packetData), 0);
-	std::copy(begin(name), begin(name) + std::min<int>(name.size(), 15), begin(packetData) + iData);
-	SendWithHeaderAndChecksum(std::span(packetData).subspan(4, 0x13));
+	USB::ClaimedInterface audio(*m_connection, m_audio_interface);
+	m_connection->set_interface(m_audio_interface, 1);
+	m_connection->iso_transfer(m_tx_iso_endpoint, silence, m_iso_packet_size);
+	m_connection->set_interface(m_audio_interface, 0);
 }
 
 
@@ -225,11 +414,40 @@ void Parser::LoadMoPreset(const File::MO& mo)
 	packetData[iChecksum + 1] = cc & 0xFF;
 
 	SendSplitPacket(packetData);
+
+	if(Journal* journal = m_journal; journal != nullptr)
+		journal->Append(Journal::Sent, RxFrame::Preset, moData);
+}
+
+
+void Parser::CheckType(File::Module m, std::uint16_t type) const
+{
+	constexpr std::array<std::string_view, static_cast<int>(File::Module::Count)> names = {
+		"FX", "DS/OD", "Amplifier", "Cabinet", "Noise gate", "Equalizer", "Modulator", "Delay", "Reverb"};
+
+	const Capabilities& caps = capabilities();
+	if(caps.isValidType(m, type) || !caps.has(Capabilities::CrashesOnInvalidType))
+		return;
+	std::stringstream ss;
+	ss << names[static_cast<int>(m)] << " type " << type << " must be <= " << int(caps.maxType[static_cast<int>(m)]);
+	throw std::runtime_error(ss.str());
+}
+
+
+void Parser::SelectCapabilities(std::string_view model, std::string_view version)
+{
+	const Capabilities* caps = &FindCapabilities(model, version);
+#if PARSER_DEBUG_LVL > 0
+	if(!caps->known)
+		std::cout << std::format("Parser: unknown pedal '{}' firmware '{}', using defaults\n", model, version);
+#endif
+	m_capabilities = caps;
 }
 
 
 void Parser::SendSplitPacket(std::span<const std::uint8_t> m)
 {
+	std::lock_guard lock{m_tx_mutex};
 	while(m.size() > 0)
 	{
 		m_usb_tx[0] = std::min<int>(m.size(), 63);
@@ -242,10 +460,41 @@ void Parser::SendSplitPacket(std::span<const std::uint8_t> m)
 }
 
 
+void Parser::SendUpload(const UploadFrames& upload)
+{
+	for(int n = 0; n <= upload.nrFrames(); n++)
+		SendUploadFrame(upload, n);
+}
+
+
+void Parser::SendUploadFrame(const UploadFrames& upload, int frame)
+{
+	if(frame == 0 && upload.audioStream)
+		StartAudioStream();
+	if(frame == upload.nrFrames())
+		return SendWithHeaderAndChecksum(upload.name);
+
+	std::lock_guard lock{m_tx_mutex};
+	assert(m_connection != nullptr);
+	for(const auto& report : upload.frame(frame))
+	{
+		std::copy(begin(report), end(report), begin(m_usb_tx));
+		m_connection->interrupt_transfer(m_tx_endpoint, m_usb_tx);
+	}
+}
+
+
 void Parser::SendWithHeaderAndChecksum(std::span<const std::uint8_t> m)
 {
 	const int N = m.size();
-	assert(N < m_usb_tx.size() - 7);
+	if(N > capabilities().maxFrameSize || N > m_usb_tx.size() - 7)
+	{
+		std::stringstream ss;
+		ss << "Message of " << N << " bytes exceeds the maximum of " << capabilities().maxFrameSize;
+		throw std::runtime_error(ss.str());
+	}
+
+	std::unique_lock lock{m_tx_mutex};
 	m_usb_tx[0] = N + 6;
 	m_usb_tx[1] = 0xAA;
 	m_usb_tx[2] = 0x55;
@@ -258,23 +507,39 @@ void Parser::SendWithHeaderAndChecksum(std::span<const std::uint8_t> m)
 
 	assert(m_connection != nullptr);
 	m_connection->interrupt_transfer(m_tx_endpoint, m_usb_tx);
+	lock.unlock();
+
+	if(Journal* journal = m_journal; journal != nullptr && N > 0)
+		journal->Append(Journal::Sent, static_cast<RxFrame::Group>(m[0]), m.subspan(1));
 }
 
 
 bool Parser::OnUsbInterruptData(std::span<std::uint8_t> data)
 {
 	auto frame = m_frame_rx.process(data);
-	if(frame.has_value() && m_listener != nullptr)
+	if(!frame.has_value())
+		return true;
+
+	if(frame->group() == RxFrame::Identify)
 	{
-		m_listener->OnMooerFrame(*frame);
-		if(frame->group() == RxFrame::Identify)
-		{
-			auto version = std::span(data).subspan(7, 5);
-			auto name = std::span(data).subspan(12, 11);
-			Listener::Identity id{as_string(version), as_string(name)};
+		auto version = std::span(data).subspan(7, 5);
+		auto name = std::span(data).subspan(12, 11);
+		Listener::Identity id{as_string(version), as_string(name)};
+		SelectCapabilities(id.name, id.version);
+		if(m_listener != nullptr)
 			m_listener->OnMooerIdentify(id);
-		}
 	}
+	else if(frame->group() == RxFrame::PedalAssignment_Maybe)
+	{
+		if(auto d = frame->nochecksum_data(); d.size() >= 16)
+			SelectCapabilities(as_string(d.subspan(5, 11)), as_string(d.subspan(0, 5)));
+	}
+
+	if(Journal* journal = m_journal; journal != nullptr)
+		journal->Append(Journal::Received, frame->group(), frame->nochecksum_data());
+
+	if(m_listener != nullptr)
+		m_listener->OnMooerFrame(*frame);
 	return true;
 }
 
@@ -2,14 +2,21 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
+#include <bitset>
 #include <cassert>
 #include <cstdint>
 #include <cstring>
+#include <filesystem>
 #include <iostream>
+#include <mutex>
 #include <optional>
 #include <sstream>
+#include <string_view>
 #include <type_traits>
+#include <vector>
 
+#include <CabinetIR.h>
 #include <UsbConnection.h>
 
 
@@ -97,7 +104,7 @@ constexpr std::array<std::string_view, 36> cab_model_names = {
 // clang-format on
 
 /// CRC of the message, excluding the package length and the AA55 pre-amble.
-std::uint16_t calculateChecksum(std::span<std::uint8_t> m);
+std::uint16_t calculateChecksum(std::span<const std::uint8_t> m);
 
 /// Big-endian 16-bit integer
 struct u16be
@@ -165,6 +172,21 @@ struct Cab
 };
 static_assert(sizeof(Cab) == 8);
 
+/// The effect modules of a preset, in the order they are stored in File::Preset
+enum class Module : std::uint8_t
+{
+	FX,
+	DS,
+	AMP,
+	CAB,
+	NS,
+	EQ,
+	MOD,
+	DELAY,
+	REVERB,
+	Count
+};
+
 struct Preset
 {
 	std::string_view getName() const
@@ -172,6 +194,22 @@ struct Preset
 		return {&name[0], strnlen(name, sizeof(name))};
 	}
 
+	/// The 8 settings bytes of module \p m, starting with type and enabled
+	std::span<const u8, 8> module(Module m) const
+	{
+		return std::span<const u8, 8>(reinterpret_cast<const u8*>(&fx) + 8 * static_cast<int>(m), 8);
+	}
+
+	u8 type(Module m) const
+	{
+		return module(m)[0];
+	}
+
+	bool enabled(Module m) const
+	{
+		return module(m)[1] != 0;
+	}
+
 	std::array<u8, 10> fxOrder;
 	u16be size;
 	char name[16];
@@ -222,6 +260,7 @@ struct MO
 static_assert(offsetof(Preset, fx) == 540 - 0x200, "FX offset incorrect");
 static_assert(offsetof(Preset, ds) == 548 - 0x200, "DS offset incorrect");
 static_assert(offsetof(Preset, reverb) == 604 - 0x200, "DS reverb incorrect");
+static_assert(offsetof(Preset, reverb) == offsetof(Preset, fx) + 8 * (int(Module::Count) - 1), "Modules not contiguous");
 static_assert(sizeof(MO) == 0x800);
 
 
@@ -235,6 +274,11 @@ static_assert(sizeof(MbfPreset) == 0x222);
 
 struct Mbf
 {
+	std::string_view getModel() const
+	{
+		return {&model[0], strnlen(model, sizeof(model))};
+	}
+
 	char manufacturer[8]; ///< "MOOER "
 	char model[32];
 	char version[7];  ///< "V1.0.0"
@@ -255,6 +299,12 @@ static_assert(offsetof(Mbf, presets) == 0x650);
 /// Load a backup from an .mbf file
 Mbf LoadBackup(std::span<const std::uint8_t> mbf);
 
+/// A backup with a valid header for \p model, and all presets empty
+Mbf NewBackup(std::string_view model);
+
+/// Write \p mbf to the file \p fn, byte-exact to what LoadBackup() read
+void SaveBackup(const std::filesystem::path& fn, const Mbf& mbf);
+
 /// Header for a .gnr amplifier/cabinet response
 struct GNR
 {
@@ -682,6 +732,59 @@ private:
 	Frame m_frame;
 };
 
+/**
+What a model and firmware version of the pedal supports.
+Selected by Parser when the pedal identifies itself.
+*/
+struct Capabilities
+{
+	enum Quirk : std::uint32_t
+	{
+		CrashesOnInvalidType = 1 << 0,	  ///< Invalid effect types hang the pedal
+		NeedsFlushAfterIdentify = 1 << 1, ///< Send Parser::SendFlush() after the identify reply
+	};
+
+	/// Valid types for module \p m are 0..maxType[m]
+	bool isValidType(File::Module m, int type) const
+	{
+		return type >= 0 && type <= maxType[static_cast<int>(m)];
+	}
+
+	bool supports(RxFrame::Group g) const
+	{
+		return groups.test(static_cast<std::uint8_t>(g));
+	}
+
+	bool has(Quirk q) const
+	{
+		return (quirks & q) != 0;
+	}
+
+	std::string_view model;		 ///< As reported by the pedal, "MOOER_GE200"
+	std::string_view minVersion; ///< Oldest firmware this entry applies to, "" for any
+	bool known;					 ///< false when the pedal was not recognized, and defaults are used
+	std::span<const std::string_view> ampModels, cabModels;
+	int firstUserAmp, firstUserCab; ///< Index of the first uploadable slot in ampModels/cabModels
+	std::array<u8, static_cast<int>(File::Module::Count)> maxType;
+	std::bitset<256> groups; ///< Supported RxFrame::Group's
+	int maxFrameSize;		 ///< Max. size of a message for Parser::SendWithHeaderAndChecksum
+	int nrPresets;
+	std::uint32_t quirks;
+};
+
+/// Capabilities for a model and firmware version, or conservative defaults if unknown
+const Capabilities& FindCapabilities(std::string_view model, std::string_view version);
+
+/**
+Update \p state with a frame that was received from, or sent to the pedal.
+\p data is the payload, excluding the group and checksum.
+Returns false if the frame does not change the state.
+*/
+bool Apply(DeviceFormat::State& state, RxFrame::Group group, std::span<const std::uint8_t> data);
+
+class Journal;
+struct UploadFrames;
+
 class Listener
 {
 public:
@@ -708,7 +811,7 @@ public:
 	Setup the Parser, need to Connect() afterwards.
 	 */
 	Parser(USB::Connection* connection = nullptr, Listener* listener = nullptr)
-		: m_connection(connection), m_listener(listener)
+		: m_connection(connection), m_listener(listener), m_capabilities(&FindCapabilities({}, {}))
 	{
 	}
 
@@ -727,6 +830,19 @@ public:
 	}
 
 	Parser& operator=(Parser&& o) = delete;
+
+	/// Record all state-changing frames to \p journal, nullptr to stop
+	void SetJournal(Journal* journal)
+	{
+		m_journal = journal;
+	}
+
+	/// Capabilities of the connected pedal, defaults until it has identified itself
+	const Capabilities& capabilities() const
+	{
+		return *m_capabilities.load();
+	}
+
 	/// Send an identification request. Should respond with "MOOER_GE200"
 	void SendIdentifyRequest()
 	{
@@ -793,7 +909,7 @@ public:
 	/p name: Name of the amplifier setting
 	/p slot: The slot index into which to load
 	 */
-	void LoadAmplifier(std::span<std::uint8_t> amp, std::string_view name, int slot);
+	void LoadAmplifier(std::span<const std::uint8_t> amp, std::string_view name, int slot);
 
 	/*
 	Load and amplifier/speaker/microphone model in GNR format.
@@ -801,13 +917,25 @@ public:
 
 	/p gnr: The contents of a .gnr file
 	/p name: The name on the display
+
+	The profile is sent in byte planes, like LoadAmplifier(), after streaming to the audio interface.
 	*/
-	void LoadGNR(std::span<std::uint8_t> gnr, std::string_view name, int slot);
+	void LoadGNR(std::span<const std::uint8_t> gnr, std::string_view name, int slot);
 
 	/**
-	Load a .wav file into a Cabinet slot
+	Load a .wav file into a Cabinet slot.
+	Any sample format, rate and number of channels is converted to the format of the pedal.
 	*/
-	void LoadWav(std::span<std::uint8_t> wav, std::string_view name, int slot);
+	void LoadWav(std::span<const std::uint8_t> wav, std::string_view name, int slot);
+
+	/// Load an impulse response, that is already in the format of the pedal, into a Cabinet slot
+	void LoadCabinet(const CabinetData& ir, std::string_view name, int slot);
+
+	/// Send an amplifier or cabinet upload, prepared by PrepareAmplifier() or PrepareCabinet()
+	void SendUpload(const UploadFrames& upload);
+
+	/// Send byte plane \p frame of \p upload, upload.nrFrames() sends the name that completes it
+	void SendUploadFrame(const UploadFrames& upload, int frame);
 
 	/**
 	Load an .mo file into the active preset
@@ -816,6 +944,7 @@ public:
 
 	void SetFX(const DeviceFormat::FX& fx)
 	{
+		CheckType(File::Module::FX, fx.type);
 		std::array<std::uint8_t, 0x0d> msg{RxFrame::Group::FX, 0};
 		copy(std::span(msg).subspan(1), fx);
 		SendWithHeaderAndChecksum(msg);
@@ -823,6 +952,7 @@ public:
 
 	void SetDS(const DeviceFormat::OD& ds)
 	{
+		CheckType(File::Module::DS, ds.type);
 		std::array<std::uint8_t, sizeof(DeviceFormat::OD) + 1> msg{RxFrame::Group::DS_OD, 0};
 		copy(std::span(msg).subspan(1), ds);
 		SendWithHeaderAndChecksum(msg);
@@ -830,6 +960,7 @@ public:
 
 	void SetAmplifier(const DeviceFormat::Amp& s)
 	{
+		CheckType(File::Module::AMP, s.type);
 		std::array<std::uint8_t, sizeof(DeviceFormat::Amp) + 1> msg{RxFrame::Group::AMP, 0};
 		copy(std::span(msg).subspan(1), s);
 		SendWithHeaderAndChecksum(msg);
@@ -837,6 +968,7 @@ public:
 
 	void SetCabinet(const DeviceFormat::Cab& s)
 	{
+		CheckType(File::Module::CAB, s.type);
 		std::array<std::uint8_t, sizeof(DeviceFormat::Cab) + 1> msg{RxFrame::Group::CAB, 0};
 		copy(std::span(msg).subspan(1), s);
 		SendWithHeaderAndChecksum(msg);
@@ -844,6 +976,7 @@ public:
 
 	void SetNoiseGate(const DeviceFormat::NS& s)
 	{
+		CheckType(File::Module::NS, s.type);
 		std::array<std::uint8_t, sizeof(DeviceFormat::NS) + 1> msg{RxFrame::Group::NS_GATE, 0};
 		copy(std::span(msg).subspan(1), s);
 		SendWithHeaderAndChecksum(msg);
@@ -851,6 +984,7 @@ public:
 
 	void SetEQ(const DeviceFormat::Equalizer& s)
 	{
+		CheckType(File::Module::EQ, s.type);
 		std::array<std::uint8_t, sizeof(DeviceFormat::Equalizer) + 1> msg{RxFrame::Group::EQ, 0};
 		copy(std::span(msg).subspan(1), s);
 		SendWithHeaderAndChecksum(msg);
@@ -858,14 +992,8 @@ public:
 
 	void SetModulator(const DeviceFormat::Mod& s)
 	{
+		CheckType(File::Module::MOD, s.type);
 		std::array<std::uint8_t, sizeof(DeviceFormat::Mod) + 1> msg{RxFrame::Group::MOD, 0};
-		std::uint16_t type = s.type;
-		if(type >= 22)
-		{ // The GE-200 crashes if s.type is invalid
-			std::stringstream ss;
-			ss << "Modulator type " << type << " must be < 21";
-			throw std::runtime_error(ss.str());
-		}
 		copy(std::span(msg).subspan(1), s);
 		SendWithHeaderAndChecksum(msg);
 	}
@@ -881,24 +1009,38 @@ public:
 	void SendWithHeaderAndChecksum(std::span<const std::uint8_t> m);
 
 private:
+	/// Throws if \p type is invalid for module \p m, and the pedal would crash on it
+	void CheckType(File::Module m, std::uint16_t type) const;
+
+	/// Select the capabilities, based on the identification of the pedal
+	void SelectCapabilities(std::string_view model, std::string_view version);
+
 	/// Split a packet into max 63-bytes chunks and send it
 	void SendSplitPacket(std::span<const std::uint8_t> m);
 
+	/// Select the streaming setting of the audio interface and stream silence, which precedes a .gnr upload
+	void StartAudioStream();
+
 	bool OnUsbInterruptData(std::span<std::uint8_t> data) override;
 
-	std::string as_string(std::span<std::uint8_t> buf)
+	std::string as_string(std::span<const std::uint8_t> buf)
 	{
 		return {reinterpret_cast<const char*>(buf.data()), buf.size()};
 	}
 
-	constexpr static int m_tx_bulk_endpoint = 0x01;
+	constexpr static int m_audio_interface = 2;
+	constexpr static int m_tx_iso_endpoint = 0x01;
+	constexpr static int m_iso_packet_size = 276; ///< wMaxPacketSize of m_tx_iso_endpoint
 	constexpr static int m_tx_endpoint = 0x02;
 	constexpr static int m_rx_endpoint = 0x81;
 
 	USB::Connection* m_connection;
+	std::mutex m_tx_mutex; ///< Uploads are sent from a background thread
 	std::array<std::uint8_t, 64> m_usb_tx;
 	RxFrame m_frame_rx;
 	Listener* m_listener;
+	std::atomic<const Capabilities*> m_capabilities;
+	std::atomic<Journal*> m_journal = nullptr;
 };
 
 
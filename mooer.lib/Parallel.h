@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+namespace Parallel
+{
+
+/// Number of hardware threads, at least 1
+inline unsigned NrThreads()
+{
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+namespace detail
+{
+inline thread_local bool inFor = false; ///< The thread runs items of a For()
+} // namespace detail
+
+/// True while the calling thread runs an item of For()
+inline bool OnWorker()
+{
+	return detail::inFor;
+}
+
+/**
+Call \p f(i) for all i in [0, n), spread over \p nThreads workers.
+
+Items are handed out in chunks of \p chunk from a shared counter,
+so threads that finish early keep picking up the remaining work.
+The first exception thrown by \p f is rethrown on the calling thread.
+A For() inside \p f runs on the worker itself, the outer loop already keeps all threads busy.
+*/
+template<typename F>
+void For(std::size_t n, F&& f, unsigned nThreads = NrThreads(), std::size_t chunk = 1)
+{
+	chunk = std::max<std::size_t>(chunk, 1);
+	nThreads = std::max(1u, std::min<unsigned>(nThreads, (n + chunk - 1) / chunk));
+	if(nThreads <= 1 || OnWorker())
+	{
+		for(std::size_t i = 0; i < n; i++)
+			f(i);
+		return;
+	}
+
+	std::atomic<std::size_t> next{0};
+	std::exception_ptr error;
+	std::mutex errorMutex;
+
+	auto work = [&]()
+	{
+		const bool nested = std::exchange(detail::inFor, true);
+		try
+		{
+			for(std::size_t b = next.fetch_add(chunk); b < n; b = next.fetch_add(chunk))
+			{
+				for(std::size_t i = b; i < std::min(b + chunk, n); i++)
+					f(i);
+			}
+		}
+		catch(...)
+		{
+			std::lock_guard lock{errorMutex};
+			if(!error)
+				error = std::current_exception();
+			next = n; // Stop handing out work
+		}
+		detail::inFor = nested;
+	};
+
+	{
+		std::vector<std::jthread> workers;
+		for(unsigned t = 1; t < nThreads; t++)
+			workers.emplace_back(work);
+		work();
+	}
+	if(error)
+		std::rethrow_exception(error);
+}
+
+} // namespace Parallel
@@ -0,0 +1,198 @@
+#include <PresetDiff.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MOOER_DIFF_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MOOER_DIFF_NEON
+#endif
+
+
+namespace Mooer
+{
+
+namespace
+{
+
+constexpr int orderOffset = offsetof(File::Preset, fxOrder);
+constexpr int nameOffset = offsetof(File::Preset, name);
+constexpr int moduleOffset = offsetof(File::Preset, fx);
+constexpr int moduleSize = 8;
+constexpr int nrModules = static_cast<int>(File::Module::Count);
+
+
+/// Bit per byte of 16 bytes, set where they differ
+std::uint32_t Compare16(const std::uint8_t* a, const std::uint8_t* b)
+{
+#if defined(MOOER_DIFF_SSE2)
+	__m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a)),
+								_mm_loadu_si128(reinterpret_cast<const __m128i*>(b)));
+	return ~_mm_movemask_epi8(eq) & 0xFFFF;
+#elif defined(MOOER_DIFF_NEON)
+	static const std::uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+	uint8x16_t ne = vmvnq_u8(vceqq_u8(vld1q_u8(a), vld1q_u8(b)));
+	uint8x16_t bits = vandq_u8(ne, vld1q_u8(weights));
+	return vaddv_u8(vget_low_u8(bits)) | (std::uint32_t(vaddv_u8(vget_high_u8(bits))) << 8);
+#else
+	std::uint32_t r = 0;
+	for(int n = 0; n < 16; n++)
+		r |= std::uint32_t(a[n] != b[n]) << n;
+	return r;
+#endif
+}
+
+
+const std::uint8_t* bytes(const File::Preset& p)
+{
+	return reinterpret_cast<const std::uint8_t*>(&p);
+}
+
+
+bool any(const PresetMask& mask, int offset, int size)
+{
+	for(int n = offset; n < offset + size; n++)
+	{
+		if(mask.test(n))
+			return true;
+	}
+	return false;
+}
+
+
+/// Merge the bytes [offset, offset + size) as a whole, returns false on a conflict
+bool MergeRange(File::Preset& merged,
+				const File::Preset& ours,
+				const File::Preset& theirs,
+				const PresetMask& oursChanged,
+				const PresetMask& theirsChanged,
+				int offset,
+				int size,
+				Prefer prefer)
+{
+	if(!any(theirsChanged, offset, size))
+		return true;
+
+	bool conflict =
+		any(oursChanged, offset, size) && std::memcmp(bytes(ours) + offset, bytes(theirs) + offset, size) != 0;
+	if(!conflict || prefer == Prefer::Theirs)
+		std::memcpy(reinterpret_cast<std::uint8_t*>(&merged) + offset, bytes(theirs) + offset, size);
+	return !conflict;
+}
+
+} // namespace
+
+
+PresetMask CompareBytes(const File::Preset& a, const File::Preset& b)
+{
+	constexpr int N = sizeof(File::Preset);
+	static_assert(N <= 128);
+
+	std::array<std::uint64_t, 2> words = {0, 0};
+	int n = 0;
+	for(; n + 16 <= N; n += 16)
+		words[n / 64] |= std::uint64_t(Compare16(bytes(a) + n, bytes(b) + n)) << (n % 64);
+	for(; n < N; n++)
+		words[n / 64] |= std::uint64_t(bytes(a)[n] != bytes(b)[n]) << (n % 64);
+
+	return (PresetMask(words[1]) << 64) | PresetMask(words[0]);
+}
+
+
+PresetDiff Diff(const File::Preset& a, const File::Preset& b, int slot)
+{
+	PresetDiff r{slot, false, false, 0, {}};
+	auto mask = CompareBytes(a, b);
+	if(mask.none())
+		return r;
+
+	r.order = any(mask, orderOffset, sizeof(a.fxOrder));
+	r.name = any(mask, nameOffset, sizeof(a.name));
+	for(int m = 0; m < nrModules; m++)
+	{
+		const int offset = moduleOffset + moduleSize * m;
+		for(int p = 0; p < moduleSize; p++)
+		{
+			if(!mask.test(offset + p))
+				continue;
+			r.modules |= 1 << m;
+			auto parameter = static_cast<std::uint8_t>(p);
+			r.parameters.push_back({static_cast<File::Module>(m), parameter, bytes(a)[offset + p], bytes(b)[offset + p]});
+		}
+	}
+	return r;
+}
+
+
+std::vector<PresetDiff> Diff(const File::Mbf& a, const File::Mbf& b)
+{
+	std::vector<PresetDiff> r;
+	for(int slot = 0; slot < a.presets.size(); slot++)
+	{
+		auto d = Diff(a.presets[slot].preset, b.presets[slot].preset, slot);
+		if(!d.empty())
+			r.push_back(std::move(d));
+	}
+	return r;
+}
+
+
+std::vector<int> UploadSet(const File::Mbf& device, const File::Mbf& target)
+{
+	std::vector<int> r;
+	for(int slot = 0; slot < device.presets.size(); slot++)
+	{
+		if(CompareBytes(device.presets[slot].preset, target.presets[slot].preset).any())
+			r.push_back(slot);
+	}
+	return r;
+}
+
+
+MergeResult Merge(const File::Mbf& base, const File::Mbf& ours, const File::Mbf& theirs, Prefer prefer)
+{
+	MergeResult r{ours, {}, {}};
+	for(int slot = 0; slot < base.presets.size(); slot++)
+	{
+		const File::Preset& b = base.presets[slot].preset;
+		const File::Preset& o = ours.presets[slot].preset;
+		const File::Preset& t = theirs.presets[slot].preset;
+		File::Preset& merged = r.merged.presets[slot].preset;
+
+		auto theirsChanged = CompareBytes(b, t);
+		if(theirsChanged.none())
+			continue;
+		auto oursChanged = CompareBytes(b, o);
+
+		auto merge = [&](Field field, File::Module module, std::uint8_t parameter, int offset, int size)
+		{
+			if(!MergeRange(merged, o, t, oursChanged, theirsChanged, offset, size, prefer))
+				r.conflicts.push_back({slot, field, module, parameter});
+		};
+		merge(Field::Order, {}, 0, orderOffset, sizeof(b.fxOrder));
+		merge(Field::Name, {}, 0, nameOffset, sizeof(b.name));
+		for(int m = 0; m < nrModules; m++)
+		{
+			const auto module = static_cast<File::Module>(m);
+			const int offset = moduleOffset + moduleSize * m;
+			if(oursChanged.test(offset) || theirsChanged.test(offset))
+			{
+				merge(Field::Module, module, 0, offset, moduleSize);
+				continue;
+			}
+			for(int p = 1; p < moduleSize; p++)
+				merge(Field::Parameter, module, p, offset + p, 1);
+		}
+
+		if(CompareBytes(merged, o).any())
+			r.uploads.push_back(slot);
+	}
+	return r;
+}
+
+
+} // namespace Mooer
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <bitset>
+#include <cstdint>
+#include <vector>
+
+#include <MooerParser.h>
+
+
+namespace Mooer
+{
+
+/// One bit per byte of a File::Preset, set where two presets differ
+using PresetMask = std::bitset<sizeof(File::Preset)>;
+
+/// Byte-wise comparison of two presets
+PresetMask CompareBytes(const File::Preset& a, const File::Preset& b);
+
+/// Part of a preset that is compared and merged as a whole
+enum class Field : std::uint8_t
+{
+	Order,	   ///< File::Preset::fxOrder
+	Name,	   ///< File::Preset::name
+	Module,	   ///< All settings of a module, used when its type changed
+	Parameter, ///< A single setting of a module
+};
+
+struct ParameterDiff
+{
+	File::Module module;
+	std::uint8_t parameter; ///< Byte within the module: 0 is the type, 1 enabled, then the knobs
+	std::uint8_t a, b;
+};
+
+struct PresetDiff
+{
+	int slot;
+	bool order;
+	bool name;
+	std::uint16_t modules; ///< Bit per File::Module with a difference
+	std::vector<ParameterDiff> parameters;
+
+	bool empty() const
+	{
+		return !order && !name && modules == 0;
+	}
+};
+
+/// Differences between two presets, the size field is ignored
+PresetDiff Diff(const File::Preset& a, const File::Preset& b, int slot = -1);
+
+/// Differences between all presets of two backups, only the presets that differ are returned
+std::vector<PresetDiff> Diff(const File::Mbf& a, const File::Mbf& b);
+
+/// Slots of \p target that differ from \p device, and have to be uploaded to make them equal
+std::vector<int> UploadSet(const File::Mbf& device, const File::Mbf& target);
+
+struct Conflict
+{
+	int slot;
+	Field field;
+	File::Module module;	///< For Field::Module and Field::Parameter
+	std::uint8_t parameter; ///< For Field::Parameter
+};
+
+struct MergeResult
+{
+	File::Mbf merged;
+	std::vector<Conflict> conflicts;
+	std::vector<int> uploads; ///< Slots where merged differs from ours
+};
+
+/// Which side wins a conflict
+enum class Prefer
+{
+	Ours,
+	Theirs,
+};
+
+/**
+Three-way merge of two backups, that both derive from \p base.
+Changes made on one side only are taken over, changes made on both sides to a different value are conflicts.
+The fx order and name are merged as a whole. When the type of a module changed,
+its other settings have a different meaning, so the module is merged as a whole too.
+The header and system settings are taken from \p ours.
+*/
+MergeResult Merge(const File::Mbf& base, const File::Mbf& ours, const File::Mbf& theirs, Prefer prefer = Prefer::Ours);
+
+} // namespace Mooer
@@ -0,0 +1,312 @@
+#include <PresetJson.h>
+
+#include <cctype>
+#include <charconv>
+#include <sstream>
+
+
+namespace Mooer
+{
+
+namespace
+{
+
+constexpr int nrModules = static_cast<int>(File::Module::Count);
+constexpr int nrValues = 6; ///< Per module, after type and enabled
+
+constexpr std::array<std::string_view, nrModules> g_moduleKeys = {
+	"fx", "ds", "amp", "cab", "ns", "eq", "mod", "delay", "reverb"};
+
+
+std::uint8_t* moduleData(File::Preset& preset, int m)
+{
+	return reinterpret_cast<std::uint8_t*>(&preset.fx) + 8 * m;
+}
+
+
+void writeString(std::ostream& os, std::string_view s)
+{
+	constexpr char hex[] = "0123456789abcdef";
+	os << '"';
+	for(unsigned char c : s)
+	{
+		if(c == '"' || c == '\\')
+			os << '\\' << c;
+		else if(c < 0x20 || c >= 0x7F)
+			os << "\\u00" << hex[c >> 4] << hex[c & 0xF];
+		else
+			os << c;
+	}
+	os << '"';
+}
+
+
+template<typename Range>
+void writeArray(std::ostream& os, const Range& values)
+{
+	os << '[';
+	for(int n = 0; n < std::size(values); n++)
+		os << (n > 0 ? ", " : "") << int(values[n]);
+	os << ']';
+}
+
+
+/// Reads the subset of JSON that ToJson() writes: objects, arrays, strings and integers
+class Reader
+{
+public:
+	Reader(std::string_view json)
+		: m_json(json), m_pos(0)
+	{
+	}
+
+	void finish()
+	{
+		if(peek() != '\0')
+			fail("trailing characters");
+	}
+
+	/// Call \p onKey for every key of an object, it has to read the value
+	template<typename F>
+	void object(F&& onKey)
+	{
+		expect('{');
+		if(peek() == '}')
+		{
+			m_pos++;
+			return;
+		}
+		do
+		{
+			auto key = string();
+			expect(':');
+			onKey(key);
+		} while(next(','));
+		expect('}');
+	}
+
+	/// Call \p onItem with the index of every element of an array, it has to read the element
+	template<typename F>
+	void array(F&& onItem)
+	{
+		expect('[');
+		if(peek() == ']')
+		{
+			m_pos++;
+			return;
+		}
+		int n = 0;
+		do
+			onItem(n++);
+		while(next(','));
+		expect(']');
+	}
+
+	std::string string()
+	{
+		expect('"');
+		std::string r;
+		while(m_pos < m_json.size() && m_json[m_pos] != '"')
+		{
+			char c = m_json[m_pos++];
+			if(c != '\\')
+			{
+				r += c;
+				continue;
+			}
+			if(m_pos >= m_json.size())
+				break;
+			c = m_json[m_pos++];
+			if(c == 'u')
+			{
+				auto code = integer(m_json.substr(m_pos, 4), 16);
+				if(code > 0xFF)
+					fail("only \\u0000 to \\u00ff are supported");
+				r += static_cast<char>(code);
+				m_pos += 4;
+			}
+			else if(c == 'n')
+				r += '\n';
+			else if(c == 't')
+				r += '\t';
+			else
+				r += c;
+		}
+		expect('"');
+		return r;
+	}
+
+	int number()
+	{
+		peek();
+		auto start = m_pos;
+		auto isNumber = [](char c) { return std::isdigit(static_cast<unsigned char>(c)) || c == '-'; };
+		while(m_pos < m_json.size() && isNumber(m_json[m_pos]))
+			m_pos++;
+		return integer(m_json.substr(start, m_pos - start), 10);
+	}
+
+	std::uint8_t byte()
+	{
+		int v = number();
+		if(v < 0 || v > 0xFF)
+			fail("value out of range");
+		return v;
+	}
+
+	/// Skip any value, for keys that are informational only
+	void skip()
+	{
+		switch(peek())
+		{
+		case '{':
+			object([this](auto&) { skip(); });
+			break;
+		case '[':
+			array([this](int) { skip(); });
+			break;
+		case '"':
+			string();
+			break;
+		default:
+			number();
+		}
+	}
+
+	[[noreturn]] void fail(std::string_view what) const
+	{
+		std::stringstream ss;
+		ss << "JSON: " << what << " at offset " << m_pos;
+		throw std::runtime_error(ss.str());
+	}
+
+private:
+	char peek()
+	{
+		while(m_pos < m_json.size() && std::isspace(static_cast<unsigned char>(m_json[m_pos])))
+			m_pos++;
+		return m_pos < m_json.size() ? m_json[m_pos] : '\0';
+	}
+
+	bool next(char c)
+	{
+		if(peek() != c)
+			return false;
+		m_pos++;
+		return true;
+	}
+
+	void expect(char c)
+	{
+		if(!next(c))
+			fail(std::string("expected '") + c + "'");
+	}
+
+	int integer(std::string_view s, int base) const
+	{
+		int v = 0;
+		auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), v, base);
+		if(ec != std::errc() || ptr != s.data() + s.size() || s.empty())
+			fail("invalid number");
+		return v;
+	}
+
+	std::string_view m_json;
+	std::size_t m_pos;
+};
+
+} // namespace
+
+
+std::string ToJson(const File::Preset& preset)
+{
+	std::stringstream os;
+	os << "{\n  \"name\": ";
+	writeString(os, preset.getName());
+	os << ",\n  \"size\": " << std::uint16_t(preset.size) << ",\n  \"order\": ";
+	writeArray(os, preset.fxOrder);
+	os << ",\n  \"modules\": {\n";
+	for(int m = 0; m < nrModules; m++)
+	{
+		auto module = preset.module(static_cast<File::Module>(m));
+		os << "    \"" << g_moduleKeys[m] << "\": {\"type\": " << int(module[0]) << ", \"enabled\": " << int(module[1])
+		   << ", \"values\": ";
+		writeArray(os, module.subspan<2>());
+		os << '}' << (m + 1 < nrModules ? ",\n" : "\n");
+	}
+	os << "  }\n}\n";
+	return os.str();
+}
+
+
+File::Preset FromJson(std::string_view json)
+{
+	File::Preset preset{};
+	Reader rd(json);
+	rd.object(
+		[&](const std::string& key)
+		{
+			if(key == "name")
+			{
+				auto name = rd.string();
+				if(name.size() > sizeof(preset.name))
+					rd.fail("name too long");
+				std::copy(begin(name), end(name), preset.name);
+			}
+			else if(key == "size")
+			{
+				const int size = rd.number();
+				if(size < 0 || size > 0xFFFF)
+					rd.fail("size out of range");
+				preset.size = size;
+			}
+			else if(key == "order")
+			{
+				rd.array(
+					[&](int n)
+					{
+						if(n >= preset.fxOrder.size())
+							rd.fail("too many entries in order");
+						preset.fxOrder[n] = rd.byte();
+					});
+			}
+			else if(key == "modules")
+			{
+				rd.object(
+					[&](const std::string& name)
+					{
+						auto it = std::find(begin(g_moduleKeys), end(g_moduleKeys), name);
+						if(it == end(g_moduleKeys))
+							rd.fail("unknown module " + name);
+						auto* module = moduleData(preset, it - begin(g_moduleKeys));
+						rd.object(
+							[&](const std::string& field)
+							{
+								if(field == "type")
+									module[0] = rd.byte();
+								else if(field == "enabled")
+									module[1] = rd.byte();
+								else if(field == "values")
+									rd.array(
+										[&](int n)
+										{
+											if(n >= nrValues)
+												rd.fail("too many values");
+											module[2 + n] = rd.byte();
+										});
+								else
+									rd.skip();
+							});
+					});
+			}
+			else
+			{
+				rd.skip();
+			}
+		});
+	rd.finish();
+	return preset;
+}
+
+
+} // namespace Mooer
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include <MooerParser.h>
+
+
+namespace Mooer
+{
+
+/**
+Text representation of a File::Preset, for version control and editing by hand.
+
+All settings of the preset are represented, so a conversion to JSON and back keeps the preset as it is.
+It is not lossless for the file: the padding that follows the preset in an .mo or .mbf is not represented.
+The keys are always written in the same order, and one module per line, so diffs stay small:
+\code
+{
+  "name": "Clean",
+  "size": 96,
+  "order": [0, 1, 2, 3, 4, 5, 6, 7, 8, 9],
+  "modules": {
+    "fx": {"type": 1, "enabled": 1, "values": [50, 50, 50, 50, 0, 0]},
+    ...
+  }
+}
+\endcode
+*/
+std::string ToJson(const File::Preset& preset);
+
+/// Parse the output of ToJson(), throws std::runtime_error on invalid input
+File::Preset FromJson(std::string_view json);
+
+} // namespace Mooer
@@ -0,0 +1,374 @@
+#include <PresetLibrary.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <tuple>
+#include <unordered_map>
+
+#include <FileView.h>
+#include <MappedFile.h>
+#include <Parallel.h>
+
+
+namespace Mooer
+{
+
+namespace
+{
+
+constexpr std::array<char, 8> g_libraryMagic = {'M', 'O', 'O', 'E', 'R', 'L', 'I', 'B'};
+constexpr std::uint32_t g_libraryVersion = 2;
+
+/// Longest path in an index file, a longer one means it is corrupt
+constexpr std::uint32_t g_maxPath = 1 << 16;
+
+enum class PresetFileType
+{
+	None,
+	MO,
+	MBF
+};
+
+
+PresetFileType GetFileType(const std::filesystem::path& fn)
+{
+	auto ext = fn.extension().string();
+	std::transform(begin(ext), end(ext), begin(ext), [](unsigned char c) { return std::tolower(c); });
+	if(ext == ".mo")
+		return PresetFileType::MO;
+	if(ext == ".mbf")
+		return PresetFileType::MBF;
+	return PresetFileType::None;
+}
+
+
+/// The path as it is stored in an index, which is also how files are matched to entries
+std::string PathKey(const std::filesystem::path& fn)
+{
+	const auto path = fn.generic_u8string();
+	return std::string(begin(path), end(path));
+}
+
+
+/// Summaries of all presets in a file, throws if it's not a valid preset file
+std::vector<PresetLibrary::Entry> ReadPresets(std::span<const std::uint8_t> data, PresetFileType type)
+{
+	std::vector<PresetLibrary::Entry> r;
+	if(type == PresetFileType::MO)
+	{
+		r.push_back(PresetLibrary::Summarize(File::MoView(data).preset(), 0, -1));
+	}
+	else if(type == PresetFileType::MBF)
+	{
+		File::MbfView mbf(data);
+		r.reserve(mbf.size());
+		for(const auto& p : mbf.presets())
+			r.push_back(PresetLibrary::Summarize(p.preset, 0, p.index));
+	}
+	return r;
+}
+
+
+template<PODType T>
+void write(std::ostream& os, const T& v)
+{
+	os.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+
+template<PODType T>
+T read(std::istream& is)
+{
+	T v;
+	is.read(reinterpret_cast<char*>(&v), sizeof(T));
+	if(!is)
+		throw std::runtime_error("PresetLibrary: index file is truncated");
+	return v;
+}
+
+
+/// A size or count, throws if it is larger than \p max
+std::uint32_t readSize(std::istream& is, std::uint64_t max)
+{
+	const auto n = read<std::uint32_t>(is);
+	if(n > max)
+		throw std::runtime_error("PresetLibrary: index file is corrupt");
+	return n;
+}
+
+} // namespace
+
+
+PresetLibrary::Entry PresetLibrary::Summarize(const File::Preset& preset, std::uint32_t file, int slot)
+{
+	Entry e{};
+	std::copy(std::begin(preset.name), std::end(preset.name), begin(e.name));
+	e.file = file;
+	e.slot = slot;
+	for(int m = 0; m < static_cast<int>(File::Module::Count); m++)
+	{
+		if(preset.enabled(static_cast<File::Module>(m)))
+			e.modules |= 1 << m;
+	}
+	e.ampType = preset.amp.type;
+	e.cabType = preset.cab.type;
+	return e;
+}
+
+
+PresetLibrary::ScanStatistics PresetLibrary::Scan(std::span<const std::filesystem::path> directories)
+{
+	namespace fs = std::filesystem;
+
+	struct Candidate
+	{
+		FileEntry file;
+		PresetFileType type;
+		const FileEntry* previous;
+		bool previousFailed;
+		std::vector<Entry> presets;
+		bool valid;
+	};
+
+	// The entry of each file at the previous scan, and whether it failed
+	std::unordered_map<std::string, std::pair<const FileEntry*, bool>> previous;
+	for(const auto& f : m_files)
+		previous[PathKey(f.path)] = {&f, false};
+	for(const auto& f : m_failed)
+		previous[PathKey(f.path)] = {&f, true};
+
+	std::vector<Candidate> candidates;
+	for(const auto& dir : directories)
+	{
+		std::error_code ec;
+		for(fs::recursive_directory_iterator it(dir, fs::directory_options::skip_permission_denied, ec), end;
+			!ec && it != end;
+			it.increment(ec))
+		{
+			auto type = GetFileType(it->path());
+			if(type == PresetFileType::None || !it->is_regular_file(ec))
+				continue;
+			Candidate c{};
+			c.file.path = it->path();
+			c.file.size = it->file_size(ec);
+			c.file.mtime = it->last_write_time(ec).time_since_epoch().count();
+			c.type = type;
+			if(auto prev = previous.find(PathKey(c.file.path)); prev != previous.end())
+				std::tie(c.previous, c.previousFailed) = prev->second;
+			candidates.push_back(std::move(c));
+		}
+	}
+	std::sort(begin(candidates), end(candidates), [](auto& a, auto& b) { return a.file.path < b.file.path; });
+	candidates.erase(std::unique(begin(candidates),
+								 end(candidates),
+								 [](auto& a, auto& b) { return a.file.path == b.file.path; }),
+					 end(candidates));
+
+	auto oldPresets = [this](const FileEntry& f)
+	{
+		auto first = begin(m_entries) + f.firstPreset;
+		return std::vector<Entry>(first, first + f.nrPresets);
+	};
+
+	std::atomic<int> nrRead = 0;
+	Parallel::For(candidates.size(),
+				  [&](std::size_t n)
+				  {
+					  Candidate& c = candidates[n];
+					  const FileEntry* prev = c.previous;
+					  auto keep = [&]
+					  {
+						  c.file.hash = prev->hash;
+						  if(!c.previousFailed)
+							  c.presets = oldPresets(*prev);
+						  c.valid = !c.previousFailed;
+					  };
+					  if(prev != nullptr && prev->mtime == c.file.mtime && prev->size == c.file.size)
+						  return keep();
+					  try
+					  {
+						  IO::MappedFile mf(c.file.path);
+						  c.file.hash = IO::Hash64(mf.data());
+						  if(prev != nullptr && prev->hash == c.file.hash)
+							  return keep();
+						  nrRead++;
+						  c.presets = ReadPresets(mf.data(), c.type);
+						  c.valid = true;
+					  }
+					  catch(std::runtime_error&)
+					  {
+						  c.valid = false;
+					  }
+				  });
+
+	ScanStatistics stats;
+	stats.nrRead = nrRead;
+	std::vector<FileEntry> files, failed;
+	std::vector<Entry> entries;
+	for(auto& c : candidates)
+	{
+		if(!c.valid)
+		{
+			failed.push_back(std::move(c.file));
+			continue;
+		}
+		c.file.firstPreset = entries.size();
+		c.file.nrPresets = c.presets.size();
+		for(auto& e : c.presets)
+			e.file = files.size();
+		entries.insert(end(entries), begin(c.presets), end(c.presets));
+		files.push_back(std::move(c.file));
+	}
+	stats.nrFiles = files.size();
+	stats.nrFailed = failed.size();
+
+	for(const auto& f : m_files)
+	{
+		auto found = std::lower_bound(
+			begin(files), end(files), f.path, [](const FileEntry& a, const fs::path& b) { return a.path < b; });
+		if(found == end(files) || found->path != f.path)
+			stats.nrRemoved++;
+	}
+
+	m_files = std::move(files);
+	m_entries = std::move(entries);
+	m_failed = std::move(failed);
+	UpdateSearchNames();
+	return stats;
+}
+
+
+std::vector<std::uint32_t> PresetLibrary::Find(const Query& query) const
+{
+	std::array<char, 16> name{};
+	if(query.name.size() > name.size())
+		return {};
+	std::transform(begin(query.name), end(query.name), begin(name), [](unsigned char c) { return std::toupper(c); });
+	const std::string_view needle(name.data(), query.name.size());
+
+	std::vector<std::uint32_t> r;
+	for(std::uint32_t n = 0; n < m_entries.size(); n++)
+	{
+		const Entry& e = m_entries[n];
+		if((query.ampType >= 0 && e.ampType != query.ampType) || (query.cabType >= 0 && e.cabType != query.cabType))
+			continue;
+		if((e.modules & query.modules) != query.modules)
+			continue;
+		if(!needle.empty())
+		{
+			auto& sn = m_searchNames[n];
+			if(std::string_view(sn.data(), strnlen(sn.data(), sn.size())).find(needle) == std::string_view::npos)
+				continue;
+		}
+		r.push_back(n);
+	}
+	return r;
+}
+
+
+void PresetLibrary::Save(const std::filesystem::path& fn) const
+{
+	std::ofstream f(fn, std::ios::binary);
+	if(!f)
+		throw std::runtime_error("PresetLibrary: could not write " + fn.string());
+
+	write(f, g_libraryMagic);
+	write(f, g_libraryVersion);
+	write<std::uint32_t>(f, m_files.size());
+	write<std::uint32_t>(f, m_entries.size());
+	write<std::uint32_t>(f, m_failed.size());
+	auto writeFile = [&f](const FileEntry& file)
+	{
+		const auto path = PathKey(file.path);
+		write(f, file.mtime);
+		write(f, file.size);
+		write(f, file.hash);
+		write(f, file.firstPreset);
+		write(f, file.nrPresets);
+		write<std::uint32_t>(f, path.size());
+		f.write(path.data(), path.size());
+	};
+	for(const auto& file : m_files)
+		writeFile(file);
+	for(const auto& file : m_failed)
+		writeFile(file);
+	f.write(reinterpret_cast<const char*>(m_entries.data()), m_entries.size() * sizeof(Entry));
+	if(!f)
+		throw std::runtime_error("PresetLibrary: could not write " + fn.string());
+}
+
+
+void PresetLibrary::Load(const std::filesystem::path& fn)
+{
+	std::ifstream f(fn, std::ios::binary);
+	if(!f)
+		throw std::runtime_error("PresetLibrary: could not open " + fn.string());
+	const auto fileSize = std::filesystem::file_size(fn); // Bounds the counts, before they are allocated
+
+	if(read<std::array<char, 8>>(f) != g_libraryMagic)
+		throw std::runtime_error("PresetLibrary: not an index file");
+	if(auto version = read<std::uint32_t>(f); version != g_libraryVersion)
+	{
+		std::stringstream ss;
+		ss << "PresetLibrary: index version " << version << " is not supported";
+		throw std::runtime_error(ss.str());
+	}
+
+	// A file record has at least its mtime, size, hash, preset range and path length
+	constexpr auto fileRecord = 3 * sizeof(std::uint64_t) + 3 * sizeof(std::uint32_t);
+	std::vector<FileEntry> files(readSize(f, fileSize / fileRecord));
+	std::vector<Entry> entries(readSize(f, fileSize / sizeof(Entry)));
+	std::vector<FileEntry> failed(readSize(f, fileSize / fileRecord));
+	auto readFile = [&f](FileEntry& file)
+	{
+		file.mtime = read<std::int64_t>(f);
+		file.size = read<std::uint64_t>(f);
+		file.hash = read<std::uint64_t>(f);
+		file.firstPreset = read<std::uint32_t>(f);
+		file.nrPresets = read<std::uint32_t>(f);
+		std::u8string path(readSize(f, g_maxPath), '\0');
+		f.read(reinterpret_cast<char*>(path.data()), path.size());
+		if(!f)
+			throw std::runtime_error("PresetLibrary: index file is truncated");
+		file.path = path;
+	};
+	for(auto& file : files)
+	{
+		readFile(file);
+		if(std::uint64_t(file.firstPreset) + file.nrPresets > entries.size())
+			throw std::runtime_error("PresetLibrary: index file is corrupt");
+	}
+	for(auto& file : failed)
+		readFile(file);
+	f.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(Entry));
+	if(!f)
+		throw std::runtime_error("PresetLibrary: index file is truncated");
+	for(const auto& e : entries)
+	{
+		if(e.file >= files.size())
+			throw std::runtime_error("PresetLibrary: index file is corrupt");
+	}
+
+	m_files = std::move(files);
+	m_entries = std::move(entries);
+	m_failed = std::move(failed);
+	UpdateSearchNames();
+}
+
+
+void PresetLibrary::UpdateSearchNames()
+{
+	m_searchNames.resize(m_entries.size());
+	for(std::size_t n = 0; n < m_entries.size(); n++)
+	{
+		auto& name = m_entries[n].name;
+		std::transform(
+			begin(name), end(name), begin(m_searchNames[n]), [](unsigned char c) { return std::toupper(c); });
+	}
+}
+
+
+} // namespace Mooer
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include <MooerParser.h>
+
+
+namespace Mooer
+{
+
+/**
+Searchable index over a collection of .mo presets and .mbf backups.
+
+Only a compact summary of each preset is kept, which can be saved to disk.
+A rescan only reads files of which the modification time or size changed,
+and keeps the summaries of files whose content hash did not change.
+Files that could not be read are kept aside, so they are only read again when they change.
+*/
+class PresetLibrary
+{
+public:
+	struct FileEntry
+	{
+		std::filesystem::path path;
+		std::int64_t mtime;
+		std::uint64_t size;
+		std::uint64_t hash;
+		std::uint32_t firstPreset, nrPresets; ///< Range into entries()
+	};
+
+	struct Entry
+	{
+		std::string_view getName() const
+		{
+			return {name.data(), strnlen(name.data(), name.size())};
+		}
+
+		bool enabled(File::Module m) const
+		{
+			return (modules >> static_cast<int>(m)) & 1;
+		}
+
+		std::array<char, 16> name;
+		std::uint32_t file;	   ///< Index into files()
+		std::int16_t slot;	   ///< Preset index within an .mbf, -1 for an .mo
+		std::uint16_t modules; ///< Bit n is set if File::Module(n) is enabled
+		u8 ampType, cabType;
+		u8 reserved[2];
+	};
+	static_assert(sizeof(Entry) == 28);
+
+	struct Query
+	{
+		std::string_view name;	   ///< Case-insensitive substring, empty matches all
+		int ampType = -1;		   ///< -1 matches all
+		int cabType = -1;		   ///< -1 matches all
+		std::uint16_t modules = 0; ///< All of these modules must be enabled
+	};
+
+	struct ScanStatistics
+	{
+		int nrFiles = 0;   ///< Preset files found
+		int nrRead = 0;	   ///< Files that were (re-)read
+		int nrFailed = 0;  ///< Files that could not be parsed, now or at a previous scan if they did not change
+		int nrRemoved = 0; ///< Files no longer on disk
+	};
+
+	/// Summarize a single preset
+	static Entry Summarize(const File::Preset& preset, std::uint32_t file, int slot);
+
+	/// (Re-)scan \p directories recursively for .mo and .mbf files
+	ScanStatistics Scan(std::span<const std::filesystem::path> directories);
+
+	/// Indices into entries() of all presets matching \p query
+	std::vector<std::uint32_t> Find(const Query& query) const;
+
+	void Save(const std::filesystem::path& fn) const;
+
+	void Load(const std::filesystem::path& fn);
+
+	const std::vector<FileEntry>& files() const
+	{
+		return m_files;
+	}
+
+	const std::vector<Entry>& entries() const
+	{
+		return m_entries;
+	}
+
+	/// Files that could not be read, without presets
+	const std::vector<FileEntry>& failed() const
+	{
+		return m_failed;
+	}
+
+	const FileEntry& file(const Entry& e) const
+	{
+		return m_files.at(e.file);
+	}
+
+private:
+	void UpdateSearchNames();
+
+	std::vector<FileEntry> m_files;
+	std::vector<Entry> m_entries;
+	std::vector<FileEntry> m_failed;
+	std::vector<std::array<char, 16>> m_searchNames; ///< Upper-case copy of Entry::name
+};
+
+} // namespace Mooer
@@ -0,0 +1,298 @@
+#include <PresetSimilarity.h>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <random>
+#include <tuple>
+#include <unordered_set>
+
+#include <MappedFile.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MOOER_SIMILARITY_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MOOER_SIMILARITY_NEON
+#endif
+
+
+namespace Mooer
+{
+
+namespace
+{
+
+constexpr int N = PresetFeatures::size;
+
+/// Full-scale value of each knob, 0 for unused bytes
+// clang-format off
+constexpr std::array<std::array<float, PresetFeatures::nrKnobs>, PresetFeatures::nrModules> g_knobRange = {{
+	{100, 100, 100, 100, 0, 0},	  // FX: attack, thresh, ratio, level
+	{100, 100, 100, 0, 0, 0},	  // DS: volume, tone, gain
+	{100, 100, 100, 100, 100, 100}, // AMP: gain, bass, mid, treble, pres, mst
+	{10, 100, 100, 5, 0, 0},	  // CAB: mic, center, distance, tube (as DeviceFormat::Cab)
+	{100, 100, 100, 0, 0, 0},	  // NS: attack, release, thresh
+	{24, 24, 24, 24, 24, 24},	  // EQ: bands
+	{100, 100, 100, 100, 100, 0}, // MOD: rate, level, depth, p4, p5
+	{100, 100, 255, 255, 255, 255}, // DELAY: level, feedback, time, subdivision, p5, p6
+	{100, 100, 100, 100, 0, 0},	  // REVERB: pre-delay, level, decay, tone
+}};
+// clang-format on
+
+
+float SquaredDistance(const float* a, const float* b)
+{
+#if defined(MOOER_SIMILARITY_SSE2)
+	__m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+	for(int n = 0; n < N; n += 8)
+	{
+		__m128 d0 = _mm_sub_ps(_mm_load_ps(a + n), _mm_load_ps(b + n));
+		__m128 d1 = _mm_sub_ps(_mm_load_ps(a + n + 4), _mm_load_ps(b + n + 4));
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(d0, d0));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(d1, d1));
+	}
+	acc0 = _mm_add_ps(acc0, acc1);
+	acc0 = _mm_add_ps(acc0, _mm_movehl_ps(acc0, acc0));
+	acc0 = _mm_add_ss(acc0, _mm_shuffle_ps(acc0, acc0, 1));
+	return _mm_cvtss_f32(acc0);
+#elif defined(MOOER_SIMILARITY_NEON)
+	float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+	for(int n = 0; n < N; n += 8)
+	{
+		float32x4_t d0 = vsubq_f32(vld1q_f32(a + n), vld1q_f32(b + n));
+		float32x4_t d1 = vsubq_f32(vld1q_f32(a + n + 4), vld1q_f32(b + n + 4));
+		acc0 = vmlaq_f32(acc0, d0, d0);
+		acc1 = vmlaq_f32(acc1, d1, d1);
+	}
+	return vaddvq_f32(vaddq_f32(acc0, acc1));
+#else
+	std::array<float, 4> acc = {0, 0, 0, 0};
+	for(int n = 0; n < N; n += 4)
+	{
+		for(int i = 0; i < 4; i++)
+		{
+			float d = a[n + i] - b[n + i];
+			acc[i] += d * d;
+		}
+	}
+	return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+#endif
+}
+
+
+float Dot(const float* a, const float* b)
+{
+#if defined(MOOER_SIMILARITY_SSE2)
+	__m128 acc = _mm_setzero_ps();
+	for(int n = 0; n < N; n += 4)
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_load_ps(a + n), _mm_loadu_ps(b + n)));
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+	return _mm_cvtss_f32(acc);
+#elif defined(MOOER_SIMILARITY_NEON)
+	float32x4_t acc = vdupq_n_f32(0);
+	for(int n = 0; n < N; n += 4)
+		acc = vmlaq_f32(acc, vld1q_f32(a + n), vld1q_f32(b + n));
+	return vaddvq_f32(acc);
+#else
+	std::array<float, 4> acc = {0, 0, 0, 0};
+	for(int n = 0; n < N; n += 4)
+	{
+		for(int i = 0; i < 4; i++)
+			acc[i] += a[n + i] * b[n + i];
+	}
+	return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+#endif
+}
+
+} // namespace
+
+
+PresetFeatures PresetFeatures::From(const File::Preset& preset)
+{
+	PresetFeatures f;
+	f.values.fill(0);
+	for(int m = 0; m < nrModules; m++)
+	{
+		auto module = preset.module(static_cast<File::Module>(m));
+		f.types[m] = module[0];
+		float* v = &f.values[m * (1 + nrKnobs)];
+		v[0] = module[1] != 0 ? 1.f : 0.f;
+		for(int k = 0; k < nrKnobs; k++)
+		{
+			float range = g_knobRange[m][k];
+			v[1 + k] = range > 0 ? module[2 + k] / range : 0.f;
+		}
+	}
+
+	// Everything but the name and size
+	std::array<std::uint8_t, sizeof(preset.fxOrder) + 8 * nrModules> settings;
+	auto modules = as_const_span(&preset).subspan(offsetof(File::Preset, fx), 8 * nrModules);
+	std::copy(begin(preset.fxOrder), end(preset.fxOrder), begin(settings));
+	std::copy(begin(modules), end(modules), begin(settings) + preset.fxOrder.size());
+	f.hash = IO::Hash64(settings);
+	return f;
+}
+
+
+float Distance(const PresetFeatures& a, const PresetFeatures& b)
+{
+	float d = SquaredDistance(a.values.data(), b.values.data());
+	for(int m = 0; m < PresetFeatures::nrModules; m++)
+		d += a.types[m] != b.types[m] ? 1.f : 0.f;
+	return d;
+}
+
+
+//-- PresetSimilarity --
+
+
+PresetSimilarity::PresetSimilarity(int nrTables, int nrProjections, float bucketWidth, std::uint32_t seed)
+	: m_nrProjections(std::max(nrProjections, 1)), m_bucketWidth(bucketWidth), m_tables(std::max(nrTables, 1))
+{
+	std::mt19937 rng(seed);
+	std::normal_distribution<float> normal;
+	std::uniform_real_distribution<float> uniform(0, bucketWidth);
+	m_projections.resize(m_tables.size() * m_nrProjections * N);
+	std::generate(begin(m_projections), end(m_projections), [&]() { return normal(rng); });
+	m_offsets.resize(m_tables.size() * m_nrProjections);
+	std::generate(begin(m_offsets), end(m_offsets), [&]() { return uniform(rng); });
+}
+
+
+std::uint64_t PresetSimilarity::Bucket(const PresetFeatures& f, int table) const
+{
+	const int first = table * m_nrProjections;
+	std::uint64_t bucket = 0xCBF29CE484222325ull;
+	for(int p = first; p < first + m_nrProjections; p++)
+	{
+		float projection = Dot(f.values.data(), &m_projections[p * N]) + m_offsets[p];
+		auto cell = static_cast<std::int64_t>(std::floor(projection / m_bucketWidth));
+		bucket = (bucket ^ static_cast<std::uint64_t>(cell)) * 0x100000001B3ull;
+	}
+	return bucket;
+}
+
+
+std::uint32_t PresetSimilarity::Add(const File::Preset& preset)
+{
+	std::uint32_t id = m_features.size();
+	m_features.push_back(PresetFeatures::From(preset));
+	for(int t = 0; t < m_tables.size(); t++)
+		m_tables[t][Bucket(m_features.back(), t)].push_back(id);
+	return id;
+}
+
+
+std::vector<PresetSimilarity::Match> PresetSimilarity::Search(const PresetFeatures& f,
+															  int k,
+															  std::int64_t exclude) const
+{
+	std::vector<std::uint32_t> candidates;
+	for(int t = 0; t < m_tables.size(); t++)
+	{
+		auto bucket = m_tables[t].find(Bucket(f, t));
+		if(bucket != m_tables[t].end())
+			candidates.insert(end(candidates), begin(bucket->second), end(bucket->second));
+	}
+	std::sort(begin(candidates), end(candidates));
+	candidates.erase(std::unique(begin(candidates), end(candidates)), end(candidates));
+	if(exclude >= 0)
+		std::erase(candidates, exclude);
+
+	// Not enough near neighbours, fall back to an exhaustive search
+	if(candidates.size() < k)
+	{
+		candidates.resize(m_features.size());
+		std::iota(begin(candidates), end(candidates), 0);
+		if(exclude >= 0)
+			std::erase(candidates, exclude);
+	}
+
+	std::vector<Match> r(candidates.size());
+	std::transform(begin(candidates),
+				   end(candidates),
+				   begin(r),
+				   [&](std::uint32_t id) {
+					   return Match{id, Distance(f, m_features[id])};
+				   });
+	auto nearest = begin(r) + std::min<std::size_t>(std::max(k, 0), r.size());
+	std::partial_sort(begin(r), nearest, end(r), [](auto& a, auto& b) { return a.distance < b.distance; });
+	r.erase(nearest, end(r));
+	return r;
+}
+
+
+std::vector<PresetSimilarity::Match> PresetSimilarity::Similar(const File::Preset& preset, int k) const
+{
+	return Search(PresetFeatures::From(preset), k, -1);
+}
+
+
+std::vector<PresetSimilarity::Match> PresetSimilarity::Similar(std::uint32_t id, int k) const
+{
+	return Search(m_features.at(id), k, id);
+}
+
+
+std::vector<std::vector<std::uint32_t>> PresetSimilarity::ExactDuplicates() const
+{
+	std::unordered_map<std::uint64_t, std::vector<std::uint32_t>> byHash;
+	for(std::uint32_t id = 0; id < m_features.size(); id++)
+		byHash[m_features[id].hash].push_back(id);
+
+	std::vector<std::vector<std::uint32_t>> r;
+	for(auto& [hash, ids] : byHash)
+	{
+		if(ids.size() > 1)
+			r.push_back(std::move(ids));
+	}
+	std::sort(begin(r), end(r));
+	return r;
+}
+
+
+std::vector<PresetSimilarity::Pair> PresetSimilarity::NearDuplicates(float maxDistance) const
+{
+	std::unordered_set<std::uint64_t> seen;
+	std::vector<Pair> r;
+	std::vector<std::uint32_t> members;
+	for(const auto& table : m_tables)
+	{
+		for(const auto& [bucket, ids] : table)
+		{
+			// Exact duplicates only take part once, via their lowest id
+			members.clear();
+			for(std::uint32_t id : ids)
+			{
+				auto h = m_features[id].hash;
+				if(std::none_of(begin(members), end(members), [&](auto u) { return m_features[u].hash == h; }))
+					members.push_back(id);
+			}
+
+			for(int i = 0; i < members.size(); i++)
+			{
+				const auto& fi = m_features[members[i]];
+				for(int j = i + 1; j < members.size(); j++)
+				{
+					const auto& fj = m_features[members[j]];
+					if(fi.types != fj.types)
+						continue;
+					float d = SquaredDistance(fi.values.data(), fj.values.data());
+					if(d > maxDistance)
+						continue;
+					std::uint64_t key = (std::uint64_t(members[i]) << 32) | members[j];
+					if(seen.insert(key).second)
+						r.push_back({members[i], members[j], d});
+				}
+			}
+		}
+	}
+	std::sort(begin(r), end(r), [](auto& a, auto& b) { return std::tie(a.a, a.b) < std::tie(b.a, b.b); });
+	return r;
+}
+
+
+} // namespace Mooer
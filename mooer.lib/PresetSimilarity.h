@@ -0,0 +1,102 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include <MooerParser.h>
+
+
+namespace Mooer
+{
+
+/// Numeric representation of a File::Preset, for similarity searches
+struct PresetFeatures
+{
+	constexpr static int nrModules = static_cast<int>(File::Module::Count);
+	constexpr static int nrKnobs = 6; ///< Settings per module, after type and enabled
+	constexpr static int size = 64;	  ///< nrModules * (1 + nrKnobs), padded for SIMD
+
+	static PresetFeatures From(const File::Preset& preset);
+
+	/// Per module: enabled and the knobs, normalized to [0, 1]
+	alignas(16) std::array<float, size> values;
+	std::array<u8, nrModules> types;
+	std::uint64_t hash; ///< Hash of all settings, excluding the name
+};
+
+/**
+Distance between two presets:
+Squared euclidean distance of the normalized values, plus 1 for every module of a different type.
+*/
+float Distance(const PresetFeatures& a, const PresetFeatures& b);
+
+/**
+Finds similar and duplicate presets.
+
+Presets are bucketed by quantized random projections (p-stable locality sensitive hashing),
+so queries only compare against a small number of candidates.
+*/
+class PresetSimilarity
+{
+public:
+	struct Match
+	{
+		std::uint32_t id;
+		float distance;
+	};
+
+	struct Pair
+	{
+		std::uint32_t a, b; ///< a < b
+		float distance;
+	};
+
+	/**
+	\p nrTables: number of independent hash tables, more gives better recall
+	\p nrProjections: projections per table, more gives smaller buckets
+	\p bucketWidth: quantization step of the projections, presets closer than this usually share a bucket
+	*/
+	PresetSimilarity(int nrTables = 8, int nrProjections = 6, float bucketWidth = 1.f, std::uint32_t seed = 0x4D4F4552);
+
+	/// Add a preset, returns its id (ids are assigned consecutively, starting at 0)
+	std::uint32_t Add(const File::Preset& preset);
+
+	std::size_t size() const
+	{
+		return m_features.size();
+	}
+
+	const PresetFeatures& features(std::uint32_t id) const
+	{
+		return m_features.at(id);
+	}
+
+	/// Up to \p k presets most similar to \p preset, nearest first
+	std::vector<Match> Similar(const File::Preset& preset, int k) const;
+
+	/// Up to \p k presets most similar to preset \p id, excluding itself
+	std::vector<Match> Similar(std::uint32_t id, int k) const;
+
+	/// Groups of ids with identical settings (ignoring the name)
+	std::vector<std::vector<std::uint32_t>> ExactDuplicates() const;
+
+	/// All pairs of presets with the same module types, that are at most \p maxDistance apart
+	std::vector<Pair> NearDuplicates(float maxDistance) const;
+
+private:
+	std::uint64_t Bucket(const PresetFeatures& f, int table) const;
+
+	std::vector<Match> Search(const PresetFeatures& f, int k, std::int64_t exclude) const;
+
+	int m_nrProjections;
+	float m_bucketWidth;
+	std::vector<float> m_projections; ///< nrTables * nrProjections directions of PresetFeatures::size
+	std::vector<float> m_offsets;	  ///< Random offset per projection, in [0, bucketWidth)
+	std::vector<PresetFeatures> m_features;
+	std::vector<std::unordered_map<std::uint64_t, std::vector<std::uint32_t>>> m_tables;
+};
+
+} // namespace Mooer
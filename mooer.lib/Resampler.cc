@@ -0,0 +1,126 @@
+#include <Resampler.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numbers>
+#include <numeric>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MOOER_RESAMPLER_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MOOER_RESAMPLER_NEON
+#endif
+
+
+namespace DSP
+{
+
+namespace
+{
+
+/// Modified Bessel function of the first kind, order 0
+double BesselI0(double x)
+{
+	double sum = 1, term = 1;
+	for(int k = 1; k < 50 && term > 1e-12 * sum; k++)
+	{
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+
+/// Dot product of \p n floats, \p n a multiple of 4
+float Dot(const float* a, const float* b, int n)
+{
+#if defined(MOOER_RESAMPLER_SSE2)
+	__m128 acc = _mm_setzero_ps();
+	for(int i = 0; i < n; i += 4)
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+	acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+	acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+	return _mm_cvtss_f32(acc);
+#elif defined(MOOER_RESAMPLER_NEON)
+	float32x4_t acc = vdupq_n_f32(0);
+	for(int i = 0; i < n; i += 4)
+		acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+	return vaddvq_f32(acc);
+#else
+	std::array<float, 4> acc = {0, 0, 0, 0};
+	for(int i = 0; i < n; i += 4)
+	{
+		for(int k = 0; k < 4; k++)
+			acc[k] += a[i + k] * b[i + k];
+	}
+	return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+#endif
+}
+
+} // namespace
+
+
+Resampler::Resampler(std::uint32_t from, std::uint32_t to, int halfTaps)
+{
+	if(from == 0 || to == 0)
+		throw std::runtime_error("Resampler: sample rates must be positive");
+	auto g = std::gcd(from, to);
+	m_up = to / g;
+	m_down = from / g;
+	m_taps = (2 * std::max(halfTaps, 2) + 3) & ~3;
+	m_delay = m_taps * m_up / 2;
+
+	// Prototype low-pass filter at the upsampled rate, with unity gain per phase
+	constexpr double beta = 8.6;
+	const int length = m_taps * m_up;
+	const double cutoff = 0.5 / std::max(m_up, m_down) * 0.95;
+	const double i0beta = BesselI0(beta);
+	m_phases.resize(length);
+	for(int j = 0; j < length; j++)
+	{
+		double t = j - m_delay;
+		double sinc = t == 0 ? 2 * cutoff : std::sin(2 * std::numbers::pi * cutoff * t) / (std::numbers::pi * t);
+		double w = t / m_delay;
+		double window = BesselI0(beta * std::sqrt(std::max(0.0, 1 - w * w))) / i0beta;
+
+		// Phase p holds h[p + k * up], stored time-reversed so it is a dot product with the input
+		int p = j % m_up, k = j / m_up;
+		m_phases[p * m_taps + (m_taps - 1 - k)] = static_cast<float>(m_up * sinc * window);
+	}
+}
+
+
+std::size_t Resampler::OutputSize(std::size_t n) const
+{
+	return (n * m_up + m_down - 1) / m_down;
+}
+
+
+std::vector<float> Resampler::Process(std::span<const float> x) const
+{
+	if(m_up == m_down)
+		return {begin(x), end(x)};
+
+	// Zero padding on both sides, so the filter never reads outside the input
+	std::vector<float> padded(x.size() + 2 * m_taps, 0.f);
+	std::copy(begin(x), end(x), begin(padded) + m_taps);
+
+	std::vector<float> y(OutputSize(x.size()));
+	for(std::size_t n = 0; n < y.size(); n++)
+	{
+		// Position in the upsampled signal, compensated for the filter delay
+		std::uint64_t q = std::uint64_t(n) * m_down + m_delay;
+		std::size_t phase = q % m_up, base = q / m_up;
+		const float* h = &m_phases[phase * m_taps];
+		// y[n] = sum_k h[phase + k * up] * x[base - k]
+		y[n] = Dot(h, &padded[m_taps + base - (m_taps - 1)], m_taps);
+	}
+	return y;
+}
+
+
+} // namespace DSP
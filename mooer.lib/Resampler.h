@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+
+namespace DSP
+{
+
+/**
+Polyphase sample-rate converter, for a rational ratio between the rates.
+
+The anti-aliasing filter is a Kaiser-windowed sinc, cut off at the lower of the two Nyquist frequencies.
+*/
+class Resampler
+{
+public:
+	/// \p halfTaps: half the filter length per output sample, more gives a steeper cut-off
+	Resampler(std::uint32_t from, std::uint32_t to, int halfTaps = 32);
+
+	/// Resample a whole signal, the output is aligned with the input (no filter delay)
+	std::vector<float> Process(std::span<const float> x) const;
+
+	/// Number of output samples for \p n input samples
+	std::size_t OutputSize(std::size_t n) const;
+
+private:
+	std::uint32_t m_up, m_down;
+	int m_taps;					 ///< Per phase, a multiple of 4
+	int m_delay;				 ///< Of the filter, at the upsampled rate
+	std::vector<float> m_phases; ///< m_up filters of m_taps, each time-reversed
+};
+
+} // namespace DSP
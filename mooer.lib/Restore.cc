@@ -0,0 +1,295 @@
+#include <Restore.h>
+
+#include <algorithm>
+#include <numeric>
+#include <sstream>
+
+#include <FileView.h>
+#include <PresetDiff.h>
+
+
+namespace Mooer
+{
+
+namespace
+{
+
+constexpr std::size_t nrSlots = std::tuple_size_v<decltype(File::Mbf::presets)>;
+
+} // namespace
+
+
+File::Mbf ReadRestoreSource(const std::filesystem::path& path, const File::Mbf& current)
+{
+	if(!std::filesystem::is_directory(path))
+		return File::MappedMbf(path)->mbf();
+
+	std::vector<std::filesystem::path> files;
+	for(const auto& entry : std::filesystem::directory_iterator(path))
+	{
+		auto ext = entry.path().extension().string();
+		std::transform(begin(ext), end(ext), begin(ext), [](unsigned char c) { return std::tolower(c); });
+		if(entry.is_regular_file() && ext == ".mo")
+			files.push_back(entry.path());
+	}
+	if(files.size() > nrSlots)
+	{
+		std::stringstream ss;
+		ss << path << " holds " << files.size() << " presets, a backup at most " << nrSlots;
+		throw std::runtime_error(ss.str());
+	}
+	std::sort(begin(files), end(files));
+
+	File::Mbf mbf = current;
+	for(std::size_t slot = 0; slot < files.size(); slot++)
+		mbf.presets[slot].preset = File::MappedMo(files[slot])->mo().preset;
+	return mbf;
+}
+
+
+File::Mbf CurrentBackup(const DeviceFormat::State& state, std::string_view model)
+{
+	File::Mbf mbf = File::NewBackup(model);
+	for(std::size_t slot = 0; slot < nrSlots; slot++)
+		mbf.presets[slot].preset = state.savedPresets[slot];
+	return mbf;
+}
+
+
+//-- PresetRestore --
+
+PresetRestore::PresetRestore(Parser& parser, RestoreOptions options)
+	: m_parser(parser)
+	, m_options(std::move(options))
+	, m_readback(nrSlots)
+	, m_received(nrSlots, false)
+{
+}
+
+
+PresetRestore::Report PresetRestore::Run(const File::Mbf& device, const File::Mbf& target, int activePreset)
+{
+	const auto start = std::chrono::steady_clock::now();
+	Report report;
+
+	auto slots = UploadSet(device, target);
+	for(int slot = 0; slot < static_cast<int>(nrSlots); slot++)
+	{
+		if(!std::binary_search(begin(slots), end(slots), slot))
+			report.skipped.push_back(slot);
+	}
+
+	for(int attempt = 0; attempt < m_options.maxAttempts && !slots.empty(); attempt++)
+	{
+		auto lost = Upload(slots, target, report);
+		auto wrong = Verify(slots, target);
+
+		// Slots that are correct now, are restored
+		std::vector<int> again;
+		std::set_union(begin(lost), end(lost), begin(wrong), end(wrong), std::back_inserter(again));
+		std::set_difference(
+			begin(slots), end(slots), begin(again), end(again), std::back_inserter(report.restored));
+		slots = std::move(again);
+
+		std::lock_guard lock{m_mutex};
+		if(m_cancel)
+			break;
+	}
+	report.failed = slots;
+	std::sort(begin(report.restored), end(report.restored));
+
+	if(activePreset >= 0)
+		m_parser.SendPresetChange(activePreset);
+	report.wallTime = std::chrono::steady_clock::now() - start;
+	return report;
+}
+
+
+PresetRestore::Report PresetRestore::Load(const File::MO& mo, int activePreset)
+{
+	const auto start = std::chrono::steady_clock::now();
+	Report report;
+
+	bool equal = false;
+	for(int attempt = 0; attempt < m_options.maxAttempts && !equal; attempt++)
+	{
+		{
+			std::lock_guard lock{m_mutex};
+			if(m_cancel)
+				break;
+			m_active.reset();
+		}
+		const auto sent = std::chrono::steady_clock::now();
+		m_parser.LoadMoPreset(mo);
+		// The pedal sends the active patch along with all presets
+		m_parser.SendPatchListRequest();
+
+		std::unique_lock lock{m_mutex};
+		if(!m_cv.wait_for(lock, m_options.timeout, [&] { return m_active.has_value() || m_cancel; }))
+			continue;
+		if(m_active.has_value())
+		{
+			report.latency.push_back(std::chrono::steady_clock::now() - sent);
+			equal = !CompareBytes(*m_active, mo.preset).any();
+		}
+	}
+	(equal ? report.restored : report.failed).push_back(activePreset);
+	report.wallTime = std::chrono::steady_clock::now() - start;
+	return report;
+}
+
+
+std::vector<int> PresetRestore::Upload(const std::vector<int>& slots, const File::Mbf& target, Report& report)
+{
+	using Clock = std::chrono::steady_clock;
+	std::deque<std::pair<int, Clock::time_point>> inFlight;
+	std::vector<int> lost;
+	std::size_t next = 0, done = 0;
+
+	std::unique_lock lock{m_mutex};
+	m_acks.clear();
+	while((next < slots.size() || !inFlight.empty()) && !m_cancel)
+	{
+		// Keep the pipeline filled
+		while(next < slots.size() && inFlight.size() < std::max<std::size_t>(m_options.maxInFlight, 1))
+		{
+			const int slot = slots[next++];
+			lock.unlock();
+			File::MO mo{};
+			mo.preset = target.presets[slot].preset;
+			inFlight.emplace_back(slot, Clock::now());
+			m_parser.SendPresetChange(slot);
+			m_parser.LoadMoPreset(mo);
+			m_parser.StorePreset(slot, mo.preset.getName());
+			lock.lock();
+		}
+
+		if(!m_cv.wait_for(lock, m_options.timeout, [&] { return !m_acks.empty() || m_cancel; }))
+		{
+			// The oldest slot is not coming anymore
+			lost.push_back(inFlight.front().first);
+			inFlight.pop_front();
+			continue;
+		}
+
+		const auto now = Clock::now();
+		const auto before = done;
+		for(; !m_acks.empty(); m_acks.pop_front())
+		{
+			auto it = std::find_if(
+				begin(inFlight), end(inFlight), [&](const auto& f) { return f.first == m_acks.front(); });
+			if(it == end(inFlight))
+				continue;
+			report.latency.push_back(now - it->second);
+			inFlight.erase(it);
+			done++;
+		}
+		if(m_options.progress && done != before)
+		{
+			lock.unlock();
+			m_options.progress(done, slots.size());
+			lock.lock();
+		}
+	}
+	for(const auto& f : inFlight)
+		lost.push_back(f.first);
+	std::sort(begin(lost), end(lost));
+	return lost;
+}
+
+
+std::vector<int> PresetRestore::Verify(const std::vector<int>& slots, const File::Mbf& target)
+{
+	{
+		std::lock_guard lock{m_mutex};
+		std::fill(begin(m_received), end(m_received), false);
+		m_nrReceived = 0;
+		if(m_cancel)
+			return slots;
+	}
+	m_parser.SendPatchListRequest();
+
+	// Wait as long as the presets keep coming
+	std::unique_lock lock{m_mutex};
+	auto allReceived = [&]
+	{
+		return std::all_of(begin(slots), end(slots), [&](int slot) { return m_received[slot]; });
+	};
+	for(std::size_t count = ~std::size_t(0); !allReceived() && !m_cancel && count != m_nrReceived;)
+	{
+		count = m_nrReceived;
+		m_cv.wait_for(lock, m_options.timeout, [&] { return m_nrReceived != count || m_cancel; });
+	}
+
+	std::vector<int> wrong;
+	for(int slot : slots)
+	{
+		if(!m_received[slot] || CompareBytes(m_readback[slot], target.presets[slot].preset).any())
+			wrong.push_back(slot);
+	}
+	return wrong;
+}
+
+
+void PresetRestore::OnFrame(const RxFrame::Frame& frame)
+{
+	{
+		std::lock_guard lock{m_mutex};
+		if(frame.group() == RxFrame::ActivePatch && frame.index() >= 0)
+		{
+			m_acks.push_back(frame.index());
+		}
+		else if(frame.group() == RxFrame::PatchSetting || frame.group() == RxFrame::ActivePatchSetting)
+		{
+			auto data = frame.nochecksum_data();
+			if(data.size() != sizeof(File::PresetPadded) + 1 || data[0] >= m_readback.size())
+				return;
+			m_readback[data[0]] = data.subspan(1);
+			m_received[data[0]] = true;
+			m_nrReceived++;
+			if(frame.group() == RxFrame::ActivePatchSetting)
+				m_active = m_readback[data[0]];
+		}
+		else
+		{
+			return;
+		}
+	}
+	m_cv.notify_all();
+}
+
+
+void PresetRestore::Cancel()
+{
+	{
+		std::lock_guard lock{m_mutex};
+		m_cancel = true;
+	}
+	m_cv.notify_all();
+}
+
+
+void PresetRestore::Report::Print(std::ostream& os) const
+{
+	os << "Restored " << restored.size() << " presets, " << skipped.size() << " unchanged, " << failed.size()
+	   << " failed, in " << wallTime.count() << " s";
+	if(!latency.empty())
+	{
+		auto sorted = latency;
+		std::sort(begin(sorted), end(sorted));
+		auto mean = std::accumulate(begin(sorted), end(sorted), std::chrono::duration<double>()) / sorted.size();
+		os << ". Latency per slot: mean " << 1e3 * mean.count() << " ms, median "
+		   << 1e3 * sorted[sorted.size() / 2].count() << " ms, max " << 1e3 * sorted.back().count() << " ms";
+	}
+	os << '\n';
+	if(!failed.empty())
+	{
+		os << "Failed slots:";
+		for(int slot : failed)
+			os << ' ' << slot;
+		os << '\n';
+	}
+}
+
+
+} // namespace Mooer
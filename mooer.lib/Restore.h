@@ -0,0 +1,103 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include <MooerParser.h>
+
+
+namespace Mooer
+{
+
+/**
+Presets to restore, in slot order: an .mbf backup, or a directory of .mo files sorted by name.
+The files of a directory replace the first slots of \p current, the slots after them keep their preset.
+Throws if the directory holds more presets than a backup.
+*/
+File::Mbf ReadRestoreSource(const std::filesystem::path& path, const File::Mbf& current);
+
+/// A backup of the presets in \p state, to compare a restore against
+File::Mbf CurrentBackup(const DeviceFormat::State& state, std::string_view model);
+
+
+struct RestoreOptions
+{
+	std::size_t maxInFlight = 4; ///< Slots sent, but not acknowledged
+	int maxAttempts = 2;		 ///< Uploads of a slot that reads back wrong
+
+	/// Without any response of the pedal
+	std::chrono::milliseconds timeout = std::chrono::seconds(3);
+
+	/// Called after each acknowledge
+	std::function<void(std::size_t done, std::size_t total)> progress;
+};
+
+/**
+Restores a backup onto the pedal: only the slots that differ are uploaded, and all of them are verified.
+
+Each slot is selected, loaded and stored. The pedal acknowledges the selection of a slot,
+the next slots are sent while at most RestoreOptions::maxInFlight are not acknowledged yet.
+Afterwards all presets are read back, and only the slots that differ are restored again.
+
+Run() blocks, the Listener of the Parser has to pass the frames of the pedal to OnFrame() meanwhile.
+*/
+class PresetRestore
+{
+public:
+	struct Report
+	{
+		std::vector<int> restored; ///< Uploaded and verified
+		std::vector<int> skipped;  ///< Already equal
+		std::vector<int> failed;   ///< Not acknowledged, or different after all attempts
+		std::chrono::duration<double> wallTime{};
+		std::vector<std::chrono::duration<double>> latency; ///< From sending a slot to its acknowledge
+
+		void Print(std::ostream& os) const;
+	};
+
+	PresetRestore(Parser& parser, RestoreOptions options = {});
+
+	/// Make \p target of the pedal, which currently holds \p device, and select \p activePreset afterwards
+	Report Run(const File::Mbf& device, const File::Mbf& target, int activePreset);
+
+	/**
+	Load \p mo into the edit buffer of the pedal, which holds slot \p activePreset, without storing it.
+	The active patch is read back, and \p mo is sent again while it differs.
+	*/
+	Report Load(const File::MO& mo, int activePreset);
+
+	/// Pass RxFrame::ActivePatch, RxFrame::PatchSetting and RxFrame::ActivePatchSetting frames of the pedal
+	void OnFrame(const RxFrame::Frame& frame);
+
+	/// Stop Run() at the next slot
+	void Cancel();
+
+private:
+	/// Upload \p slots, returns those that were not acknowledged
+	std::vector<int> Upload(const std::vector<int>& slots, const File::Mbf& target, Report& report);
+
+	/// Read all presets back, returns the \p slots that differ from \p target
+	std::vector<int> Verify(const std::vector<int>& slots, const File::Mbf& target);
+
+	Parser& m_parser;
+	RestoreOptions m_options;
+
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_cancel = false;
+	std::deque<int> m_acks;						///< Slots acknowledged by the pedal, not processed yet
+	std::vector<File::PresetPadded> m_readback; ///< Presets read back, per slot
+	std::vector<bool> m_received;				///< Slots of m_readback that were read back
+	std::size_t m_nrReceived = 0;
+	std::optional<File::PresetPadded> m_active; ///< Edit buffer, as read back by RxFrame::ActivePatchSetting
+};
+
+} // namespace Mooer
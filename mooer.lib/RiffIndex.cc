@@ -0,0 +1,519 @@
+#include <RiffIndex.h>
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <type_traits>
+
+#include <Parallel.h>
+
+
+namespace GuitarPro
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+constexpr std::array<char, 8> g_indexMagic = {'M', 'O', 'O', 'E', 'R', 'R', 'I', 'F'};
+constexpr std::uint32_t g_indexVersion = 1;
+
+/// Files that are read in parallel before their n-grams are added, which bounds the memory of an update
+constexpr std::size_t g_batchSize = 256;
+
+/// Longest path in an index file, a longer one means it is corrupt
+constexpr std::uint32_t g_maxPath = 1 << 16;
+
+/// Range of the differences in an n-gram key, larger ones are clamped
+constexpr int g_maxStringStep = 7;
+constexpr int g_maxFretStep = 31;
+
+
+/// The path as it is stored in an index, which is also how files are matched to library entries
+std::string PathKey(const fs::path& fn)
+{
+	const auto path = fn.generic_u8string();
+	return std::string(begin(path), end(path));
+}
+
+
+/// Key of the n-gram at \p notes: the string and fret of each note after the first, relative to the first
+std::uint32_t GramKey(std::span<const RiffIndex::Note> notes)
+{
+	std::uint32_t key = 0;
+	for(std::size_t i = 1; i < RiffIndex::g_gramSize; i++)
+	{
+		const int ds = std::clamp(notes[i].string - notes[0].string, -g_maxStringStep, g_maxStringStep);
+		const int df = std::clamp(notes[i].fret - notes[0].fret, -g_maxFretStep, g_maxFretStep);
+		key = (key << 10) | ((ds + g_maxStringStep) << 6) | (df + g_maxFretStep);
+	}
+	return key;
+}
+
+
+/// The n-grams of \p sequence as (key << 32 | position), ordered
+std::vector<std::uint64_t> Grams(std::span<const RiffIndex::Note> sequence)
+{
+	std::vector<std::uint64_t> r;
+	for(std::size_t p = 0; p + RiffIndex::g_gramSize <= sequence.size(); p++)
+		r.push_back(static_cast<std::uint64_t>(GramKey(sequence.subspan(p))) << 32 | p);
+	std::sort(begin(r), end(r));
+	return r;
+}
+
+
+void PutVarint(std::vector<std::uint8_t>& dst, std::uint32_t v)
+{
+	for(; v >= 0x80; v >>= 7)
+		dst.push_back(static_cast<std::uint8_t>(v | 0x80));
+	dst.push_back(static_cast<std::uint8_t>(v));
+}
+
+
+std::uint32_t GetVarint(const std::uint8_t*& p, const std::uint8_t* end)
+{
+	std::uint32_t v = 0;
+	for(int shift = 0; shift < 35; shift += 7)
+	{
+		if(p == end)
+			break;
+		const std::uint8_t b = *p++;
+		v |= static_cast<std::uint32_t>(b & 0x7F) << shift;
+		if((b & 0x80) == 0)
+			return v;
+	}
+	throw std::runtime_error("RiffIndex: posting list is corrupt");
+}
+
+
+/// Where a riff can start: a document, and a position in it
+struct Hit
+{
+	std::uint32_t document;
+	std::uint32_t start;
+
+	auto operator<=>(const Hit&) const = default;
+};
+
+
+/// Pass each document of \p data to \p f, with its positions as they are decoded
+template<typename F>
+void Decode(std::span<const std::uint8_t> data, F&& f)
+{
+	const std::uint8_t* p = data.data();
+	const std::uint8_t* end = p + data.size();
+	std::uint32_t document = 0;
+	while(p != end)
+	{
+		document += GetVarint(p, end);
+		const auto n = GetVarint(p, end);
+		std::uint32_t position = 0;
+		for(std::uint32_t i = 0; i < n; i++)
+		{
+			position += GetVarint(p, end);
+			f(document, position);
+		}
+	}
+}
+
+
+template<typename T>
+void write(std::ostream& os, const T& v)
+{
+	static_assert(std::is_trivially_copyable_v<T>);
+	os.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+
+template<typename T>
+T read(std::istream& is)
+{
+	static_assert(std::is_trivially_copyable_v<T>);
+	T v;
+	is.read(reinterpret_cast<char*>(&v), sizeof(T));
+	if(!is)
+		throw std::runtime_error("RiffIndex: index file is truncated");
+	return v;
+}
+
+
+/// A size, throws if it is larger than \p max
+std::uint32_t readSize(std::istream& is, std::uint64_t max)
+{
+	const auto n = read<std::uint32_t>(is);
+	if(n > max)
+		throw std::runtime_error("RiffIndex: index file is corrupt");
+	return n;
+}
+
+} // namespace
+
+
+std::vector<RiffIndex::Note> RiffIndex::Sequence(const GPIF& score, int track)
+{
+	std::vector<Note> r;
+	for(int bar = 0; bar < score.nrBars(); bar++)
+	{
+		score.visitNotes(
+			track,
+			bar,
+			[](Clef) {},
+			[&](Clef, const GPIF::Rhythm&, std::span<const GPIF::Note> notes)
+			{
+				// The melody of a chord is on its highest string
+				auto top = std::max_element(
+					begin(notes), end(notes), [](const GPIF::Note& a, const GPIF::Note& b) { return a.string < b.string; });
+				if(top != end(notes))
+					r.push_back(Note{top->string, top->fret});
+			});
+	}
+	return r;
+}
+
+
+RiffIndex::UpdateStatistics RiffIndex::Update(const TabLibrary& library)
+{
+	UpdateStatistics stats;
+
+	// Files that are gone or changed lose their documents, the changed ones are indexed again below
+	std::unordered_map<std::string, std::uint32_t> indexed;
+	for(std::uint32_t f = 0; f < m_files.size(); f++)
+	{
+		if(!m_files[f].removed)
+			indexed[PathKey(m_files[f].path)] = f;
+	}
+	std::vector<const TabLibrary::Entry*> toRead;
+	for(const auto& e : library.entries())
+	{
+		auto it = indexed.find(PathKey(e.path));
+		if(it != indexed.end())
+		{
+			const bool changed = m_files[it->second].hash != e.hash;
+			if(!changed)
+			{
+				indexed.erase(it);
+				continue;
+			}
+		}
+		toRead.push_back(&e);
+	}
+	for(const auto& [path, f] : indexed)
+	{
+		m_files[f].removed = true;
+		m_nrRemovedDocuments += m_files[f].nrDocuments;
+		stats.nrRemoved++;
+	}
+
+	struct Read
+	{
+		std::vector<std::vector<std::uint64_t>> tracks; ///< Grams()
+		bool valid;
+	};
+	for(std::size_t first = 0; first < toRead.size(); first += g_batchSize)
+	{
+		const auto batch = std::span(toRead).subspan(first, std::min(g_batchSize, toRead.size() - first));
+		std::vector<Read> reads(batch.size());
+		// Each file is parsed on a single thread, Parallel::For() does not nest
+		Parallel::For(batch.size(),
+					  [&](std::size_t n)
+					  {
+						  try
+						  {
+							  const GPIF score = TabLibrary::ReadScore(batch[n]->path, batch[n]->format);
+							  for(int t = 0; t < score.nrTracks(); t++)
+								  reads[n].tracks.push_back(Grams(Sequence(score, t)));
+							  reads[n].valid = true;
+						  }
+						  catch(std::exception&)
+						  {
+							  reads[n].valid = false;
+						  }
+					  });
+
+		// Document ids only grow, so the posting lists are appended to
+		for(std::size_t n = 0; n < batch.size(); n++)
+		{
+			if(!reads[n].valid)
+			{
+				stats.nrFailed++;
+				continue;
+			}
+			stats.nrRead++;
+			const auto file = static_cast<std::uint32_t>(m_files.size());
+			m_files.push_back(FileEntry{batch[n]->path,
+										batch[n]->hash,
+										static_cast<std::uint32_t>(m_documents.size()),
+										static_cast<std::uint32_t>(reads[n].tracks.size()),
+										false});
+			for(std::uint32_t t = 0; t < reads[n].tracks.size(); t++)
+			{
+				AddDocument(m_documents.size(), reads[n].tracks[t]);
+				m_documents.push_back(Document{file, t});
+			}
+		}
+	}
+
+	if(2 * m_nrRemovedDocuments > m_documents.size())
+		Compact();
+	stats.nrFiles = std::count_if(begin(m_files), end(m_files), [](const FileEntry& f) { return !f.removed; });
+	return stats;
+}
+
+
+std::vector<RiffIndex::Match> RiffIndex::Find(std::span<const Note> riff) const
+{
+	if(riff.size() < g_gramSize)
+		throw std::runtime_error("RiffIndex: a riff needs at least " + std::to_string(g_gramSize) + " notes");
+
+	// The n-grams of the riff, the rarest first, each with its offset in the riff
+	std::vector<std::pair<const PostingList*, std::uint32_t>> grams;
+	for(std::size_t p = 0; p + g_gramSize <= riff.size(); p++)
+	{
+		auto it = m_postings.find(GramKey(riff.subspan(p)));
+		if(it == m_postings.end())
+			return {};
+		grams.emplace_back(&it->second, static_cast<std::uint32_t>(p));
+	}
+	std::sort(begin(grams),
+			  end(grams),
+			  [](auto& a, auto& b) { return a.first->data.size() < b.first->data.size(); });
+
+	// Where the riff can start: every n-gram has to be at its offset from there
+	std::vector<Hit> hits, next, common;
+	for(std::size_t g = 0; g < grams.size(); g++)
+	{
+		const auto [list, offset] = grams[g];
+		next.clear();
+		Decode(list->data,
+			   [&](std::uint32_t document, std::uint32_t position)
+			   {
+				   if(position >= offset)
+					   next.push_back(Hit{document, position - offset});
+			   });
+		if(g == 0)
+			std::swap(hits, next);
+		else
+		{
+			common.clear();
+			std::set_intersection(begin(hits), end(hits), begin(next), end(next), std::back_inserter(common));
+			std::swap(hits, common);
+		}
+		if(hits.empty())
+			return {};
+	}
+
+	std::vector<Match> r;
+	for(const Hit& h : hits)
+	{
+		const Document& d = m_documents.at(h.document);
+		if(!m_files.at(d.file).removed)
+			r.push_back(Match{d.file, static_cast<int>(d.track), static_cast<int>(h.start)});
+	}
+	return r;
+}
+
+
+void RiffIndex::AddDocument(std::uint32_t document, std::span<const std::uint64_t> grams)
+{
+	for(std::size_t i = 0; i < grams.size();)
+	{
+		const auto key = static_cast<std::uint32_t>(grams[i] >> 32);
+		std::size_t j = i;
+		while(j < grams.size() && (grams[j] >> 32) == key)
+			j++;
+
+		PostingList& list = m_postings[key];
+		PutVarint(list.data, document - list.lastDocument);
+		PutVarint(list.data, static_cast<std::uint32_t>(j - i));
+		std::uint32_t previous = 0;
+		for(; i < j; i++)
+		{
+			const auto position = static_cast<std::uint32_t>(grams[i]);
+			PutVarint(list.data, position - previous);
+			previous = position;
+		}
+		list.lastDocument = document;
+		list.nrDocuments++;
+	}
+}
+
+
+void RiffIndex::Compact()
+{
+	constexpr auto none = std::numeric_limits<std::uint32_t>::max();
+
+	std::vector<std::uint32_t> documentIds(m_documents.size(), none);
+	std::vector<FileEntry> files;
+	std::vector<Document> documents;
+	for(auto& f : m_files)
+	{
+		if(f.removed)
+			continue;
+		const auto file = static_cast<std::uint32_t>(files.size());
+		for(std::uint32_t d = f.firstDocument; d < f.firstDocument + f.nrDocuments; d++)
+		{
+			documentIds[d] = documents.size();
+			documents.push_back(Document{file, m_documents[d].track});
+		}
+		f.firstDocument = documentIds[f.firstDocument];
+		files.push_back(std::move(f));
+	}
+
+	// The order of the documents is kept, so the lists stay ordered
+	std::unordered_map<std::uint32_t, PostingList> postings;
+	std::vector<std::uint64_t> grams;
+	for(const auto& [key, list] : m_postings)
+	{
+		PostingList compacted;
+		std::uint32_t current = none;
+		auto flush = [&]
+		{
+			if(current == none)
+				return;
+			PutVarint(compacted.data, current - compacted.lastDocument);
+			PutVarint(compacted.data, static_cast<std::uint32_t>(grams.size()));
+			std::uint32_t previous = 0;
+			for(auto position : grams)
+			{
+				PutVarint(compacted.data, static_cast<std::uint32_t>(position) - previous);
+				previous = static_cast<std::uint32_t>(position);
+			}
+			compacted.lastDocument = current;
+			compacted.nrDocuments++;
+			grams.clear();
+		};
+		Decode(list.data,
+			   [&](std::uint32_t document, std::uint32_t position)
+			   {
+				   const auto id = documentIds.at(document);
+				   if(id == none)
+					   return;
+				   if(id != current)
+				   {
+					   flush();
+					   current = id;
+				   }
+				   grams.push_back(position);
+			   });
+		flush();
+		if(compacted.nrDocuments > 0)
+			postings.emplace(key, std::move(compacted));
+	}
+
+	m_files = std::move(files);
+	m_documents = std::move(documents);
+	m_postings = std::move(postings);
+	m_nrRemovedDocuments = 0;
+}
+
+
+void RiffIndex::Save(const std::filesystem::path& fn) const
+{
+	std::ofstream f(fn, std::ios::binary);
+	if(!f)
+		throw std::runtime_error("RiffIndex: could not write " + fn.string());
+
+	write(f, g_indexMagic);
+	write(f, g_indexVersion);
+	write<std::uint32_t>(f, m_files.size());
+	for(const auto& file : m_files)
+	{
+		const auto path = PathKey(file.path);
+		write(f, file.hash);
+		write(f, file.firstDocument);
+		write(f, file.nrDocuments);
+		write<std::uint8_t>(f, file.removed ? 1 : 0);
+		write<std::uint32_t>(f, path.size());
+		f.write(path.data(), path.size());
+	}
+	write<std::uint32_t>(f, m_documents.size());
+	f.write(reinterpret_cast<const char*>(m_documents.data()), m_documents.size() * sizeof(Document));
+	write<std::uint32_t>(f, m_postings.size());
+	for(const auto& [key, list] : m_postings)
+	{
+		write(f, key);
+		write(f, list.lastDocument);
+		write(f, list.nrDocuments);
+		write<std::uint32_t>(f, list.data.size());
+		f.write(reinterpret_cast<const char*>(list.data.data()), list.data.size());
+	}
+	if(!f)
+		throw std::runtime_error("RiffIndex: could not write " + fn.string());
+}
+
+
+void RiffIndex::Load(const std::filesystem::path& fn)
+{
+	std::ifstream f(fn, std::ios::binary);
+	if(!f)
+		throw std::runtime_error("RiffIndex: could not open " + fn.string());
+	const auto fileSize = fs::file_size(fn); // A posting list can not be larger
+
+	if(read<std::array<char, 8>>(f) != g_indexMagic)
+		throw std::runtime_error("RiffIndex: not an index file");
+	if(auto version = read<std::uint32_t>(f); version != g_indexVersion)
+	{
+		std::stringstream ss;
+		ss << "RiffIndex: index version " << version << " is not supported";
+		throw std::runtime_error(ss.str());
+	}
+
+	// Counts are not trusted to reserve, a corrupt one fails at the end of the file
+	std::vector<FileEntry> files;
+	for(auto n = read<std::uint32_t>(f); n > 0; n--)
+	{
+		FileEntry& file = files.emplace_back();
+		file.hash = read<std::uint64_t>(f);
+		file.firstDocument = read<std::uint32_t>(f);
+		file.nrDocuments = read<std::uint32_t>(f);
+		file.removed = read<std::uint8_t>(f) != 0;
+		std::u8string path(readSize(f, g_maxPath), '\0');
+		f.read(reinterpret_cast<char*>(path.data()), path.size());
+		if(!f)
+			throw std::runtime_error("RiffIndex: index file is truncated");
+		file.path = path;
+	}
+	std::vector<Document> documents;
+	for(auto n = read<std::uint32_t>(f); n > 0; n--)
+		documents.push_back(read<Document>(f));
+	std::uint32_t nrRemoved = 0;
+	for(std::uint32_t i = 0; i < files.size(); i++)
+	{
+		const FileEntry& file = files[i];
+		if(file.firstDocument > documents.size() || file.nrDocuments > documents.size() - file.firstDocument)
+			throw std::runtime_error("RiffIndex: index file is corrupt");
+		if(file.removed)
+			nrRemoved += file.nrDocuments;
+	}
+	for(const Document& d : documents)
+	{
+		if(d.file >= files.size())
+			throw std::runtime_error("RiffIndex: index file is corrupt");
+	}
+
+	std::unordered_map<std::uint32_t, PostingList> postings;
+	for(auto n = read<std::uint32_t>(f); n > 0; n--)
+	{
+		const auto key = read<std::uint32_t>(f);
+		PostingList& list = postings[key];
+		list.lastDocument = read<std::uint32_t>(f);
+		list.nrDocuments = read<std::uint32_t>(f);
+		list.data.resize(readSize(f, fileSize));
+		f.read(reinterpret_cast<char*>(list.data.data()), list.data.size());
+		if(!f)
+			throw std::runtime_error("RiffIndex: index file is truncated");
+		if(list.lastDocument >= documents.size())
+			throw std::runtime_error("RiffIndex: index file is corrupt");
+	}
+
+	m_files = std::move(files);
+	m_documents = std::move(documents);
+	m_postings = std::move(postings);
+	m_nrRemovedDocuments = nrRemoved;
+}
+
+} // namespace GuitarPro
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include <TabLibrary.h>
+
+
+namespace GuitarPro
+{
+
+/**
+Index of the note sequences of the tracks in a TabLibrary, to find riffs.
+
+The sequence of a track has a note per beat with notes, the one on the highest string, in the order of
+GPIF::visitNotes(). Every n-gram of g_gramSize notes is stored relative to its first note: the differences in string
+and fret. So a riff is found wherever the same shape is played: moved along the neck, or moved to other strings with
+the same fingering. Pitches are not compared, a riff on other strings that needs another fingering is not found.
+
+Each n-gram has a posting list of the tracks and positions where it occurs, compressed as variable-length
+differences. A riff is looked up by intersecting the lists of its n-grams at matching positions.
+Files that change are indexed again under new ids, the old ids are dropped once they are the majority.
+*/
+class RiffIndex
+{
+public:
+	/// Number of notes in an n-gram, a riff has at least this many
+	static constexpr std::size_t g_gramSize = 4;
+
+	struct Note
+	{
+		int string; ///< 0-based, from the lowest, as GPIF::Note
+		int fret;
+	};
+
+	struct FileEntry
+	{
+		std::filesystem::path path;
+		std::uint64_t hash; ///< As TabLibrary::Entry::hash
+		std::uint32_t firstDocument, nrDocuments; ///< One document per track
+		bool removed;
+	};
+
+	struct Match
+	{
+		std::uint32_t file; ///< Index into files()
+		int track;
+		int position; ///< Of the first note in the sequence of the track
+	};
+
+	struct UpdateStatistics
+	{
+		int nrFiles = 0;   ///< Files in the index
+		int nrRead = 0;	   ///< Files that were (re-)indexed
+		int nrFailed = 0;  ///< Files that could not be read
+		int nrRemoved = 0; ///< Files that are no longer in the library, or changed
+	};
+
+	/// The note sequence of \p track
+	static std::vector<Note> Sequence(const GPIF& score, int track);
+
+	/// Index the files of \p library that are new or changed, and drop the ones that are gone
+	UpdateStatistics Update(const TabLibrary& library);
+
+	/// All places where the shape of \p riff is played. Throws if it is shorter than an n-gram.
+	std::vector<Match> Find(std::span<const Note> riff) const;
+
+	void Save(const std::filesystem::path& fn) const;
+
+	void Load(const std::filesystem::path& fn);
+
+	/// Also has the removed files, until they are compacted
+	const std::vector<FileEntry>& files() const
+	{
+		return m_files;
+	}
+
+private:
+	struct Document
+	{
+		std::uint32_t file;
+		std::uint32_t track;
+	};
+
+	struct PostingList
+	{
+		std::vector<std::uint8_t> data; ///< Per document: its id minus the previous, the number of positions, positions
+		std::uint32_t lastDocument = 0;
+		std::uint32_t nrDocuments = 0;
+	};
+
+	/// Add the n-grams of a new document, \p grams are (key << 32 | position) in order
+	void AddDocument(std::uint32_t document, std::span<const std::uint64_t> grams);
+
+	/// Renumber the files and documents without the removed ones
+	void Compact();
+
+	std::vector<FileEntry> m_files;
+	std::vector<Document> m_documents;
+	std::uint32_t m_nrRemovedDocuments = 0;
+	std::unordered_map<std::uint32_t, PostingList> m_postings; ///< By n-gram key
+};
+
+} // namespace GuitarPro
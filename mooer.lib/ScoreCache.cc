@@ -0,0 +1,371 @@
+#include <ScoreCache.h>
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <type_traits>
+
+#include <MappedFile.h>
+
+
+namespace GuitarPro
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+constexpr std::array<char, 8> g_cacheMagic = {'M', 'O', 'O', 'E', 'R', 'G', 'P', 'C'};
+constexpr std::uint32_t g_cacheVersion = 1;
+constexpr std::uint32_t g_byteOrder = 0x01020304;
+constexpr std::size_t g_columnAlignment = 8;
+
+/// The arrays in a cache file, in the order they are written
+enum class Column
+{
+	Tracks,
+	MasterBars,
+	MasterBarBarsOffsets,
+	MasterBarBarsValues,
+	Bars,
+	BarVoicesOffsets,
+	BarVoicesValues,
+	VoiceBeatsOffsets,
+	VoiceBeatsValues,
+	Beats,
+	BeatNotes,
+	Notes,
+	Rhythms,
+	PitchSteps,
+	Text,
+	Count
+};
+
+/// Part of the Text column
+struct TextRange
+{
+	std::uint32_t offset, size;
+};
+
+struct TrackRecord
+{
+	TextRange name;
+	std::uint8_t palmMute;
+	std::uint8_t reserved[3];
+};
+
+struct ColumnRange
+{
+	std::uint64_t offset; ///< In bytes, from the start of the file
+	std::uint64_t count;  ///< Of elements
+};
+
+struct Header
+{
+	std::array<char, 8> magic;
+	std::uint32_t version;
+	std::uint32_t byteOrder;
+	ScoreCache::Key key;
+	TextRange source; ///< Path of the score
+	TextRange gpVersion;
+	std::int32_t revision;
+	std::uint32_t reserved;
+	std::array<ColumnRange, static_cast<int>(Column::Count)> columns;
+};
+
+static_assert(std::is_trivially_copyable_v<GPIF::MasterBar> && sizeof(GPIF::MasterBar) == 8);
+static_assert(std::is_trivially_copyable_v<GPIF::Bar> && sizeof(GPIF::Bar) == 1);
+static_assert(std::is_trivially_copyable_v<GPIF::Beat> && sizeof(GPIF::Beat) == 8);
+static_assert(std::is_trivially_copyable_v<GPIF::Note> && sizeof(GPIF::Note) == 4);
+static_assert(std::is_trivially_copyable_v<GPIF::Rhythm> && sizeof(GPIF::Rhythm) == 2);
+
+
+std::string SourceName(const fs::path& fn)
+{
+	auto name = fs::absolute(fn).lexically_normal().generic_u8string();
+	return std::string(begin(name), end(name));
+}
+
+
+/// Size and modification time of \p fn, without the hash
+std::optional<ScoreCache::Key> Stat(const fs::path& fn)
+{
+	std::error_code ec;
+	ScoreCache::Key key{};
+	key.size = fs::file_size(fn, ec);
+	if(ec)
+		return {};
+	key.mtime = fs::last_write_time(fn, ec).time_since_epoch().count();
+	if(ec)
+		return {};
+	return key;
+}
+
+
+/// The header of \p file, nullptr if it is not a cache file of this version
+const Header* GetHeader(std::span<const std::uint8_t> file)
+{
+	if(file.size() < sizeof(Header))
+		return nullptr;
+	auto h = reinterpret_cast<const Header*>(file.data());
+	if(h->magic != g_cacheMagic || h->version != g_cacheVersion || h->byteOrder != g_byteOrder)
+		return nullptr;
+	return h;
+}
+
+
+/// Elements of column \p c, throws if they are not inside \p file
+template<typename T>
+std::span<const T> GetColumn(std::span<const std::uint8_t> file, const Header& h, Column c)
+{
+	const ColumnRange& r = h.columns[static_cast<int>(c)];
+	if(r.offset % alignof(T) != 0 || r.offset > file.size() || r.count > (file.size() - r.offset) / sizeof(T))
+		throw std::runtime_error("ScoreCache: file is corrupt");
+	return {reinterpret_cast<const T*>(file.data() + r.offset), r.count};
+}
+
+
+std::string_view GetText(std::span<const char> text, TextRange r)
+{
+	if(r.offset > text.size() || r.size > text.size() - r.offset)
+		throw std::runtime_error("ScoreCache: file is corrupt");
+	return {text.data() + r.offset, r.size};
+}
+
+
+/// \p offsets do not decrease, and end at \p size
+bool IsMonotonic(std::span<const std::uint32_t> offsets, std::size_t size)
+{
+	return !offsets.empty() && offsets.back() == size && std::ranges::is_sorted(offsets);
+}
+
+
+/// All \p values are in [min, end)
+bool InRange(std::span<const int> values, int min, std::size_t end)
+{
+	return std::ranges::all_of(values, [&](int v) { return v >= min && (v < 0 || static_cast<std::size_t>(v) < end); });
+}
+
+
+IndexListsView GetIndexLists(std::span<const std::uint8_t> file, const Header& h, Column offsets, Column values)
+{
+	IndexListsView r(GetColumn<std::uint32_t>(file, h, offsets), GetColumn<int>(file, h, values));
+	if(!IsMonotonic(r.offsets, r.values.size()))
+		throw std::runtime_error("ScoreCache: file is corrupt");
+	return r;
+}
+
+} // namespace
+
+
+ScoreCache::ScoreCache(std::filesystem::path directory)
+	: m_directory(std::move(directory))
+{
+}
+
+
+GPIF ScoreCache::Load(const std::filesystem::path& fn) const
+{
+	if(auto score = Find(fn))
+		return *score;
+
+	IO::MappedFile file(fn);
+	auto key = Stat(fn);
+	if(!key)
+		throw std::runtime_error("ScoreCache: could not read " + fn.string());
+	const auto data = std::span(reinterpret_cast<const char*>(file.data().data()), file.size());
+	GPIF score = ReaderV345::isValid(data) ? ReaderV345::Read(data)
+				 : ReaderV6::isValid(data)	 ? ReaderV6::Read(data)
+											 : ReaderV78::Read(data);
+	key->hash = IO::Hash64(file.data());
+	try
+	{
+		Store(fn, score, *key);
+	}
+	catch(std::exception&)
+	{
+		// The cache only speeds up the next load, this one succeeded
+	}
+	return score;
+}
+
+
+std::optional<GPIF> ScoreCache::Find(const std::filesystem::path& fn) const
+{
+	struct Storage
+	{
+		IO::MappedFile file;
+		std::vector<GPIF::Track> tracks;
+		std::vector<std::string_view> pitchSteps;
+	};
+
+	const auto key = Stat(fn);
+	const auto cacheFile = CacheFile(fn);
+	std::error_code ec;
+	if(!key || !fs::is_regular_file(cacheFile, ec))
+		return {};
+
+	try
+	{
+		auto storage = std::make_shared<Storage>();
+		storage->file = IO::MappedFile(cacheFile);
+		const auto data = storage->file.data();
+		const Header* h = GetHeader(data);
+		if(h == nullptr)
+			return {};
+		const auto text = GetColumn<char>(data, *h, Column::Text);
+		if(GetText(text, h->source) != SourceName(fn))
+			return {};
+		if(key->size != h->key.size || key->mtime != h->key.mtime)
+		{
+			// Touched or copied, it can still have the same contents
+			IO::MappedFile source(fn);
+			if(source.size() != h->key.size || IO::Hash64(source.data()) != h->key.hash)
+				return {};
+		}
+
+		// Only the names are copied, the tables are used where they are mapped
+		for(const auto& t : GetColumn<TrackRecord>(data, *h, Column::Tracks))
+			storage->tracks.push_back(GPIF::Track{GetText(text, t.name), t.palmMute != 0});
+		for(auto step : GetColumn<TextRange>(data, *h, Column::PitchSteps))
+			storage->pitchSteps.push_back(GetText(text, step));
+
+		GPIF score;
+		score.version = GetText(text, h->gpVersion);
+		score.revision = h->revision;
+		score.tracks = storage->tracks;
+		score.masterBars = GetColumn<GPIF::MasterBar>(data, *h, Column::MasterBars);
+		score.masterBarBars = GetIndexLists(data, *h, Column::MasterBarBarsOffsets, Column::MasterBarBarsValues);
+		score.bars = GetColumn<GPIF::Bar>(data, *h, Column::Bars);
+		score.barVoices = GetIndexLists(data, *h, Column::BarVoicesOffsets, Column::BarVoicesValues);
+		score.voiceBeats = GetIndexLists(data, *h, Column::VoiceBeatsOffsets, Column::VoiceBeatsValues);
+		score.beats = GetColumn<GPIF::Beat>(data, *h, Column::Beats);
+		score.beatNotes = GetColumn<std::uint32_t>(data, *h, Column::BeatNotes);
+		score.notes = GetColumn<GPIF::Note>(data, *h, Column::Notes);
+		score.rhythms = GetColumn<GPIF::Rhythm>(data, *h, Column::Rhythms);
+		score.pitchSteps = storage->pitchSteps;
+
+		// visitNotes() only checks the indices into the tables, the lists have to be in range
+		if(score.beatNotes.size() != score.beats.size() + 1 || !IsMonotonic(score.beatNotes, score.notes.size()))
+			return {};
+		if(score.masterBarBars.size() < score.masterBars.size()
+		   || !InRange(score.masterBarBars.values, 0, std::min(score.bars.size(), score.barVoices.size()))
+		   || !InRange(score.barVoices.values, -1, score.voiceBeats.size())
+		   || !InRange(score.voiceBeats.values, 0, score.beats.size()))
+			return {};
+		for(std::size_t i = 0; i < score.masterBarBars.size(); i++)
+		{
+			if(score.masterBarBars[i].size() < score.tracks.size())
+				return {};
+		}
+		score.m_storage = std::move(storage);
+		return score;
+	}
+	catch(std::runtime_error&)
+	{
+		return {};
+	}
+}
+
+
+void ScoreCache::Store(const std::filesystem::path& fn, const GPIF& score, const Key& key) const
+{
+	std::string text;
+	auto addText = [&text](std::string_view s)
+	{
+		TextRange r{static_cast<std::uint32_t>(text.size()), static_cast<std::uint32_t>(s.size())};
+		text += s;
+		return r;
+	};
+
+	Header h{};
+	h.magic = g_cacheMagic;
+	h.version = g_cacheVersion;
+	h.byteOrder = g_byteOrder;
+	h.key = key;
+	h.source = addText(SourceName(fn));
+	h.gpVersion = addText(score.version);
+	h.revision = score.revision;
+
+	std::vector<TrackRecord> tracks;
+	for(const auto& t : score.tracks)
+		tracks.push_back(TrackRecord{addText(t.name), static_cast<std::uint8_t>(t.palmMute ? 1 : 0), {}});
+	std::vector<TextRange> pitchSteps;
+	for(auto step : score.pitchSteps)
+		pitchSteps.push_back(addText(step));
+
+	fs::create_directories(m_directory);
+	const auto dst = CacheFile(fn);
+	std::stringstream tmpName;
+	tmpName << '.' << std::hex << std::random_device{}() << ".tmp";
+	auto tmp = dst;
+	tmp += tmpName.str(); // Unique, for other threads and processes that store the same score
+	std::error_code ec;
+	{
+		std::ofstream f(tmp, std::ios::binary);
+		if(!f)
+			throw std::runtime_error("ScoreCache: could not write " + tmp.string());
+
+		std::uint64_t offset = sizeof(Header);
+		f.write(reinterpret_cast<const char*>(&h), sizeof(h));
+		auto column = [&]<typename T>(Column c, std::span<const T> elements)
+		{
+			constexpr std::array<char, g_columnAlignment> padding{};
+			const auto pad = (g_columnAlignment - offset % g_columnAlignment) % g_columnAlignment;
+			f.write(padding.data(), pad);
+			offset += pad;
+			h.columns[static_cast<int>(c)] = {offset, elements.size()};
+			f.write(reinterpret_cast<const char*>(elements.data()), elements.size_bytes());
+			offset += elements.size_bytes();
+		};
+		column(Column::Tracks, std::span<const TrackRecord>(tracks));
+		column(Column::MasterBars, score.masterBars);
+		column(Column::MasterBarBarsOffsets, score.masterBarBars.offsets);
+		column(Column::MasterBarBarsValues, score.masterBarBars.values);
+		column(Column::Bars, score.bars);
+		column(Column::BarVoicesOffsets, score.barVoices.offsets);
+		column(Column::BarVoicesValues, score.barVoices.values);
+		column(Column::VoiceBeatsOffsets, score.voiceBeats.offsets);
+		column(Column::VoiceBeatsValues, score.voiceBeats.values);
+		column(Column::Beats, score.beats);
+		column(Column::BeatNotes, score.beatNotes);
+		column(Column::Notes, score.notes);
+		column(Column::Rhythms, score.rhythms);
+		column(Column::PitchSteps, std::span<const TextRange>(pitchSteps));
+		column(Column::Text, std::span<const char>(text));
+
+		// The column ranges are known now
+		f.seekp(0);
+		f.write(reinterpret_cast<const char*>(&h), sizeof(h));
+		f.close();
+		if(!f)
+		{
+			fs::remove(tmp, ec);
+			throw std::runtime_error("ScoreCache: could not write " + tmp.string());
+		}
+	}
+	// On POSIX, a reader that has the old file mapped keeps it. Windows does not replace a mapped file,
+	// the old one then stays until a later Store(), and Find() only uses it while its key matches.
+	fs::rename(tmp, dst, ec);
+	if(ec)
+	{
+		fs::remove(tmp, ec);
+		throw std::runtime_error("ScoreCache: could not replace " + dst.string());
+	}
+}
+
+
+std::filesystem::path ScoreCache::CacheFile(const std::filesystem::path& fn) const
+{
+	const auto source = SourceName(fn);
+	const auto hash = IO::Hash64(std::span(reinterpret_cast<const std::uint8_t*>(source.data()), source.size()));
+	std::stringstream ss;
+	ss << std::hex << std::setw(16) << std::setfill('0') << hash << ".gpc";
+	return m_directory / ss.str();
+}
+
+} // namespace GuitarPro
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+#include <GuitarPro.h>
+
+
+namespace GuitarPro
+{
+
+/**
+Cache of parsed scores, one file per score in a directory.
+
+A cache file holds the tables of a GPIF as arrays, which are memory-mapped and viewed in place,
+so loading a score that did not change takes the same time for any size of score.
+A cache file is used if the size and modification time of the score still match, or otherwise the hash of its contents.
+The layout depends on the platform, a file of another version, byte order or path is ignored.
+So is a file whose tables are not consistent, the views of a mapped file are not checked when they are used.
+*/
+class ScoreCache
+{
+public:
+	/// What a cache file was made from
+	struct Key
+	{
+		std::uint64_t size;
+		std::int64_t mtime;
+		std::uint64_t hash; ///< IO::Hash64() of the contents
+	};
+
+	/// Cache in \p directory, which is created when the first score is stored
+	explicit ScoreCache(std::filesystem::path directory);
+
+	/// The score in \p fn: from the cache if it is current, otherwise it is read and stored in the cache
+	GPIF Load(const std::filesystem::path& fn) const;
+
+	/// The cached score of \p fn, if there is one and it is current
+	std::optional<GPIF> Find(const std::filesystem::path& fn) const;
+
+	/// Store \p score, read from \p fn with contents \p key
+	void Store(const std::filesystem::path& fn, const GPIF& score, const Key& key) const;
+
+	/// Name of the cache file of \p fn
+	std::filesystem::path CacheFile(const std::filesystem::path& fn) const;
+
+private:
+	std::filesystem::path m_directory;
+};
+
+} // namespace GuitarPro
@@ -0,0 +1,388 @@
+#include <TabLibrary.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+
+#include <MappedFile.h>
+#include <Parallel.h>
+
+
+namespace GuitarPro
+{
+
+namespace
+{
+
+namespace fs = std::filesystem;
+
+constexpr std::array<char, 8> g_catalogMagic = {'M', 'O', 'O', 'E', 'R', 'T', 'A', 'B'};
+constexpr std::uint32_t g_catalogVersion = 2;
+
+/// Limits of what a catalog file can hold, larger values mean it is corrupt
+constexpr std::uint32_t g_maxText = 1 << 20;
+constexpr std::uint32_t g_maxCount = 1 << 16;
+
+
+bool IsScoreFile(const fs::path& fn)
+{
+	auto ext = fn.extension().string();
+	std::transform(begin(ext), end(ext), begin(ext), [](unsigned char c) { return std::tolower(c); });
+	return ext == ".gp3" || ext == ".gp4" || ext == ".gp5" || ext == ".gpx" || ext == ".gp";
+}
+
+
+/// The path as it is stored in a catalog, which is also how entries are matched to files
+std::string PathKey(const fs::path& fn)
+{
+	const auto path = fn.generic_u8string();
+	return std::string(begin(path), end(path));
+}
+
+
+template<typename T>
+void write(std::ostream& os, const T& v)
+{
+	static_assert(std::is_trivially_copyable_v<T>);
+	os.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+
+void writeString(std::ostream& os, std::string_view s)
+{
+	write<std::uint32_t>(os, s.size());
+	os.write(s.data(), s.size());
+}
+
+
+template<typename T>
+T read(std::istream& is)
+{
+	static_assert(std::is_trivially_copyable_v<T>);
+	T v;
+	is.read(reinterpret_cast<char*>(&v), sizeof(T));
+	if(!is)
+		throw std::runtime_error("TabLibrary: catalog file is truncated");
+	return v;
+}
+
+
+/// A size or count, throws if it is larger than \p max
+std::uint32_t readSize(std::istream& is, std::uint32_t max)
+{
+	const auto n = read<std::uint32_t>(is);
+	if(n > max)
+		throw std::runtime_error("TabLibrary: catalog file is corrupt");
+	return n;
+}
+
+
+std::string readString(std::istream& is)
+{
+	std::string s(readSize(is, g_maxText), '\0');
+	is.read(s.data(), s.size());
+	if(!is)
+		throw std::runtime_error("TabLibrary: catalog file is truncated");
+	return s;
+}
+
+} // namespace
+
+
+TabLibrary::Format TabLibrary::GetFormat(std::span<const char> data)
+{
+	const std::string_view start(data.data(), std::min<std::size_t>(data.size(), 64));
+	if(start.starts_with("PK"))
+		return Format::GP;
+	if(ReaderV6::isValid(data))
+		return Format::GPX;
+	if(ReaderV345::isValid(data))
+	{
+		// The version is in "FICHIER GUITAR PRO v5.00"
+		const auto v = start.find(" v");
+		switch(v != std::string_view::npos && v + 2 < start.size() ? start[v + 2] : 0)
+		{
+		case '3':
+			return Format::GP3;
+		case '4':
+			return Format::GP4;
+		case '5':
+			return Format::GP5;
+		}
+	}
+	throw std::runtime_error("Not a GuitarPro file");
+}
+
+
+ScoreInfo TabLibrary::ReadInfo(std::span<const char> data, Format format)
+{
+	switch(format)
+	{
+	case Format::GP3:
+	case Format::GP4:
+	case Format::GP5:
+		return ReaderV345::ReadInfo(data);
+	case Format::GPX:
+		return ReaderV6::ReadInfo(data);
+	case Format::GP:
+		return ReaderV78::ReadInfo(data);
+	}
+	throw std::runtime_error("Not a GuitarPro file");
+}
+
+
+GPIF TabLibrary::ReadScore(const std::filesystem::path& fn, Format format)
+{
+	switch(format)
+	{
+	case Format::GP3:
+	case Format::GP4:
+	case Format::GP5:
+		return ReaderV345::Read(fn);
+	case Format::GPX:
+		return ReaderV6::Read(fn);
+	case Format::GP:
+		return ReaderV78::Read(fn);
+	}
+	throw std::runtime_error("Not a GuitarPro file");
+}
+
+
+TabLibrary::ScanStatistics TabLibrary::Scan(std::span<const std::filesystem::path> directories)
+{
+	struct Candidate
+	{
+		Entry entry;
+		const Entry* previous;
+		bool previousFailed;
+		bool valid;
+	};
+
+	// The entry of each file at the previous scan, and whether it failed
+	std::unordered_map<std::string, std::pair<const Entry*, bool>> previous;
+	for(const auto& e : m_entries)
+		previous[PathKey(e.path)] = {&e, false};
+	for(const auto& e : m_failed)
+		previous[PathKey(e.path)] = {&e, true};
+
+	std::vector<Candidate> candidates;
+	for(const auto& dir : directories)
+	{
+		std::error_code ec;
+		for(fs::recursive_directory_iterator it(dir, fs::directory_options::skip_permission_denied, ec), end;
+			!ec && it != end;
+			it.increment(ec))
+		{
+			if(!IsScoreFile(it->path()) || !it->is_regular_file(ec))
+				continue;
+			Candidate c{};
+			c.entry.path = it->path();
+			c.entry.size = it->file_size(ec);
+			c.entry.mtime = it->last_write_time(ec).time_since_epoch().count();
+			if(auto prev = previous.find(PathKey(c.entry.path)); prev != previous.end())
+				std::tie(c.previous, c.previousFailed) = prev->second;
+			candidates.push_back(std::move(c));
+		}
+	}
+	std::sort(begin(candidates), end(candidates), [](auto& a, auto& b) { return a.entry.path < b.entry.path; });
+	candidates.erase(std::unique(begin(candidates),
+								 end(candidates),
+								 [](auto& a, auto& b) { return a.entry.path == b.entry.path; }),
+					 end(candidates));
+
+	std::atomic<int> nrRead = 0;
+	Parallel::For(candidates.size(),
+				  [&](std::size_t n)
+				  {
+					  Candidate& c = candidates[n];
+					  const Entry* prev = c.previous;
+					  auto keep = [&]
+					  {
+						  c.entry.hash = prev->hash;
+						  c.entry.format = prev->format;
+						  c.entry.info = prev->info;
+						  c.valid = !c.previousFailed;
+					  };
+					  if(prev != nullptr && prev->mtime == c.entry.mtime && prev->size == c.entry.size)
+						  return keep();
+					  try
+					  {
+						  IO::MappedFile mf(c.entry.path);
+						  c.entry.hash = IO::Hash64(mf.data());
+						  if(prev != nullptr && prev->hash == c.entry.hash)
+							  return keep();
+						  nrRead++;
+						  const std::span data(reinterpret_cast<const char*>(mf.data().data()), mf.size());
+						  c.entry.format = GetFormat(data);
+						  c.entry.info = ReadInfo(data, c.entry.format);
+						  c.valid = true;
+					  }
+					  catch(std::runtime_error&)
+					  {
+						  c.valid = false;
+					  }
+				  });
+
+	ScanStatistics stats;
+	stats.nrRead = nrRead;
+	std::vector<Entry> entries, failed;
+	for(auto& c : candidates)
+	{
+		(c.valid ? entries : failed).push_back(std::move(c.entry));
+	}
+	stats.nrFiles = entries.size();
+	stats.nrFailed = failed.size();
+
+	for(const auto& e : m_entries)
+	{
+		auto found = std::lower_bound(
+			begin(entries), end(entries), e.path, [](const Entry& a, const fs::path& b) { return a.path < b; });
+		if(found == end(entries) || found->path != e.path)
+			stats.nrRemoved++;
+	}
+
+	m_entries = std::move(entries);
+	m_failed = std::move(failed);
+	UpdateSearchTexts();
+	return stats;
+}
+
+
+std::vector<std::uint32_t> TabLibrary::Find(std::string_view text) const
+{
+	std::string needle(text);
+	std::transform(begin(needle), end(needle), begin(needle), [](unsigned char c) { return std::toupper(c); });
+
+	std::vector<std::uint32_t> r;
+	for(std::uint32_t n = 0; n < m_entries.size(); n++)
+	{
+		if(m_searchTexts[n].find(needle) != std::string::npos)
+			r.push_back(n);
+	}
+	return r;
+}
+
+
+void TabLibrary::Save(const std::filesystem::path& fn) const
+{
+	std::ofstream f(fn, std::ios::binary);
+	if(!f)
+		throw std::runtime_error("TabLibrary: could not write " + fn.string());
+
+	write(f, g_catalogMagic);
+	write(f, g_catalogVersion);
+	write<std::uint32_t>(f, m_entries.size());
+	for(const auto& e : m_entries)
+	{
+		write(f, e.mtime);
+		write(f, e.size);
+		write(f, e.hash);
+		write(f, e.format);
+		writeString(f, PathKey(e.path));
+		writeString(f, e.info.version);
+		writeString(f, e.info.title);
+		writeString(f, e.info.artist);
+		write<std::int32_t>(f, e.info.nrBars);
+		write<std::int32_t>(f, e.info.tempo);
+		write<std::uint32_t>(f, e.info.tracks.size());
+		for(const auto& t : e.info.tracks)
+		{
+			writeString(f, t.name);
+			write<std::uint32_t>(f, t.tuning.size());
+			for(int pitch : t.tuning)
+				write<std::int32_t>(f, pitch);
+		}
+	}
+	write<std::uint32_t>(f, m_failed.size());
+	for(const auto& e : m_failed)
+	{
+		write(f, e.mtime);
+		write(f, e.size);
+		write(f, e.hash);
+		writeString(f, PathKey(e.path));
+	}
+	if(!f)
+		throw std::runtime_error("TabLibrary: could not write " + fn.string());
+}
+
+
+void TabLibrary::Load(const std::filesystem::path& fn)
+{
+	std::ifstream f(fn, std::ios::binary);
+	if(!f)
+		throw std::runtime_error("TabLibrary: could not open " + fn.string());
+
+	if(read<std::array<char, 8>>(f) != g_catalogMagic)
+		throw std::runtime_error("TabLibrary: not a catalog file");
+	if(auto version = read<std::uint32_t>(f); version != g_catalogVersion)
+	{
+		std::stringstream ss;
+		ss << "TabLibrary: catalog version " << version << " is not supported";
+		throw std::runtime_error(ss.str());
+	}
+
+	// The entries are added as they are read, so a corrupt count fails at the end of the file
+	std::vector<Entry> entries;
+	for(auto n = read<std::uint32_t>(f); n > 0; n--)
+	{
+		Entry& e = entries.emplace_back();
+		e.mtime = read<std::int64_t>(f);
+		e.size = read<std::uint64_t>(f);
+		e.hash = read<std::uint64_t>(f);
+		e.format = read<Format>(f);
+		if(e.format > Format::GP)
+			throw std::runtime_error("TabLibrary: catalog file is corrupt");
+		const auto path = readString(f);
+		e.path = std::u8string(begin(path), end(path));
+		e.info.version = readString(f);
+		e.info.title = readString(f);
+		e.info.artist = readString(f);
+		e.info.nrBars = read<std::int32_t>(f);
+		e.info.tempo = read<std::int32_t>(f);
+		e.info.tracks.resize(readSize(f, g_maxCount));
+		for(auto& t : e.info.tracks)
+		{
+			t.name = readString(f);
+			t.tuning.resize(readSize(f, g_maxCount));
+			for(int& pitch : t.tuning)
+				pitch = read<std::int32_t>(f);
+		}
+	}
+	std::vector<Entry> failed;
+	for(auto n = read<std::uint32_t>(f); n > 0; n--)
+	{
+		Entry& e = failed.emplace_back();
+		e.mtime = read<std::int64_t>(f);
+		e.size = read<std::uint64_t>(f);
+		e.hash = read<std::uint64_t>(f);
+		const auto path = readString(f);
+		e.path = std::u8string(begin(path), end(path));
+	}
+
+	m_entries = std::move(entries);
+	m_failed = std::move(failed);
+	UpdateSearchTexts();
+}
+
+
+void TabLibrary::UpdateSearchTexts()
+{
+	m_searchTexts.resize(m_entries.size());
+	for(std::size_t n = 0; n < m_entries.size(); n++)
+	{
+		const ScoreInfo& info = m_entries[n].info;
+		std::string& text = m_searchTexts[n];
+		text = info.title + '\n' + info.artist;
+		for(const auto& t : info.tracks)
+			text += '\n' + t.name;
+		std::transform(begin(text), end(text), begin(text), [](unsigned char c) { return std::toupper(c); });
+	}
+}
+
+} // namespace GuitarPro
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include <GuitarPro.h>
+
+
+namespace GuitarPro
+{
+
+/**
+Catalog of a collection of GuitarPro files, with the ScoreInfo of each.
+
+Files are picked by extension, the format is then told from the first bytes.
+Only the header of a score is read: the song info and tracks of a binary file, the part of a score.gpif up to the
+end of its master bars. The catalog can be saved to disk. A rescan only reads files of which the modification time
+or size changed, and keeps the info of files whose content hash did not change.
+Files that could not be read are kept aside, so they are only read again when they change.
+*/
+class TabLibrary
+{
+public:
+	enum class Format : std::uint8_t
+	{
+		GP3,
+		GP4,
+		GP5,
+		GPX, ///< GuitarPro 6
+		GP,	 ///< GuitarPro 7 and 8
+	};
+
+	struct Entry
+	{
+		std::filesystem::path path;
+		std::int64_t mtime;
+		std::uint64_t size;
+		std::uint64_t hash;
+		Format format;
+		ScoreInfo info;
+	};
+
+	struct ScanStatistics
+	{
+		int nrFiles = 0;   ///< Score files found
+		int nrRead = 0;	   ///< Files that were (re-)read
+		int nrFailed = 0;  ///< Files that could not be parsed, now or at a previous scan if they did not change
+		int nrRemoved = 0; ///< Files no longer on disk
+	};
+
+	/// Format of \p data, by its first bytes. Throws if it is not a GuitarPro file.
+	static Format GetFormat(std::span<const char> data);
+
+	/// The info of the score in \p data, of format \p format
+	static ScoreInfo ReadInfo(std::span<const char> data, Format format);
+
+	/// The whole score in \p fn, of format \p format
+	static GPIF ReadScore(const std::filesystem::path& fn, Format format);
+
+	/// (Re-)scan \p directories recursively for GuitarPro files
+	ScanStatistics Scan(std::span<const std::filesystem::path> directories);
+
+	/// Indices into entries() of the scores with \p text in their title, artist or a track name, ignoring case
+	std::vector<std::uint32_t> Find(std::string_view text) const;
+
+	void Save(const std::filesystem::path& fn) const;
+
+	void Load(const std::filesystem::path& fn);
+
+	const std::vector<Entry>& entries() const
+	{
+		return m_entries;
+	}
+
+	/// Files that could not be read, only their path, modification time, size and hash are set
+	const std::vector<Entry>& failed() const
+	{
+		return m_failed;
+	}
+
+private:
+	void UpdateSearchTexts();
+
+	std::vector<Entry> m_entries;
+	std::vector<Entry> m_failed;
+	std::vector<std::string> m_searchTexts; ///< Upper-case title, artist and track names, one per line
+};
+
+} // namespace GuitarPro
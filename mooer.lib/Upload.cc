@@ -0,0 +1,277 @@
+#include <Upload.h>
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64)
+#include <immintrin.h>
+#if defined(__SSSE3__) || defined(__AVX__)
+#define MOOER_UPLOAD_SSSE3
+#define MOOER_UPLOAD_TARGET
+#elif defined(__GNUC__)
+// Not enabled for the whole build, compile these functions for it and check the CPU at runtime
+#define MOOER_UPLOAD_SSSE3
+#define MOOER_UPLOAD_TARGET __attribute__((target("ssse3")))
+#define MOOER_UPLOAD_DISPATCH
+#endif
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MOOER_UPLOAD_NEON
+#endif
+
+
+namespace Mooer
+{
+
+namespace
+{
+
+using u8 = std::uint8_t;
+
+constexpr int nrWords = 512;   ///< Words per upload, so bytes per plane
+constexpr int maxPlanes = 254; ///< Byte planes of an upload, so that the name frame number also fits in a byte
+
+
+#if defined(MOOER_UPLOAD_SSSE3)
+
+bool HasSsse3()
+{
+#if defined(MOOER_UPLOAD_DISPATCH)
+	static const bool has = __builtin_cpu_supports("ssse3");
+	return has;
+#else
+	return true;
+#endif
+}
+
+
+/// pshufb masks that gather byte plane i of 16 three-byte words, from source vector s of 48 bytes
+constexpr auto g_planes3 = []
+{
+	std::array<std::array<std::array<char, 16>, 3>, 3> m{};
+	for(int i = 0; i < 3; i++)
+		for(int s = 0; s < 3; s++)
+			for(int k = 0; k < 16; k++)
+			{
+				int idx = 3 * k + (2 - i) - 16 * s;
+				m[i][s][k] = idx >= 0 && idx < 16 ? static_cast<char>(idx) : static_cast<char>(0x80);
+			}
+	return m;
+}();
+
+
+MOOER_UPLOAD_TARGET std::size_t Transpose4(const u8* w, std::size_t n, u8* const* p)
+{
+	// Per 4 words: the 4 most significant bytes, then the next, ...
+	const __m128i order = _mm_setr_epi8(3, 7, 11, 15, 2, 6, 10, 14, 1, 5, 9, 13, 0, 4, 8, 12);
+	std::size_t k = 0;
+	for(; k + 16 <= n; k += 16)
+	{
+		auto load = [&](int i) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + 4 * k + 16 * i)); };
+		__m128i v0 = _mm_shuffle_epi8(load(0), order);
+		__m128i v1 = _mm_shuffle_epi8(load(1), order);
+		__m128i v2 = _mm_shuffle_epi8(load(2), order);
+		__m128i v3 = _mm_shuffle_epi8(load(3), order);
+
+		// 4x4 transpose of 32-bit lanes
+		__m128i lo01 = _mm_unpacklo_epi32(v0, v1), lo23 = _mm_unpacklo_epi32(v2, v3);
+		__m128i hi01 = _mm_unpackhi_epi32(v0, v1), hi23 = _mm_unpackhi_epi32(v2, v3);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(p[0] + k), _mm_unpacklo_epi64(lo01, lo23));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(p[1] + k), _mm_unpackhi_epi64(lo01, lo23));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(p[2] + k), _mm_unpacklo_epi64(hi01, hi23));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(p[3] + k), _mm_unpackhi_epi64(hi01, hi23));
+	}
+	return k;
+}
+
+
+MOOER_UPLOAD_TARGET std::size_t Transpose3(const u8* w, std::size_t n, u8* const* p)
+{
+	__m128i mask[3][3];
+	for(int i = 0; i < 3; i++)
+		for(int s = 0; s < 3; s++)
+			mask[i][s] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(g_planes3[i][s].data()));
+
+	std::size_t k = 0;
+	for(; k + 16 <= n; k += 16)
+	{
+		__m128i v[3];
+		for(int s = 0; s < 3; s++)
+			v[s] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + 3 * k + 16 * s));
+		for(int i = 0; i < 3; i++)
+		{
+			__m128i r = _mm_or_si128(_mm_shuffle_epi8(v[0], mask[i][0]), _mm_shuffle_epi8(v[1], mask[i][1]));
+			r = _mm_or_si128(r, _mm_shuffle_epi8(v[2], mask[i][2]));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(p[i] + k), r);
+		}
+	}
+	return k;
+}
+
+#elif defined(MOOER_UPLOAD_NEON)
+
+std::size_t Transpose4(const u8* w, std::size_t n, u8* const* p)
+{
+	std::size_t k = 0;
+	for(; k + 16 <= n; k += 16)
+	{
+		uint8x16x4_t v = vld4q_u8(w + 4 * k);
+		for(int i = 0; i < 4; i++)
+			vst1q_u8(p[i] + k, v.val[3 - i]);
+	}
+	return k;
+}
+
+
+std::size_t Transpose3(const u8* w, std::size_t n, u8* const* p)
+{
+	std::size_t k = 0;
+	for(; k + 16 <= n; k += 16)
+	{
+		uint8x16x3_t v = vld3q_u8(w + 3 * k);
+		for(int i = 0; i < 3; i++)
+			vst1q_u8(p[i] + k, v.val[2 - i]);
+	}
+	return k;
+}
+
+#endif
+
+
+/**
+Frame every byte plane of \p words as [AA 55 size header data checksum], with the plane number in header[2],
+and split the frames into interrupt transfers.
+*/
+UploadFrames Prepare(std::span<const u8> words, int nrPlanes, std::span<const u8> header, std::string_view name)
+{
+	if(words.size() < static_cast<std::size_t>(nrPlanes) * nrWords)
+	{
+		std::stringstream ss;
+		ss << "Upload needs " << nrPlanes * nrWords << " bytes, got " << words.size();
+		throw std::runtime_error(ss.str());
+	}
+
+	const std::size_t szData = header.size() + nrWords;
+	const std::size_t szFrame = 4 + szData + 2;
+	std::vector<u8> frames(nrPlanes * szFrame);
+	std::vector<u8*> planes(nrPlanes);
+	for(int i = 0; i < nrPlanes; i++)
+	{
+		u8* frame = &frames[i * szFrame];
+		frame[0] = 0xAA;
+		frame[1] = 0x55;
+		frame[2] = szData & 0xFF;
+		frame[3] = szData >> 8;
+		std::copy(begin(header), end(header), frame + 4);
+		frame[6] = i + 1;
+		planes[i] = frame + 4 + header.size();
+	}
+	TransposeBytes(words.first(nrPlanes * nrWords), planes);
+
+	UploadFrames r;
+	constexpr std::size_t chunk = UploadFrames::reportSize - 1;
+	r.group = static_cast<RxFrame::Group>(header[0]);
+	r.reportsPerFrame = (szFrame + chunk - 1) / chunk;
+	r.reports.reserve(nrPlanes * r.reportsPerFrame);
+	for(int i = 0; i < nrPlanes; i++)
+	{
+		auto frame = std::span(frames).subspan(i * szFrame, szFrame);
+		auto cc = calculateChecksum(frame.subspan(2, szData + 2));
+		frame[szFrame - 2] = cc >> 8;
+		frame[szFrame - 1] = cc & 0xFF;
+
+		for(std::size_t n = 0; n < szFrame; n += chunk)
+		{
+			auto& report = r.reports.emplace_back();
+			report[0] = std::min(chunk, szFrame - n);
+			std::copy_n(frame.begin() + n, report[0], report.begin() + 1);
+		}
+	}
+
+	// group, slot, plane, kind, name
+	r.name.assign(4 + 15, 0);
+	std::copy(begin(header), end(header), begin(r.name));
+	r.name[2] = nrPlanes + 1;
+	std::copy_n(begin(name), std::min<std::size_t>(name.size(), 15), begin(r.name) + 4);
+	return r;
+}
+
+} // namespace
+
+
+void TransposeBytes(std::span<const std::uint8_t> words, std::span<std::uint8_t* const> planes)
+{
+	const std::size_t nrPlanes = planes.size();
+	if(nrPlanes == 0)
+		return;
+	const std::size_t n = words.size() / nrPlanes;
+
+	std::size_t k = 0;
+#if defined(MOOER_UPLOAD_SSSE3) || defined(MOOER_UPLOAD_NEON)
+#if defined(MOOER_UPLOAD_SSSE3)
+	if(HasSsse3())
+#endif
+	{
+		if(nrPlanes == 4)
+			k = Transpose4(words.data(), n, planes.data());
+		else if(nrPlanes == 3)
+			k = Transpose3(words.data(), n, planes.data());
+	}
+#endif
+	for(; k < n; k++)
+	{
+		for(std::size_t i = 0; i < nrPlanes; i++)
+			planes[i][k] = words[nrPlanes * k + (nrPlanes - 1 - i)];
+	}
+}
+
+
+UploadFrames PrepareAmplifier(std::span<const std::uint8_t> amp, std::string_view name, int slot)
+{
+	const std::array<u8, 4> header{
+		RxFrame::Group::AmpUpload, static_cast<u8>(slot), 0, static_cast<u8>(AmpKind::amp)};
+	return Prepare(amp, 4, header, name);
+}
+
+
+UploadFrames PrepareGNR(std::span<const std::uint8_t> gnrData, std::string_view name, int slot)
+{
+	if(gnrData.size() < sizeof(File::GNR))
+		throw std::runtime_error("GNR too small in size");
+	auto gnr = reinterpret_cast<const File::GNR*>(gnrData.data());
+	auto id = [](const auto& field) { return std::string_view(field.data(), strnlen(field.data(), field.size())); };
+	if(id(gnr->manufacturer) != "mooerge" || id(gnr->infoId) != "info" || id(gnr->dataId) != "data")
+		throw std::runtime_error("Not a GNR file");
+	if(gnr->dataSize == 0 || gnr->dataSize % nrWords != 0 || gnrData.size() - sizeof(File::GNR) < gnr->dataSize)
+	{
+		std::stringstream ss;
+		ss << "GNR data of " << gnr->dataSize << " bytes is not a multiple of " << nrWords << " words, or truncated";
+		throw std::runtime_error(ss.str());
+	}
+	// Planes are numbered from 1 in a byte, and the name frame takes the number after the last plane
+	if(gnr->dataSize / nrWords > maxPlanes)
+	{
+		std::stringstream ss;
+		ss << "GNR data of " << gnr->dataSize << " bytes has more than " << maxPlanes << " byte planes";
+		throw std::runtime_error(ss.str());
+	}
+
+	const std::array<u8, 4> header{
+		RxFrame::Group::AmpUpload, static_cast<u8>(slot), 0, static_cast<u8>(AmpKind::gnr)};
+	auto r = Prepare(gnr->dataSpan(), gnr->dataSize / nrWords, header, name);
+	r.audioStream = true;
+	return r;
+}
+
+
+UploadFrames PrepareCabinet(const CabinetData& ir, std::string_view name, int slot)
+{
+	// Unlike an amplifier there is no kind, but the samples still start after a fourth, zero, header byte
+	const std::array<u8, 4> header{RxFrame::Group::CabinetUpload, static_cast<u8>(slot), 0, 0};
+	return Prepare(ir, 3, header, name);
+}
+
+
+} // namespace Mooer
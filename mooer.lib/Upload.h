@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include <MooerParser.h>
+
+
+namespace Mooer
+{
+
+enum class AmpKind : std::uint8_t
+{
+	amp = 0x05,
+	gnr = 0x15
+};
+
+/**
+Split an array of big-endian words into byte planes, most significant byte first:
+planes[i][n] = words[planes.size() * n + (planes.size() - 1 - i)].
+Uses SSSE3 (selected at runtime) or NEON for 3 and 4 byte words.
+*/
+void TransposeBytes(std::span<const std::uint8_t> words, std::span<std::uint8_t* const> planes);
+
+/**
+An amplifier or cabinet upload, framed and checksummed, ready to send with Parser::SendUpload().
+
+The model is sent as one frame per byte plane, followed by a frame with the name.
+Preparing is independent of a Parser, so several uploads can be prepared in parallel.
+*/
+struct UploadFrames
+{
+	static constexpr int reportSize = 64;
+	using Report = std::array<std::uint8_t, reportSize>;
+
+	/// Interrupt transfers of the frame of byte plane \p n
+	std::span<const Report> frame(int n) const
+	{
+		return std::span(reports).subspan(n * reportsPerFrame, reportsPerFrame);
+	}
+
+	/// Number of byte plane \p n in its frame header, the pedal acknowledges the frame with it
+	int planeNumber(int n) const
+	{
+		// Length byte, AA 55, size, group, slot, plane
+		return frame(n)[0][7];
+	}
+
+	int nrFrames() const
+	{
+		return reportsPerFrame > 0 ? static_cast<int>(reports.size() / reportsPerFrame) : 0;
+	}
+
+	RxFrame::Group group = RxFrame::Group::AmpUpload; ///< Group of the frames, and of the acknowledges of the pedal
+	bool audioStream = false; ///< The audio interface has to be streamed to before the first frame
+	std::size_t reportsPerFrame = 0;
+	std::vector<Report> reports;	///< Interrupt transfers of all byte planes: length byte and up to 63 bytes of frame
+	std::vector<std::uint8_t> name; ///< Payload of the name frame, for Parser::SendWithHeaderAndChecksum()
+};
+
+/// Frames of an .amp file, \p amp holds 512 words of 4 bytes
+UploadFrames PrepareAmplifier(std::span<const std::uint8_t> amp, std::string_view name, int slot);
+
+/**
+Frames of a .gnr profile: its data holds 512 words of any size, 20 bytes for the captured profiles.
+Throws if \p gnr is not a valid .gnr file.
+*/
+UploadFrames PrepareGNR(std::span<const std::uint8_t> gnr, std::string_view name, int slot);
+
+/// Frames of an impulse response
+UploadFrames PrepareCabinet(const CabinetData& ir, std::string_view name, int slot);
+
+} // namespace Mooer
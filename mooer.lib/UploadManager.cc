@@ -0,0 +1,286 @@
+#include <UploadManager.h>
+
+#include <algorithm>
+#include <sstream>
+
+
+namespace Mooer
+{
+
+namespace
+{
+
+/// CRC of a model name, without the padding of the pedal or the name frame
+std::uint16_t NameChecksum(std::string_view name)
+{
+	name = name.substr(0, name.find_last_not_of(std::string_view(" \0", 2)) + 1);
+	return calculateChecksum({reinterpret_cast<const std::uint8_t*>(name.data()), name.size()});
+}
+
+} // namespace
+
+
+UploadManager::UploadManager(Parser& parser, UploadOptions options)
+	: m_parser(parser)
+	, m_options(std::move(options))
+	, m_worker([this](std::stop_token stop) { Run(stop); })
+{
+}
+
+
+UploadManager::~UploadManager()
+{
+	m_worker.request_stop();
+}
+
+
+int UploadManager::Submit(Prepare prepare, Callback callback)
+{
+	int id;
+	{
+		std::lock_guard lock{m_mutex};
+		id = m_nextId++;
+		m_queue.push_back({id, std::move(prepare), std::move(callback)});
+		PrepareNext();
+	}
+	m_cv.notify_all();
+	return id;
+}
+
+
+void UploadManager::Cancel(int job)
+{
+	{
+		std::lock_guard lock{m_mutex};
+		bool queued = std::any_of(begin(m_queue), end(m_queue), [&](const Job& j) { return j.id == job; });
+		if(job != m_current && !queued)
+			return;
+		m_cancelled.insert(job);
+	}
+	m_cv.notify_all();
+}
+
+
+void UploadManager::CancelAll()
+{
+	{
+		std::lock_guard lock{m_mutex};
+		for(const auto& job : m_queue)
+			m_cancelled.insert(job.id);
+		if(m_current >= 0)
+			m_cancelled.insert(m_current);
+	}
+	m_cv.notify_all();
+}
+
+
+void UploadManager::SetVerify(bool verify)
+{
+	std::lock_guard lock{m_mutex};
+	m_options.verify = verify;
+}
+
+
+void UploadManager::OnAcknowledge(const RxFrame::Frame& frame)
+{
+	{
+		std::lock_guard lock{m_mutex};
+		if(m_current < 0)
+			return;
+		const auto namesGroup = m_ackGroup == RxFrame::CabinetUpload ? RxFrame::CabModels : RxFrame::AmpModels;
+		if(frame.group() == m_ackGroup && frame.index() == m_ackPlane)
+			m_acked = true;
+		else if(frame.group() == namesGroup && frame.data.size() >= sizeof(DeviceFormat::AmpModelNames))
+			m_names = DeviceFormat::AmpModelNames(frame.data);
+		else
+			return;
+	}
+	m_cv.notify_all();
+}
+
+
+std::size_t UploadManager::size() const
+{
+	std::lock_guard lock{m_mutex};
+	return m_queue.size() + (m_current >= 0 ? 1 : 0);
+}
+
+
+void UploadManager::Run(std::stop_token stop)
+{
+	while(true)
+	{
+		Job job;
+		{
+			std::unique_lock lock{m_mutex};
+			if(!m_cv.wait(lock, stop, [&] { return !m_queue.empty(); }))
+				return;
+			job = std::move(m_queue.front());
+			m_queue.pop_front();
+			m_current = job.id;
+			PrepareNext();
+		}
+
+		Progress result = isCancelled(job.id) ? Progress{job.id, Progress::Cancelled, 0, 0, {}} : Send(job, stop);
+		{
+			std::lock_guard lock{m_mutex};
+			m_current = -1;
+			m_cancelled.erase(job.id);
+		}
+		if(stop.stop_requested())
+			return; // The owner is being destroyed
+		job.callback(result);
+	}
+}
+
+
+void UploadManager::PrepareNext()
+{
+	if(m_queue.empty() || m_queue.front().frames.valid())
+		return;
+	m_queue.front().frames = std::async(std::launch::async, m_queue.front().prepare);
+}
+
+
+UploadManager::Progress UploadManager::Send(Job& job, std::stop_token stop)
+{
+	Progress p{job.id, Progress::Sending, 0, 0, {}};
+	auto fail = [&](std::string error)
+	{
+		p.status = Progress::Failed;
+		p.error = std::move(error);
+		return p;
+	};
+
+	UploadFrames frames;
+	try
+	{
+		frames = job.frames.get();
+	}
+	catch(std::exception& e)
+	{
+		return fail(e.what());
+	}
+	p.nrPlanes = frames.nrFrames();
+	{
+		std::lock_guard lock{m_mutex};
+		m_ackGroup = frames.group;
+	}
+	job.callback(p);
+
+	// The planes, each acknowledged by the pedal
+	for(int n = 0; n < p.nrPlanes; n++)
+	{
+		bool acknowledged;
+		try
+		{
+			acknowledged = SendAcknowledged(frames, n, job.id, stop, p);
+		}
+		catch(std::exception& e)
+		{
+			return fail(e.what());
+		}
+		if(!acknowledged)
+		{
+			if(stop.stop_requested() || isCancelled(job.id))
+				break;
+			std::stringstream ss;
+			ss << "Byte plane " << n << " not acknowledged after " << m_options.maxAttempts << " attempts";
+			return fail(ss.str());
+		}
+		p.planes = n + 1;
+		job.callback(p);
+	}
+
+	// The name completes the upload, it is not acknowledged but can be read back
+	bool verify;
+	{
+		std::lock_guard lock{m_mutex};
+		verify = m_options.verify;
+	}
+	for(int attempt = 0; !stop.stop_requested() && !isCancelled(job.id); attempt++)
+	{
+		if(attempt == m_options.maxAttempts)
+			return fail("The pedal did not store the name of the upload");
+		if(attempt > 0)
+			p.resent++;
+		bool stored;
+		try
+		{
+			m_parser.SendUploadFrame(frames, p.nrPlanes);
+			stored = !verify || VerifyName(frames, job.id, stop);
+		}
+		catch(std::exception& e)
+		{
+			return fail(e.what());
+		}
+		if(stored)
+		{
+			p.status = Progress::Done;
+			return p;
+		}
+	}
+	p.status = Progress::Cancelled;
+	return p;
+}
+
+
+bool UploadManager::SendAcknowledged(const UploadFrames& frames, int n, int job, std::stop_token stop, Progress& p)
+{
+	for(int attempt = 0; attempt < m_options.maxAttempts; attempt++)
+	{
+		if(stop.stop_requested() || isCancelled(job))
+			return false;
+		if(attempt > 0)
+			p.resent++;
+		{
+			std::lock_guard lock{m_mutex};
+			m_ackPlane = frames.planeNumber(n);
+			m_acked = false;
+		}
+
+		m_parser.SendUploadFrame(frames, n);
+
+		std::unique_lock lock{m_mutex};
+		if(m_cv.wait_for(lock, stop, m_options.ackTimeout, [&] { return m_acked || m_cancelled.contains(job); }))
+		{
+			m_ackPlane = -1;
+			return m_acked;
+		}
+	}
+	std::lock_guard lock{m_mutex};
+	m_ackPlane = -1;
+	return false;
+}
+
+
+bool UploadManager::VerifyName(const UploadFrames& frames, int job, std::stop_token stop)
+{
+	const int slot = frames.name[1];
+	if(slot >= DeviceFormat::AmpModelNames::size())
+		return true; // Not in the names the pedal sends back
+	{
+		std::lock_guard lock{m_mutex};
+		m_names.reset();
+	}
+
+	// The pedal sends the model names along with all presets
+	m_parser.SendPatchListRequest();
+
+	std::unique_lock lock{m_mutex};
+	m_cv.wait_for(lock, stop, m_options.verifyTimeout, [&] { return m_names.has_value() || m_cancelled.contains(job); });
+	if(!m_names.has_value())
+		return false;
+	auto expected = std::string_view(reinterpret_cast<const char*>(frames.name.data()) + 4, frames.name.size() - 4);
+	return NameChecksum((*m_names)[slot]) == NameChecksum(expected);
+}
+
+
+bool UploadManager::isCancelled(int job) const
+{
+	std::lock_guard lock{m_mutex};
+	return m_cancelled.contains(job);
+}
+
+
+} // namespace Mooer
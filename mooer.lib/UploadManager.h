@@ -0,0 +1,139 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <thread>
+
+#include <Upload.h>
+
+
+namespace Mooer
+{
+
+struct UploadOptions
+{
+	/// For the acknowledge of a byte plane
+	std::chrono::milliseconds ackTimeout = std::chrono::seconds(2);
+	int maxAttempts = 3; ///< Sends of a byte plane or name, before the job fails
+
+	/// Read the model names back after an upload, and send the name again if the pedal did not store it
+	bool verify = false;
+	std::chrono::milliseconds verifyTimeout = std::chrono::seconds(5);
+};
+
+/**
+Sends amplifier and cabinet uploads from a background thread, one at a time, in the order they were submitted.
+
+Each byte plane is sent after the pedal acknowledged the previous one, which drives the progress of a job.
+A plane that is not acknowledged is sent again, instead of the whole job. Only an acknowledge with the number of
+the plane that is waited for counts, a late one for a plane that timed out is dropped.
+With UploadOptions::verify, the model names are requested afterwards, and the one in the slot is compared
+with the upload. The pedal does not return the planes themselves, so only their acknowledges confirm them.
+A job can be cancelled before any byte plane, the slot then keeps the planes that were sent.
+While a job is sent, the next one in the queue is already prepared.
+
+The pedal's acknowledges and model names are received by the Listener of the Parser,
+it should pass them to OnAcknowledge().
+*/
+class UploadManager
+{
+public:
+	/// Builds the frames of a job, on a background thread. Exceptions fail the job.
+	using Prepare = std::function<UploadFrames()>;
+
+	struct Progress
+	{
+		enum Status
+		{
+			Sending,
+			Done,
+			Cancelled,
+			Failed
+		};
+
+		int job;
+		Status status;
+		int planes;		   ///< Byte planes acknowledged by the pedal
+		int nrPlanes;	   ///< 0 while the job is not prepared
+		std::string error; ///< Reason of Failed
+		int resent = 0;	   ///< Byte planes and names that were sent again
+	};
+
+	/// Called from the background thread
+	using Callback = std::function<void(const Progress&)>;
+
+	UploadManager(Parser& parser, UploadOptions options = {});
+
+	/// Cancels all jobs, and waits for the one that is being sent to stop
+	~UploadManager();
+
+	UploadManager(const UploadManager&) = delete;
+	UploadManager& operator=(const UploadManager&) = delete;
+
+	/// Queue a job, returns its id
+	int Submit(Prepare prepare, Callback callback);
+
+	/// Cancel a job that is queued or being sent
+	void Cancel(int job);
+
+	void CancelAll();
+
+	/// Enable UploadOptions::verify, for the jobs that start sending afterwards
+	void SetVerify(bool verify);
+
+	/// Pass RxFrame::AmpUpload, RxFrame::CabinetUpload, RxFrame::AmpModels and RxFrame::CabModels frames of the pedal
+	void OnAcknowledge(const RxFrame::Frame& frame);
+
+	/// Jobs that are queued or being sent
+	std::size_t size() const;
+
+private:
+	struct Job
+	{
+		int id = -1;
+		Prepare prepare;
+		Callback callback;
+		std::future<UploadFrames> frames; ///< Valid once the preparation started
+	};
+
+	void Run(std::stop_token stop);
+
+	/// Start preparing the first job in the queue, when it isn't yet. Call with m_mutex locked.
+	void PrepareNext();
+
+	/// Send all planes of \p job, returns its final status
+	Progress Send(Job& job, std::stop_token stop);
+
+	/// Send byte plane or name \p n of \p frames until the pedal acknowledges it, returns false if it never does
+	bool SendAcknowledged(const UploadFrames& frames, int n, int job, std::stop_token stop, Progress& p);
+
+	/// Request the model names, returns true if the slot of \p frames holds its name
+	bool VerifyName(const UploadFrames& frames, int job, std::stop_token stop);
+
+	bool isCancelled(int job) const;
+
+	Parser& m_parser;
+	UploadOptions m_options;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable_any m_cv;
+	std::deque<Job> m_queue;
+	std::set<int> m_cancelled;
+	int m_nextId = 0;
+	int m_current = -1; ///< Job that is being sent
+	RxFrame::Group m_ackGroup = RxFrame::Group::AmpUpload;
+	int m_ackPlane = -1;	///< UploadFrames::planeNumber() of the plane that is waited for, -1 for none
+	bool m_acked = false;	///< The pedal acknowledged m_ackPlane
+	std::optional<DeviceFormat::AmpModelNames> m_names; ///< Read back for the current job
+
+	std::jthread m_worker; ///< Last member, so it stops before the rest is destroyed
+};
+
+} // namespace Mooer
@@ -1,9 +1,12 @@
 #include "UsbConnection.h"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <iostream>
 #include <sstream>
+#include <vector>
 
 // #define DEBUG_LVL_USB
 #ifdef DEBUG_LVL_USB
@@ -39,6 +42,15 @@ struct CheckedLibUsb
 	}
 };
 
+/// Isochronous transfers that are sent as one stream
+struct IsoBatch
+{
+	std::atomic<int> pending;
+	int completed = 0; ///< Set when no transfer is pending, for libusb_handle_events_completed()
+	int status = LIBUSB_TRANSFER_COMPLETED;
+};
+
+
 class DeviceList
 {
 public:
@@ -348,6 +360,81 @@ void Connection::bulk_transfer(unsigned char endpoint, std::span<const std::uint
 }
 
 
+void Connection::iso_transfer(unsigned char endpoint, std::span<const std::uint8_t> data, int packetSize)
+{
+	if(!IsConnected() || data.empty())
+		return;
+
+	constexpr int packetsPerTransfer = 32;
+	const std::size_t bytesPerTransfer = packetsPerTransfer * packetSize;
+	const int timeout_ms = 3 * 1000;
+	auto pData = const_cast<std::uint8_t*>(data.data());
+
+	IsoBatch batch{0};
+	std::vector<libusb_transfer*> transfers;
+	for(std::size_t offset = 0; offset < data.size(); offset += bytesPerTransfer)
+	{
+		const int size = std::min(bytesPerTransfer, data.size() - offset);
+		const int nrPackets = (size + packetSize - 1) / packetSize;
+		auto tf = libusb_alloc_transfer(nrPackets);
+		libusb_fill_iso_transfer(
+			tf, m_device, endpoint, pData + offset, size, nrPackets, &Connection::iso_transfer_cb, &batch, timeout_ms);
+		libusb_set_iso_packet_lengths(tf, packetSize);
+		tf->iso_packet_desc[nrPackets - 1].length = size - (nrPackets - 1) * packetSize;
+		transfers.push_back(tf);
+	}
+
+	batch.pending = transfers.size();
+	int rc = 0;
+	for(std::size_t n = 0; n < transfers.size(); n++)
+	{
+		rc = libusb_submit_transfer(transfers[n]);
+		if(rc != 0)
+		{
+			// The rest is never submitted, only wait for the ones that are
+			if((batch.pending -= transfers.size() - n) == 0)
+				batch.completed = 1;
+			break;
+		}
+	}
+	while(!batch.completed)
+		libusb_handle_events_completed(m_ctx, &batch.completed);
+
+	for(auto tf : transfers)
+		libusb_free_transfer(tf);
+	CheckedLibUsb checked(rc);
+	if(batch.status != LIBUSB_TRANSFER_COMPLETED)
+		throw std::runtime_error(fmt::format("Isochronous transfer failed with status {}", batch.status));
+}
+
+
+void Connection::iso_transfer_cb(libusb_transfer* tf)
+{
+	auto batch = reinterpret_cast<IsoBatch*>(tf->user_data);
+	if(tf->status != LIBUSB_TRANSFER_COMPLETED)
+		batch->status = tf->status;
+	if(--batch->pending == 0)
+		batch->completed = 1;
+}
+
+
+void Connection::claim_interface(int interface_number)
+{
+	if(!IsConnected())
+		return;
+	CheckedLibUsb rx = libusb_claim_interface(m_device, interface_number);
+}
+
+
+void Connection::release_interface(int interface_number)
+{
+	if(!IsConnected())
+		return;
+	// Called from destructors, a device that left cannot be released anyway
+	libusb_release_interface(m_device, interface_number);
+}
+
+
 void Connection::set_interface(int interface_number, int alternate_setting)
 {
 	CheckedLibUsb rx = libusb_set_interface_alt_setting(m_device, interface_number, alternate_setting);
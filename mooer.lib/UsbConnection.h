@@ -71,6 +71,17 @@ public:
 
 	void bulk_transfer(unsigned char endpoint, std::span<const std::uint8_t> data);
 
+	/**
+	Stream \p data to isochronous \p endpoint, in packets of at most \p packetSize bytes.
+	All transfers are submitted at once, so the stream has no gaps. Blocks until all are sent.
+	*/
+	void iso_transfer(unsigned char endpoint, std::span<const std::uint8_t> data, int packetSize);
+
+	/// An interface has to be claimed before its alternate setting is changed
+	void claim_interface(int interface_number);
+
+	void release_interface(int interface_number);
+
 	void set_interface(int interface_number, int alternate_setting);
 
 	void Connect(TransferListener* listener, unsigned char endpoint);
@@ -80,6 +91,8 @@ private:
 
 	static void data_transfer_cb(libusb_transfer* tf);
 
+	static void iso_transfer_cb(libusb_transfer* tf);
+
 	void RunEventLoop();
 
 	std::jthread m_event_worker;
@@ -89,4 +102,29 @@ private:
 	ConnectionListener* m_listener;
 };
 
+
+/// Claims an interface of \p connection for the lifetime of this object
+class ClaimedInterface
+{
+public:
+	ClaimedInterface(Connection& connection, int interface_number)
+		: m_connection(connection)
+		, m_interface(interface_number)
+	{
+		m_connection.claim_interface(m_interface);
+	}
+
+	~ClaimedInterface()
+	{
+		m_connection.release_interface(m_interface);
+	}
+
+	ClaimedInterface(const ClaimedInterface&) = delete;
+	ClaimedInterface& operator=(const ClaimedInterface&) = delete;
+
+private:
+	Connection& m_connection;
+	int m_interface;
+};
+
 } // namespace USB
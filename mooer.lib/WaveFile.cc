@@ -0,0 +1,142 @@
+#include <WaveFile.h>
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+
+namespace RIFF
+{
+
+namespace
+{
+
+constexpr std::size_t headerSize = 12; ///< "RIFF", size, "WAVE"
+
+
+template<typename T>
+T load(const std::uint8_t* p)
+{
+	T v;
+	std::memcpy(&v, p, sizeof(T));
+	return v;
+}
+
+
+/// Sign-extended little-endian 24-bit integer
+std::int32_t load24(const std::uint8_t* p)
+{
+	std::uint32_t v = (std::uint32_t(p[0]) << 8) | (std::uint32_t(p[1]) << 16) | (std::uint32_t(p[2]) << 24);
+	return static_cast<std::int32_t>(v) >> 8;
+}
+
+
+/// Convert \p nrFrames interleaved samples to float, one channel at a time
+template<typename Convert>
+void Deinterleave(Audio& audio,
+				  const std::uint8_t* data,
+				  std::size_t nrFrames,
+				  int bytesPerBlock,
+				  int bytesPerSample,
+				  Convert&& convert)
+{
+	for(int c = 0; c < audio.channels.size(); c++)
+	{
+		auto& channel = audio.channels[c];
+		channel.resize(nrFrames);
+		const std::uint8_t* p = data + c * bytesPerSample;
+		for(std::size_t n = 0; n < nrFrames; n++, p += bytesPerBlock)
+			channel[n] = convert(p);
+	}
+}
+
+} // namespace
+
+
+bool isValidRiff(std::span<const std::uint8_t> riff)
+{
+	if(riff.size() < headerSize)
+		return false;
+	return load<id_t>(riff.data()) == fileTypeId && load<id_t>(riff.data() + 8) == fileFormatId;
+}
+
+
+std::optional<std::span<const std::uint8_t>> FindChunk(std::span<const std::uint8_t> riff, id_t id)
+{
+	if(!isValidRiff(riff))
+		return std::nullopt;
+	riff = riff.subspan(headerSize);
+	while(riff.size() >= sizeof(Chunk))
+	{
+		auto chunkId = load<id_t>(riff.data());
+		auto size = std::min<std::size_t>(load<u32>(riff.data() + 4), riff.size() - sizeof(Chunk));
+		if(chunkId == id)
+			return riff.subspan(sizeof(Chunk), size);
+		// Chunks are word aligned
+		auto next = sizeof(Chunk) + size + (size & 1);
+		if(next >= riff.size())
+			break;
+		riff = riff.subspan(next);
+	}
+	return std::nullopt;
+}
+
+
+Audio Read(std::span<const std::uint8_t> riff)
+{
+	if(!isValidRiff(riff))
+		throw std::runtime_error("Input is not a RIFF wave file");
+	auto fmtChunk = FindChunk(riff, fmtChunkId);
+	auto dataChunk = FindChunk(riff, dataId);
+	if(!fmtChunk || fmtChunk->size() < sizeof(Format) || !dataChunk)
+		throw std::runtime_error("Wave file has no format or data");
+
+	auto fmt = load<Format>(fmtChunk->data());
+	auto audioFormat = fmt.audioFormat;
+	if(audioFormat == Extensible)
+	{
+		if(fmtChunk->size() < sizeof(FormatExtensible))
+			throw std::runtime_error("Wave file has an invalid extensible format");
+		auto ext = load<FormatExtensible>(fmtChunk->data());
+		audioFormat = static_cast<AudioFormat>(ext.subFormat[0] | (ext.subFormat[1] << 8));
+	}
+
+	const int bytesPerSample = fmt.bitsPerSample / 8;
+	if(fmt.nChannels == 0 || fmt.frequency == 0 || bytesPerSample == 0 || fmt.bitsPerSample % 8 != 0 ||
+	   fmt.bytesPerBlock < fmt.nChannels * bytesPerSample)
+		throw std::runtime_error("Wave file has an invalid format");
+
+	Audio audio;
+	audio.frequency = fmt.frequency;
+	audio.channels.resize(fmt.nChannels);
+	const auto nrFrames = dataChunk->size() / fmt.bytesPerBlock;
+	const auto* data = dataChunk->data();
+	auto deinterleave = [&](auto&& convert)
+	{
+		Deinterleave(audio, data, nrFrames, fmt.bytesPerBlock, bytesPerSample, convert);
+	};
+
+	if(audioFormat == PCM && fmt.bitsPerSample == 8)
+		deinterleave([](const std::uint8_t* p) { return (int(p[0]) - 128) / 128.f; });
+	else if(audioFormat == PCM && fmt.bitsPerSample == 16)
+		deinterleave([](const std::uint8_t* p) { return load<std::int16_t>(p) / 32768.f; });
+	else if(audioFormat == PCM && fmt.bitsPerSample == 24)
+		deinterleave([](const std::uint8_t* p) { return load24(p) / 8388608.f; });
+	else if(audioFormat == PCM && fmt.bitsPerSample == 32)
+		deinterleave([](const std::uint8_t* p) { return load<std::int32_t>(p) / 2147483648.f; });
+	else if(audioFormat == IEEE754 && fmt.bitsPerSample == 32)
+		deinterleave([](const std::uint8_t* p) { return load<float>(p); });
+	else if(audioFormat == IEEE754 && fmt.bitsPerSample == 64)
+		deinterleave([](const std::uint8_t* p) { return static_cast<float>(load<double>(p)); });
+	else
+	{
+		std::stringstream ss;
+		ss << "Wave format " << audioFormat << " with " << fmt.bitsPerSample << " bits is not supported";
+		throw std::runtime_error(ss.str());
+	}
+	return audio;
+}
+
+
+} // namespace RIFF
@@ -2,6 +2,9 @@
 
 #include <array>
 #include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
 
 
 namespace RIFF
@@ -20,7 +23,8 @@ constexpr id_t dataId = {'d', 'a', 't', 'a'};
 enum AudioFormat : std::uint16_t
 {
 	PCM = 1,
-	IEEE754 = 3
+	IEEE754 = 3,
+	Extensible = 0xFFFE ///< Actual format is in FormatExtensible::subFormat
 };
 
 struct Chunk
@@ -30,6 +34,7 @@ struct Chunk
 	std::uint8_t data[];
 };
 
+/// Canonical header, the fmt chunk is not necessarily the first, nor this size
 struct Master
 {
 	id_t fileTypeId;   // RIFF
@@ -49,28 +54,43 @@ struct Master
 };
 static_assert(sizeof(Master) + sizeof(Chunk) == 44);
 
-bool isValidRiff(std::span<const std::uint8_t> riff)
+/// Contents of the "fmt " chunk
+struct Format
 {
-	if(riff.size() < sizeof(Master))
-		return false;
-	auto hdr = reinterpret_cast<const Master*>(riff.data());
-	return (hdr->fileTypeId == fileTypeId) && (hdr->fileFormatId == fileFormatId);
-}
+	AudioFormat audioFormat;
+	u16 nChannels;
+	u32 frequency;
+	u32 bytesPerSec;
+	u16 bytesPerBlock;
+	u16 bitsPerSample;
+};
+static_assert(sizeof(Format) == 16);
 
-std::optional<std::span<const std::uint8_t>> FindChunk(std::span<const std::uint8_t> riff, id_t id)
+struct FormatExtensible : Format
 {
-	if(!isValidRiff(riff))
-		return std::nullopt;
-	u32 idx = sizeof(Master);
-	while(riff.size() > sizeof(Chunk))
-	{
-		auto hdr = reinterpret_cast<const Chunk*>(riff.data());
-		if(hdr->dataId == id)
-			return std::span<const std::uint8_t>{&hdr->data[0], hdr->dataSize};
-		riff = riff.subspan(sizeof(Chunk) + hdr->dataSize);
-	}
-	return std::nullopt;
+	u16 extensionSize;
+	u16 validBitsPerSample;
+	u32 channelMask;
+	std::array<std::uint8_t, 16> subFormat; ///< GUID, starting with the AudioFormat
 };
+static_assert(sizeof(FormatExtensible) == 40);
+
+/// Decoded samples
+struct Audio
+{
+	u32 frequency;
+	std::vector<std::vector<float>> channels; ///< Samples in [-1, 1]
+};
+
+bool isValidRiff(std::span<const std::uint8_t> riff);
+
+/// Data of the first chunk with \p id, std::nullopt if there is none
+std::optional<std::span<const std::uint8_t>> FindChunk(std::span<const std::uint8_t> riff, id_t id);
 
+/**
+Decode a wave file: 8, 16, 24 or 32 bit PCM, or 32 or 64 bit IEEE floats, any number of channels.
+Throws std::runtime_error if the file is invalid or the format is not supported.
+*/
+Audio Read(std::span<const std::uint8_t> riff);
 
 } // namespace RIFF
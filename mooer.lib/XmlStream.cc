@@ -0,0 +1,294 @@
+#include <XmlStream.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <stdexcept>
+
+
+namespace XML
+{
+
+namespace
+{
+
+bool isSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+
+bool isBlank(std::string_view s)
+{
+	return std::all_of(begin(s), end(s), isSpace);
+}
+
+
+void AppendUtf8(std::string& dst, std::uint32_t c)
+{
+	if(c < 0x80)
+	{
+		dst += static_cast<char>(c);
+	}
+	else if(c < 0x800)
+	{
+		dst += static_cast<char>(0xC0 | (c >> 6));
+		dst += static_cast<char>(0x80 | (c & 0x3F));
+	}
+	else if(c < 0x10000)
+	{
+		dst += static_cast<char>(0xE0 | (c >> 12));
+		dst += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+		dst += static_cast<char>(0x80 | (c & 0x3F));
+	}
+	else
+	{
+		dst += static_cast<char>(0xF0 | (c >> 18));
+		dst += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+		dst += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+		dst += static_cast<char>(0x80 | (c & 0x3F));
+	}
+}
+
+
+/// Decode the entity at the start of \p s into \p dst, returns its length, or 0 if it is not known
+std::size_t DecodeEntity(std::string_view s, std::string& dst)
+{
+	constexpr std::pair<std::string_view, char> predefined[] = {
+		{"&lt;", '<'}, {"&gt;", '>'}, {"&amp;", '&'}, {"&quot;", '"'}, {"&apos;", '\''}};
+	for(auto [entity, c] : predefined)
+	{
+		if(s.starts_with(entity))
+		{
+			dst += c;
+			return entity.size();
+		}
+	}
+
+	auto semicolon = s.find(';');
+	if(!s.starts_with("&#") || semicolon == std::string_view::npos)
+		return 0;
+	const bool hex = s.size() > 2 && s[2] == 'x';
+	const char* first = s.data() + (hex ? 3 : 2);
+	const char* last = s.data() + semicolon;
+	std::uint32_t c = 0;
+	auto [ptr, ec] = std::from_chars(first, last, c, hex ? 16 : 10);
+	if(ec != std::errc() || ptr != last || first == last || c > 0x10FFFF)
+		return 0;
+	AppendUtf8(dst, c);
+	return semicolon + 1;
+}
+
+} // namespace
+
+
+std::string_view find(const Attributes& attributes, std::string_view name)
+{
+	auto it = std::find_if(begin(attributes), end(attributes), [&](const auto& a) { return a.first == name; });
+	return it != end(attributes) ? it->second : std::string_view{};
+}
+
+
+//-- Tokenizer --
+
+Tokenizer::Tokenizer(Handler& handler)
+	: m_handler(handler)
+{
+}
+
+
+void Tokenizer::Feed(std::string_view chunk)
+{
+	m_buffer.erase(0, m_pos);
+	m_pos = 0;
+	m_buffer.append(chunk);
+	while(Next())
+		;
+}
+
+
+void Tokenizer::Finish()
+{
+	auto rest = std::string_view(m_buffer).substr(m_pos);
+	if(!isBlank(rest) || m_depth != 0)
+		throw std::runtime_error("XML document ends inside an element");
+	m_buffer.clear();
+	m_pos = 0;
+}
+
+
+bool Tokenizer::Next()
+{
+	const std::string_view buffer = m_buffer;
+	if(m_pos >= buffer.size())
+		return false;
+
+	// Character data, up to the next tag
+	if(buffer[m_pos] != '<')
+	{
+		auto lt = buffer.find('<', m_pos);
+		if(lt == std::string_view::npos)
+			return false;
+		auto text = buffer.substr(m_pos, lt - m_pos);
+		m_pos = lt;
+		if(!isBlank(text))
+			m_handler.OnText(Decode(text));
+		return true;
+	}
+
+	auto rest = buffer.substr(m_pos);
+	auto skipTo = [&](std::string_view terminator)
+	{
+		auto end = rest.find(terminator);
+		if(end == std::string_view::npos)
+			return false;
+		m_pos += end + terminator.size();
+		return true;
+	};
+
+	if(rest.starts_with("<?"))
+		return skipTo("?>");
+	if(rest.starts_with("<!--"))
+		return skipTo("-->");
+	if(rest.starts_with("<![CDATA["))
+	{
+		auto end = rest.find("]]>");
+		if(end == std::string_view::npos)
+			return false;
+		m_handler.OnText(rest.substr(9, end - 9));
+		m_pos += end + 3;
+		return true;
+	}
+	if(rest.starts_with("<!"))
+	{
+		// Document type, possibly with an internal subset in brackets
+		int brackets = 0;
+		for(std::size_t i = 2; i < rest.size(); i++)
+		{
+			if(rest[i] == '[')
+				brackets++;
+			else if(rest[i] == ']')
+				brackets--;
+			else if(rest[i] == '>' && brackets <= 0)
+			{
+				m_pos += i + 1;
+				return true;
+			}
+		}
+		return false;
+	}
+	if(rest.size() < 2)
+		return false;
+
+	if(rest[1] == '/')
+	{
+		auto gt = rest.find('>');
+		if(gt == std::string_view::npos)
+			return false;
+		auto name = rest.substr(2, gt - 2);
+		name = name.substr(0, std::find_if(begin(name), end(name), isSpace) - begin(name));
+		if(m_depth == 0)
+			throw std::runtime_error("XML end tag without a start tag");
+		m_pos += gt + 1;
+		m_depth--;
+		m_handler.OnEndElement(name);
+		return true;
+	}
+
+	// A start tag ends at the first '>' outside of an attribute value
+	char quote = 0;
+	for(std::size_t i = 1; i < rest.size(); i++)
+	{
+		const char c = rest[i];
+		if(quote != 0)
+		{
+			if(c == quote)
+				quote = 0;
+		}
+		else if(c == '"' || c == '\'')
+		{
+			quote = c;
+		}
+		else if(c == '>')
+		{
+			const bool empty = rest[i - 1] == '/';
+			auto tag = rest.substr(1, i - 1 - (empty ? 1 : 0));
+			m_pos += i + 1;
+			StartTag(tag);
+			if(empty)
+				m_handler.OnEndElement(tag.substr(0, std::find_if(begin(tag), end(tag), isSpace) - begin(tag)));
+			else
+				m_depth++;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+void Tokenizer::StartTag(std::string_view tag)
+{
+	auto nameEnd = std::find_if(begin(tag), end(tag), isSpace) - begin(tag);
+	auto name = tag.substr(0, nameEnd);
+
+	// The values are decoded into m_values first, so views into them stay valid
+	m_attributes.clear();
+	std::size_t nrValues = 0;
+	for(auto s = tag.substr(nameEnd);;)
+	{
+		s.remove_prefix(std::find_if_not(begin(s), end(s), isSpace) - begin(s));
+		auto eq = s.find('=');
+		if(s.empty() || eq == std::string_view::npos)
+			break;
+		auto attrName = s.substr(0, eq);
+		attrName = attrName.substr(0, std::find_if(begin(attrName), end(attrName), isSpace) - begin(attrName));
+		s.remove_prefix(eq + 1);
+		s.remove_prefix(std::find_if_not(begin(s), end(s), isSpace) - begin(s));
+		if(s.empty() || (s[0] != '"' && s[0] != '\''))
+			throw std::runtime_error("XML attribute value without quotes");
+		auto close = s.find(s[0], 1);
+		if(close == std::string_view::npos)
+			throw std::runtime_error("XML attribute value without closing quote");
+
+		if(m_values.size() <= nrValues)
+			m_values.resize(nrValues + 1);
+		m_values[nrValues++] = Decode(s.substr(1, close - 1));
+		m_attributes.emplace_back(attrName, std::string_view{});
+		s.remove_prefix(close + 1);
+	}
+	for(std::size_t i = 0; i < m_attributes.size(); i++)
+		m_attributes[i].second = m_values[i];
+	m_handler.OnStartElement(name, m_attributes);
+}
+
+
+std::string_view Tokenizer::Decode(std::string_view s)
+{
+	if(s.find_first_of("&\r") == std::string_view::npos)
+		return s;
+
+	m_decoded.clear();
+	for(std::size_t i = 0; i < s.size(); i++)
+	{
+		if(s[i] == '&')
+		{
+			if(auto n = DecodeEntity(s.substr(i), m_decoded); n > 0)
+			{
+				i += n - 1;
+				continue;
+			}
+		}
+		else if(s[i] == '\r')
+		{
+			// Line ends are normalized to '\n'
+			m_decoded += '\n';
+			if(i + 1 < s.size() && s[i + 1] == '\n')
+				i++;
+			continue;
+		}
+		m_decoded += s[i];
+	}
+	return m_decoded;
+}
+
+} // namespace XML
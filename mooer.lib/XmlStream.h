@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+namespace XML
+{
+
+/// Attributes of an element, name and decoded value
+using Attributes = std::vector<std::pair<std::string_view, std::string_view>>;
+
+/// Value of attribute \p name, empty if it is missing
+std::string_view find(const Attributes& attributes, std::string_view name);
+
+/// Receives the elements of a document, all views are only valid during the call
+class Handler
+{
+public:
+	virtual ~Handler() = default;
+
+	virtual void OnStartElement(std::string_view name, const Attributes& attributes) {};
+	virtual void OnEndElement(std::string_view name) {};
+
+	/// Character data or CDATA, with entities decoded. Character data of only whitespace is skipped.
+	virtual void OnText(std::string_view text) {};
+};
+
+/**
+Incremental XML tokenizer: the document is fed in chunks of any size, and passed to a Handler as it is tokenized.
+Only the token that is split by a chunk boundary is buffered, so memory does not grow with the document.
+
+Processing instructions, comments and the document type are skipped. Entities are decoded like pugixml does:
+the predefined ones and character references, others are kept as they are.
+*/
+class Tokenizer
+{
+public:
+	explicit Tokenizer(Handler& handler);
+
+	/// Tokenize the next part of the document
+	void Feed(std::string_view chunk);
+
+	/// The document is complete, throws if it ends inside a token or an element
+	void Finish();
+
+private:
+	/// Tokenize m_buffer from m_pos, returns false if the next token is incomplete
+	bool Next();
+
+	void StartTag(std::string_view tag);
+
+	/// Decode entities and line ends of \p s into m_decoded, returns m_decoded
+	std::string_view Decode(std::string_view s);
+
+	Handler& m_handler;
+	std::string m_buffer;
+	std::size_t m_pos = 0;
+	int m_depth = 0;
+	std::string m_decoded;
+	Attributes m_attributes;
+	std::vector<std::string> m_values; ///< Decoded attribute values
+};
+
+} // namespace XML